@@ -0,0 +1,515 @@
+// Headless highlighting benchmark.
+//
+//   malachite_bench [--output results.json] [--edits N] [file or folder ...]
+//
+// Runs the lexer, Parser and completion index against an offscreen
+// QTextDocument for every corpus entry (synthetic modules plus any .py files
+// given on the command line), plus the piece table on a 300 MB file and file
+// decoding on 64 MB, and writes the numbers as JSON, so releases can be compared.
+
+#include <QGuiApplication>
+#include <QTextDocument>
+#include <QTextCursor>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QSysInfo>
+#include <QTextStream>
+#include <QTemporaryFile>
+#include "scr/parser/parser.h"
+#include "scr/parser/lexer.h"
+#include "scr/parser/tokencache.h"
+#include "scr/text/identifierindex.h"
+#include "scr/text/fuzzymatcher.h"
+#include "scr/text/piecetable.h"
+#include "scr/text/textcodec.h"
+
+namespace {
+
+struct CorpusEntry {
+    QString name;
+    QString text;
+};
+
+// Typical code: classes, methods, strings, comments and numbers
+QString syntheticModule(int lines)
+{
+    QString text;
+    text.reserve(lines * 40);
+    int written = 0;
+    for (int n = 0; written < lines; ++n) {
+        text += QStringLiteral("@dataclass\n"
+                               "class Model%1(BaseModel):\n"
+                               "    \"\"\"Generated model %1.\"\"\"\n"
+                               "    def __init__(self, value=0x%1, name='model_%1'):\n"
+                               "        self.value = value * 1.5e3  # scale\n"
+                               "        self.name = f\"{name}_{value!r:>8}\"\n"
+                               "        if isinstance(value, int) and value > %1:\n"
+                               "            raise ValueError(\"too big: %s\" % value)\n"
+                               "        return None\n"
+                               "\n").arg(n);
+        written += 10;
+    }
+    return text;
+}
+
+// Code written by and for Russian speakers: Cyrillic comments, docstrings
+// and messages, all of it in cp1251 too
+QString cyrillicModule(int lines)
+{
+    QString text;
+    text.reserve(lines * 50);
+    int written = 0;
+    for (int n = 0; written < lines; ++n) {
+        text += QStringLiteral("# Модель №%1 — данные пользователя\n"
+                               "class Запись%1:\n"
+                               "    \"\"\"Хранит «значение» и имя записи %1.\"\"\"\n"
+                               "    def __init__(self, значение=%1, имя='запись_%1'):\n"
+                               "        self.значение = значение  # начальное значение\n"
+                               "        if значение < 0:\n"
+                               "            raise ValueError(\"Отрицательное значение: %s\" % значение)\n"
+                               "        print(f\"Создана запись {имя}, ёмкость {значение}\")\n"
+                               "\n").arg(n);
+        written += 9;
+    }
+    return text;
+}
+
+// Triple quoted strings with f-string fields nested across lines
+QString nestedTripleStrings(int lines)
+{
+    QString text;
+    int written = 0;
+    for (int n = 0; written < lines; ++n) {
+        text += QStringLiteral("doc%1 = f'''header {value %1 +\n"
+                               "    len(\"\"\"inner\"\"\")} and {items[%1]:>{width}}\n"
+                               "    plain ''' + \"\"\"\n"
+                               "    second 'block' with \\\"\"\" escapes\n"
+                               "    \"\"\"\n").arg(n);
+        written += 5;
+    }
+    return text;
+}
+
+// Very long lines, e.g. generated data tables
+QString longLines(int lines, int width)
+{
+    QString line;
+    while (line.size() < width) {
+        line += QStringLiteral("'key_%1': [%1, 0x%1, \"v%1\"], ").arg(line.size());
+    }
+    line.truncate(width);
+
+    QString text;
+    text.reserve(lines * (width + 16));
+    for (int n = 0; n < lines; ++n) {
+        text += QStringLiteral("row_%1 = {").arg(n);
+        text += line;
+        text += QStringLiteral("}\n");
+    }
+    return text;
+}
+
+QVector<CorpusEntry> loadFiles(const QStringList &paths)
+{
+    QVector<CorpusEntry> entries;
+    auto addFile = [&entries](const QString &path) {
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly)) {
+            entries.append({QFileInfo(path).fileName(), QString::fromUtf8(file.readAll())});
+        }
+    };
+
+    for (const QString &path : paths) {
+        if (QFileInfo(path).isDir()) {
+            QDirIterator it(path, QStringList() << "*.py", QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                addFile(it.next());
+            }
+        } else {
+            addFile(path);
+        }
+    }
+    return entries;
+}
+
+// Raw lexer throughput, no document involved
+QJsonObject benchLexer(const QString &text)
+{
+    const QStringList lines = text.split(QLatin1Char('\n'));
+    QVector<Token> tokens;
+
+    QElapsedTimer timer;
+    timer.start();
+    LexState state;
+    qint64 tokenCount = 0;
+    for (const QString &line : lines) {
+        tokens.clear();
+        Lexer::tokenize(line, state, tokens);
+        tokenCount += tokens.size();
+    }
+    const qint64 ns = timer.nsecsElapsed();
+
+    QJsonObject result;
+    result["ns"] = double(ns);
+    result["tokens"] = double(tokenCount);
+    result["ns_per_line"] = double(ns) / qMax(1, int(lines.size()));
+    return result;
+}
+
+// One full highlight of a fresh document
+qint64 fullHighlight(Parser &parser)
+{
+    QElapsedTimer timer;
+    timer.start();
+    parser.rehighlight();
+    return timer.nsecsElapsed();
+}
+
+// Average cost of inserting `ch` at random positions, undone after each edit
+QJsonObject benchEdits(QTextDocument &doc, Parser &parser, QChar ch, int edits)
+{
+    QRandomGenerator random(42);
+    qint64 totalNs = 0;
+    qint64 totalBlocks = 0;
+    int maxBlocks = 0;
+
+    for (int i = 0; i < edits; ++i) {
+        const int position = random.bounded(qMax(1, doc.characterCount() - 1));
+        QTextCursor cursor(&doc);
+        cursor.setPosition(position);
+
+        QElapsedTimer timer;
+        timer.start();
+        cursor.insertText(QString(ch));
+        totalNs += timer.nsecsElapsed();
+        totalBlocks += parser.lastEditBlockCount();
+        maxBlocks = qMax(maxBlocks, parser.lastEditBlockCount());
+
+        doc.undo();
+    }
+
+    QJsonObject result;
+    result["edits"] = edits;
+    result["ns_per_edit"] = edits ? double(totalNs) / edits : 0.0;
+    result["blocks_per_edit"] = edits ? double(totalBlocks) / edits : 0.0;
+    result["max_blocks"] = maxBlocks;
+    return result;
+}
+
+// Buffer identifier index: initial scan, upkeep per edit and the per-keystroke lookup
+QJsonObject benchCompletion(const QString &text, int edits)
+{
+    QTextDocument doc;
+    doc.setPlainText(text);
+
+    QElapsedTimer timer;
+    timer.start();
+    IdentifierIndex index(&doc);
+    const qint64 buildNs = timer.nsecsElapsed();
+
+    QRandomGenerator random(42);
+    qint64 editNs = 0;
+    for (int i = 0; i < edits; ++i) {
+        QTextCursor cursor(&doc);
+        cursor.setPosition(random.bounded(qMax(1, doc.characterCount() - 1)));
+        timer.restart();
+        cursor.insertText(QStringLiteral("x"));
+        editNs += timer.nsecsElapsed();
+        doc.undo();
+    }
+
+    // One and two letter queries have the most matches, the worst case
+    QStringList queries;
+    for (char c = 'a'; c <= 'z'; ++c) {
+        queries << QString(QLatin1Char(c)) << QString(QLatin1Char(c)) + QLatin1Char('e');
+    }
+    queries << "_" << "self" << "gtattr" << "np_arr";
+    qint64 lookupNs = 0;
+    qint64 maxLookupNs = 0;
+    for (const QString &query : queries) {
+        timer.restart();
+        FuzzyTopK top(50);
+        index.collect(FuzzyMatcher(query), top);
+        const QVector<FuzzyResult> results = top.take();
+        const qint64 ns = timer.nsecsElapsed();
+        lookupNs += ns;
+        maxLookupNs = qMax(maxLookupNs, ns);
+        Q_UNUSED(results)
+    }
+
+    QJsonObject result;
+    result["words"] = index.wordCount();
+    result["build_ns"] = double(buildNs);
+    result["ns_per_edit"] = edits ? double(editNs) / edits : 0.0;
+    result["ns_per_lookup"] = double(lookupNs) / queries.size();
+    result["max_lookup_ns"] = double(maxLookupNs);
+    return result;
+}
+
+// Workspace-sized fuzzy matching: snake and camel case names built from a
+// small vocabulary, so most queries have plenty of candidates
+QJsonObject benchWorkspaceMatching(int names)
+{
+    static const char *const parts[] = {
+        "get", "set", "user", "name", "value", "data", "file", "path", "read", "write",
+        "config", "item", "list", "index", "parse", "token", "node", "tree", "http", "server",
+        "client", "request", "cache", "buffer", "line", "text", "model", "view", "event", "array"
+    };
+    constexpr int partCount = int(sizeof(parts) / sizeof(parts[0]));
+
+    QRandomGenerator random(7);
+    FuzzyCandidates candidates;
+    for (int i = 0; i < names; ++i) {
+        const bool camel = random.bounded(3) == 0;
+        QString name;
+        for (int p = 0, count = 1 + random.bounded(4); p < count; ++p) {
+            QString part = QString::fromLatin1(parts[random.bounded(partCount)]);
+            if (p > 0) {
+                if (camel) {
+                    part[0] = part.at(0).toUpper();
+                } else {
+                    name += QLatin1Char('_');
+                }
+            }
+            name += part;
+        }
+        name += QString::number(i);
+        candidates.append(name);
+    }
+
+    const QStringList queries = {"g", "ga", "gtattr", "np_arr", "usrnm", "cfg", "hsrv", "read_f"};
+    QJsonObject result;
+    result["names"] = candidates.size();
+    QElapsedTimer timer;
+    qint64 totalNs = 0;
+    for (const QString &query : queries) {
+        timer.start();
+        FuzzyTopK top(50);
+        FuzzyMatcher(query).collect(candidates, top);
+        const QVector<FuzzyResult> best = top.take();
+        const qint64 ns = timer.nsecsElapsed();
+        totalNs += ns;
+        result[query] = double(ns);
+        Q_UNUSED(best)
+    }
+    result["ns_per_query"] = double(totalNs) / queries.size();
+    return result;
+}
+
+// Log-like file of `megabytes` through PieceTable: open, scattered edits,
+// and reading a screenful of lines the way LargeFileEdit paints
+QJsonObject benchPieceTable(int megabytes)
+{
+    QJsonObject result;
+    QTemporaryFile file;
+    if (!file.open()) {
+        return result;
+    }
+    const QByteArray line = "2024-01-01 12:00:00 INFO worker-3 request handled in 12 ms status=200\n";
+    QByteArray chunk;
+    while (chunk.size() < 1024 * 1024) {
+        chunk += line;
+    }
+    for (int i = 0; i < megabytes; ++i) {
+        file.write(chunk);
+    }
+    file.flush();
+
+    QElapsedTimer timer;
+    PieceTable table;
+    timer.start();
+    table.load(file.fileName());
+    result["megabytes"] = megabytes;
+    result["lines"] = table.lineCount();
+    result["load_ms"] = timer.nsecsElapsed() / 1e6;
+
+    QRandomGenerator random(11);
+    constexpr int edits = 1000;
+    timer.start();
+    for (int i = 0; i < edits; ++i) {
+        table.insert(table.lineStart(random.bounded(table.lineCount())), "edited\n");
+    }
+    result["ns_per_edit"] = double(timer.nsecsElapsed()) / edits;
+
+    constexpr int screens = 200;
+    timer.start();
+    for (int i = 0; i < screens; ++i) {
+        const int first = random.bounded(table.lineCount());
+        for (int l = first; l < qMin(first + 60, table.lineCount()); ++l) {
+            table.line(l, 64 * 1024);
+        }
+    }
+    result["us_per_screen"] = timer.nsecsElapsed() / 1e3 / screens;
+    return result;
+}
+
+// MB/s of one run of `decode`, best of three
+template<typename Decode>
+double decodeSpeed(const QByteArray &bytes, Decode decode)
+{
+    double best = 0;
+    for (int run = 0; run < 3; ++run) {
+        QElapsedTimer timer;
+        timer.start();
+        const QString text = decode();
+        const qint64 ns = qMax<qint64>(1, timer.nsecsElapsed());
+        Q_UNUSED(text)
+        best = qMax(best, bytes.size() / (1024.0 * 1024.0) / (ns / 1e9));
+    }
+    return best;
+}
+
+// Opening a file: detection plus decoding, in FileLoader sized chunks
+QJsonObject benchDecode(int megabytes)
+{
+    // A module over and over, up to the size asked for
+    auto repeated = [megabytes](const QByteArray &module) {
+        const qsizetype size = qsizetype(megabytes) * 1024 * 1024;
+        QByteArray bytes;
+        bytes.reserve(size + module.size());
+        while (bytes.size() < size) {
+            bytes += module;
+        }
+        return bytes;
+    };
+    const QByteArray utf8 = repeated(syntheticModule(2000).toUtf8());
+    // Multi-byte sequences on every line, and the same text as real cp1251
+    const QString cyrillic = cyrillicModule(2000);
+    TextCodec::Format cp1251Format;
+    cp1251Format.encoding = TextCodec::Encoding::Cp1251;
+    const QByteArray cyrillicUtf8 = repeated(cyrillic.toUtf8());
+    const QByteArray cp1251 = repeated(TextCodec::encode(cyrillic, cp1251Format));
+
+    auto chunked = [](const QByteArray &bytes, TextCodec::Encoding encoding) {
+        TextCodec::Decoder decoder(encoding);
+        QString text;
+        text.reserve(bytes.size());
+        constexpr qsizetype chunk = 1024 * 1024;
+        for (qsizetype i = 0; i < bytes.size(); i += chunk) {
+            decoder.decode(bytes.constData() + i, qMin(chunk, bytes.size() - i), text);
+        }
+        decoder.finish(text);
+        return text;
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    const TextCodec::Format format = TextCodec::detect(utf8.constData(), utf8.size());
+    const double detectNs = double(timer.nsecsElapsed());
+
+    QJsonObject result;
+    result["megabytes"] = megabytes;
+    result["detected"] = TextCodec::name(format.encoding);
+    result["detect_ms"] = detectNs / 1e6;
+    result["utf8_mb_per_s"] = decodeSpeed(utf8, [&]() { return chunked(utf8, TextCodec::Encoding::Utf8); });
+    result["qt_utf8_mb_per_s"] = decodeSpeed(utf8, [&]() { return QString::fromUtf8(utf8); });
+    result["cyrillic_utf8_mb_per_s"] = decodeSpeed(cyrillicUtf8, [&]() {
+        return chunked(cyrillicUtf8, TextCodec::Encoding::Utf8);
+    });
+    result["qt_cyrillic_utf8_mb_per_s"] = decodeSpeed(cyrillicUtf8, [&]() { return QString::fromUtf8(cyrillicUtf8); });
+    result["cp1251_mb_per_s"] = decodeSpeed(cp1251, [&]() { return chunked(cp1251, TextCodec::Encoding::Cp1251); });
+    return result;
+}
+
+QJsonObject benchEntry(const CorpusEntry &entry, int edits)
+{
+    const double megabytes = entry.text.toUtf8().size() / (1024.0 * 1024.0);
+
+    QTextDocument doc;
+    doc.setPlainText(entry.text);
+    const int lines = doc.blockCount();
+
+    Parser parser(&doc);
+
+    // Cold: nothing cached yet. Warm: every line comes from the token cache.
+    TokenCache::instance().clear();
+    const qint64 coldNs = fullHighlight(parser);
+    const qint64 warmNs = fullHighlight(parser);
+
+    QJsonObject highlight;
+    highlight["cold_ns"] = double(coldNs);
+    highlight["warm_ns"] = double(warmNs);
+    highlight["mb_per_s"] = megabytes / (coldNs / 1e9);
+    highlight["ns_per_line"] = double(coldNs) / qMax(1, lines);
+    highlight["warm_mb_per_s"] = megabytes / (warmNs / 1e9);
+    highlight["cache_hit_rate"] = TokenCache::instance().hitRate();
+
+    QJsonObject edit;
+    edit["plain_char"] = benchEdits(doc, parser, QLatin1Char('x'), edits);
+    edit["quote"] = benchEdits(doc, parser, QLatin1Char('"'), edits);
+
+    QJsonObject result;
+    result["name"] = entry.name;
+    result["lines"] = lines;
+    result["megabytes"] = megabytes;
+    result["lexer"] = benchLexer(entry.text);
+    result["highlight"] = highlight;
+    result["edit"] = edit;
+    result["completion"] = benchCompletion(entry.text, edits);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    // No window is ever shown, QTextDocument only needs fonts
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+
+    QString outputPath;
+    int edits = 200;
+    QStringList paths;
+    const QStringList args = app.arguments().mid(1);
+    for (int i = 0; i < args.size(); ++i) {
+        if (args[i] == "--output" && i + 1 < args.size()) {
+            outputPath = args[++i];
+        } else if (args[i] == "--edits" && i + 1 < args.size()) {
+            edits = args[++i].toInt();
+        } else {
+            paths << args[i];
+        }
+    }
+
+    QVector<CorpusEntry> corpus = {
+        {"synthetic_module_100k", syntheticModule(100000)},
+        {"nested_triple_strings", nestedTripleStrings(20000)},
+        {"long_lines_10k", longLines(500, 10000)}
+    };
+    corpus += loadFiles(paths);
+
+    QJsonArray results;
+    for (const CorpusEntry &entry : corpus) {
+        QTextStream(stderr) << "bench: " << entry.name << Qt::endl;
+        results.append(benchEntry(entry, edits));
+    }
+
+    QJsonObject report;
+    report["qt_version"] = QString::fromLatin1(qVersion());
+    report["cpu"] = QSysInfo::currentCpuArchitecture();
+    report["results"] = results;
+    report["workspace_matching"] = benchWorkspaceMatching(500000);
+    report["piece_table"] = benchPieceTable(300);
+    report["decode"] = benchDecode(64);
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (outputPath.isEmpty()) {
+        QTextStream(stdout) << json;
+    } else {
+        QFile file(outputPath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            QTextStream(stderr) << "bench: cannot write " << outputPath << Qt::endl;
+            return 1;
+        }
+        file.write(json);
+    }
+    return 0;
+}
@@ -33,9 +33,16 @@
 #include <QCloseEvent>
 #include <QStatusBar>
 #include <QMenu>
+#include <QListWidget>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QPointer>
+#include <memory>
 #include "../parser/parser.h"
 #include "execute/executer.h"
 #include "../text/CustomTextEdit.h"
+#include "../text/editjournal.h"
 
 App::App(QWidget *parent) 
     : QWidget(parent)
@@ -45,8 +52,12 @@ App::App(QWidget *parent)
     , fileModel(nullptr)
     , fileTree(nullptr)
     , explorerPanel(nullptr)
+    , outlineTree(nullptr)
+    , outlineModel(nullptr)
     , statusBar(nullptr)
+    , largeFileLabel(nullptr)
     , miniWindow(nullptr)
+    , searchEngine(new SearchEngine(this))
 {
     setupUI();
     setupMenuBar();
@@ -55,8 +66,12 @@ App::App(QWidget *parent)
     setupContextMenu();
     setupStatusBar(); 
 
-    tabWidget->newTab();
-    CustomTextEdit *firstEditor = tabWidget->getCurrentEditor();
+    // The last session's tabs, or a fresh one with the greeting
+    CustomTextEdit *firstEditor = nullptr;
+    if (!restoreSession()) {
+        tabWidget->newTab();
+        firstEditor = tabWidget->getCurrentEditor();
+    }
     
     if (firstEditor) {
         firstEditor->setPlainText(
@@ -66,14 +81,16 @@ App::App(QWidget *parent)
             "\n"
             "func()\n"
         );
-        
-        // highlighting 
-        new Parser(firstEditor->document());
+
+        // highlighting comes from the Parser newTab attached
 
         // new context menu
-        setupContextMenu();
+        attachContextMenu();
     }
 
+    // Once the window is up
+    QTimer::singleShot(0, this, &App::offerRecovery);
+
     // Window settings
     setWindowTitle("Malachite IDE");
     setMinimumSize(800, 600);
@@ -103,8 +120,16 @@ void App::setupUI() {
 }
 
 void App::setupContextMenu() {
+    // Once, whatever the first tab is: restored sessions start on placeholders
+    connect(tabWidget, &Tab::currentChanged, this, &App::attachContextMenu);
+    connect(tabWidget, &Tab::currentTabChanged, this, &App::attachContextMenu);
+    attachContextMenu();
+}
+
+void App::attachContextMenu() {
     CustomTextEdit *editor = tabWidget->getCurrentEditor();
-    if (!editor) return;
+    if (!editor || editor->property("hasContextMenu").toBool()) return;
+    editor->setProperty("hasContextMenu", true);
     
     QMenu *contextMenu = new QMenu(editor);
 
@@ -156,26 +181,7 @@ void App::setupContextMenu() {
     connect(pasteAction, &QAction::triggered, editor, &CustomTextEdit::paste);
     
     // connect search action 
-    connect(searchAction, &QAction::triggered, this, [this]() {
-        if (!miniWindow) {
-            miniWindow = new QDialog(this);
-            miniWindow->setWindowTitle("Search Engine");
-            miniWindow->setFixedSize(1000, 800);
-
-            QVBoxLayout *layout = new QVBoxLayout(miniWindow);
-            QLabel *label = new QLabel("Here will our search engine", miniWindow);
-            QPushButton *closeButton = new QPushButton("close", miniWindow);
-
-            layout->addWidget(label);
-            layout->addWidget(closeButton);
-
-            connect(closeButton, &QPushButton::clicked, 
-                miniWindow, &QDialog::close);
-        }
-
-        miniWindow->show();
-        qDebug() << "Search option clicked";
-    });
+    connect(searchAction, &QAction::triggered, this, &App::showSearchEngine);
     
     // set context menu for Text edit
     editor->setContextMenuPolicy(Qt::CustomContextMenu);
@@ -183,10 +189,6 @@ void App::setupContextMenu() {
             [editor, contextMenu](const QPoint &pos) {
                 contextMenu->exec(editor->mapToGlobal(pos));
             });
-    
-    connect(tabWidget, &Tab::currentChanged, this, [this]() {
-        setupContextMenu();
-    });
 }
 
 void App::setupStatusBar() {
@@ -207,8 +209,112 @@ void App::setupStatusBar() {
     statusBar->addPermanentWidget(lineLabel);
     statusBar->addPermanentWidget(indentLabel);
     
+    // Shown while the current tab is in large-file mode
+    largeFileLabel = new QLabel("Large file: limited highlighting", statusBar);
+    largeFileLabel->setStyleSheet("QLabel { padding: 0 8px; border: none; border-left: 1px solid #cbcbcb; }");
+    largeFileLabel->setToolTip("Only the visible lines are highlighted");
+    statusBar->addPermanentWidget(largeFileLabel);
+    
+    connect(tabWidget, &Tab::currentChanged, this, &App::updateLargeFileIndicator);
+    
     // Show cursor info
     updateCursorInfo();
+    updateLargeFileIndicator();
+}
+
+void App::showSearchEngine() {
+    if (!miniWindow) {
+        miniWindow = new QDialog(this);
+        miniWindow->setWindowTitle("Search Engine");
+        miniWindow->setFixedSize(1000, 800);
+
+        QVBoxLayout *layout = new QVBoxLayout(miniWindow);
+        QLineEdit *queryEdit = new QLineEdit(miniWindow);
+        queryEdit->setObjectName("queryEdit");
+        queryEdit->setPlaceholderText("Class, function or module-level name");
+        QListWidget *resultList = new QListWidget(miniWindow);
+        QPushButton *closeButton = new QPushButton("close", miniWindow);
+
+        layout->addWidget(queryEdit);
+        layout->addWidget(resultList, 1);
+        layout->addWidget(closeButton);
+
+        // Every keystroke is a prefix lookup in the workspace index
+        connect(queryEdit, &QLineEdit::textChanged, resultList, [this, resultList](const QString &text) {
+            resultList->clear();
+            const QDir root(searchEngine->rootPath());
+            for (const SymbolLocation &location : searchEngine->find(text.trimmed(), 200)) {
+                const Symbol &symbol = location.symbol;
+                const QString name = symbol.scope.isEmpty() ? symbol.name : symbol.scope + "." + symbol.name;
+                QListWidgetItem *item = new QListWidgetItem(
+                    QString("%1    %2:%3").arg(name, root.relativeFilePath(location.file)).arg(symbol.line + 1),
+                    resultList);
+                item->setData(Qt::UserRole, location.file);
+                item->setData(Qt::UserRole + 1, symbol.line);
+            }
+            resultList->setCurrentRow(0);
+        });
+        connect(queryEdit, &QLineEdit::returnPressed, resultList, [resultList]() {
+            if (resultList->currentItem()) {
+                emit resultList->itemActivated(resultList->currentItem());
+            }
+        });
+        connect(resultList, &QListWidget::itemActivated, this, [this](QListWidgetItem *item) {
+            miniWindow->close();
+            openSymbol(item->data(Qt::UserRole).toString(), item->data(Qt::UserRole + 1).toInt());
+        });
+        connect(closeButton, &QPushButton::clicked, 
+            miniWindow, &QDialog::close);
+    }
+
+    // Start from the word under the cursor
+    QLineEdit *queryEdit = miniWindow->findChild<QLineEdit*>("queryEdit");
+    CustomTextEdit *editor = tabWidget->getCurrentEditor();
+    if (editor) {
+        QTextCursor cursor = editor->textCursor();
+        if (!cursor.hasSelection()) {
+            cursor.select(QTextCursor::WordUnderCursor);
+        }
+        queryEdit->setText(cursor.selectedText().trimmed());
+    }
+    queryEdit->selectAll();
+    queryEdit->setFocus();
+
+    miniWindow->show();
+}
+
+void App::openSymbol(const QString &filePath, int line) {
+    openFileInTab(filePath);
+
+    CustomTextEdit *editor = tabWidget->getCurrentEditor();
+    if (!editor || editor->property("filePath").toString() != filePath) {
+        return;
+    }
+    // Still loading, the tab goes there once the text is in
+    if (editor->property("loading").toBool()) {
+        editor->setProperty("pendingLine", line);
+        return;
+    }
+    QTextCursor cursor(editor->document()->findBlockByNumber(line));
+    editor->setTextCursor(cursor);
+    editor->centerCursor();
+    editor->setFocus();
+}
+
+void App::openOutlineItem(const QModelIndex &index) {
+    CustomTextEdit *editor = tabWidget->getCurrentEditor();
+    const int line = outlineModel->lineAt(index);
+    if (!editor || line < 0) {
+        return;
+    }
+    QTextCursor cursor(editor->document()->findBlockByNumber(line));
+    editor->setTextCursor(cursor);
+    editor->centerCursor();
+    editor->setFocus();
+}
+
+void App::updateLargeFileIndicator() {
+    largeFileLabel->setVisible(Tab::isLargeFile(tabWidget->currentWidget()));
 }
 
 void App::updateCursorInfo() {
@@ -296,6 +402,7 @@ void App::setupMenuBar() {
     
     // Connect for update window title
     connect(tabWidget, &Tab::currentChanged, this, &App::updateWindowTitle);
+    connect(tabWidget, &Tab::fileSaved, this, &App::updateWindowTitle);
     
     // Connect for update cursor info
     connect(tabWidget, &Tab::currentChanged, this, [this]() {
@@ -427,7 +534,32 @@ void App::setupFileExplorer() {
         "}"
     );
     
-    leftLayout->addWidget(fileTree, 1);
+    // Outline of the current tab under the files
+    QWidget *outlinePanel = new QWidget(this);
+    QVBoxLayout *outlineLayout = new QVBoxLayout(outlinePanel);
+    outlineLayout->setContentsMargins(0, 0, 0, 0);
+    outlineLayout->setSpacing(0);
+    
+    QLabel *outlineLabel = new QLabel("Outline");
+    outlineLabel->setAlignment(Qt::AlignCenter);
+    outlineLayout->addWidget(outlineLabel);
+    
+    outlineModel = new OutlineModel(this);
+    outlineTree = new QTreeView(this);
+    outlineTree->setModel(outlineModel);
+    outlineTree->setHeaderHidden(true);
+    outlineTree->setIndentation(14);
+    outlineTree->setUniformRowHeights(true);
+    outlineTree->setStyleSheet(fileTree->styleSheet());
+    outlineLayout->addWidget(outlineTree, 1);
+    
+    QSplitter *explorerSplitter = new QSplitter(Qt::Vertical, explorerPanel);
+    explorerSplitter->addWidget(fileTree);
+    explorerSplitter->addWidget(outlinePanel);
+    explorerSplitter->setSizes(QList<int>() << 400 << 240);
+    explorerSplitter->setChildrenCollapsible(false);
+    explorerSplitter->setHandleWidth(2);
+    leftLayout->addWidget(explorerSplitter, 1);
     
     splitter->insertWidget(0, explorerPanel);
     
@@ -446,6 +578,22 @@ void App::setupFileExplorer() {
 
 void App::setupConnections() {
     connect(fileTree, &QTreeView::doubleClicked, this, &App::onFileDoubleClicked);
+    connect(outlineTree, &QTreeView::activated, this, &App::openOutlineItem);
+    connect(outlineTree, &QTreeView::clicked, this, &App::openOutlineItem);
+    
+    // Workspace symbols: completion in every editor, reindex on save
+    tabWidget->setCompletionSource([this](const FuzzyMatcher &matcher, FuzzyTopK &top) {
+        searchEngine->collect(matcher, top);
+    });
+    connect(tabWidget, &Tab::fileSaved, searchEngine, &SearchEngine::updateFile);
+    connect(searchEngine, &SearchEngine::indexingStarted, this, [this]() {
+        statusBar->showMessage("Indexing workspace...");
+    });
+    connect(searchEngine, &SearchEngine::indexingFinished, this, [this]() {
+        statusBar->showMessage(QString("Indexed %1 files, %2 symbols")
+                                   .arg(searchEngine->fileCount())
+                                   .arg(searchEngine->symbolCount()), 3000);
+    });
     
     // Connect | here we following for cursor in all editors
     connect(tabWidget, &Tab::currentChanged, this, [this]() {
@@ -459,6 +607,7 @@ void App::setupConnections() {
             currentEditorCursorConnection = connect(editor, &CustomTextEdit::cursorPositionChanged,
                                                   this, &App::updateCursorInfo);
         }
+        outlineModel->setTree(editor ? editor->syntaxTree() : nullptr);
         
         updateCursorInfo();
     });
@@ -470,6 +619,12 @@ void App::onFileDoubleClicked(const QModelIndex &index) {
     }
     
     QString filePath = fileModel->filePath(index);
+    
+    // Multi-GB outputs: map and view, don't load
+    if (fileModel->size(index) >= tabWidget->getViewerThreshold()) {
+        tabWidget->openViewerTab(filePath);
+        return;
+    }
     this->openFileInTab(filePath);
 }
 
@@ -483,6 +638,7 @@ void App::openFolder() {
     
     if (!folderPath.isEmpty()) {
         fileTree->setRootIndex(fileModel->index(folderPath));
+        searchEngine->openFolder(folderPath);
     }
 }
 
@@ -589,7 +745,7 @@ void App::openFileInTab(const QString &filePath) {
 }
 
 void App::saveFile() {
-    CustomTextEdit *editor = tabWidget->getCurrentEditor();
+    QWidget *editor = tabWidget->currentWidget();
     if (!editor) return;
     
     // checking 
@@ -607,7 +763,7 @@ void App::saveFile() {
 }
 
 void App::saveAsFile() {
-    CustomTextEdit *editor = tabWidget->getCurrentEditor();
+    QWidget *editor = tabWidget->currentWidget();
     if (!editor) return;
     
     QString currentPath = editor->property("filePath").toString();
@@ -623,15 +779,8 @@ void App::saveAsFile() {
     );
     
     if (!filePath.isEmpty()) {
+        // The tab takes the new path once the file is really written
         tabWidget->saveTabContent(editor, filePath);
-        
-        // updating
-        editor->setProperty("filePath", filePath);
-        editor->setProperty("isModified", false);
-        editor->setProperty("originalContent", editor->toPlainText());
-        
-        tabWidget->updateTabTitle(tabWidget->currentIndex());
-        updateWindowTitle();
     }
 }
 
@@ -655,7 +804,25 @@ void App::executePy() {
     }
     
     QString filePath = tabWidget->getCurrentFilePath();
-    if (!filePath.isEmpty()) {
+    if (Tab::isSaving(editor)) {
+        // Run what the save writes, not what was on disk before it. After
+        // Save As the tab has its path only once the write is through.
+        auto done = std::make_shared<QMetaObject::Connection>();
+        auto failed = std::make_shared<QMetaObject::Connection>();
+        QPointer<CustomTextEdit> target = editor;
+        *done = connect(tabWidget, &Tab::fileSaved, this, [this, done, failed, target](const QString &saved) {
+            if (target && target->property("filePath").toString() == saved) {
+                disconnect(*done);
+                disconnect(*failed);
+                Executer::executePy(saved, this);
+            }
+        });
+        // Nothing runs after a failed save
+        *failed = connect(tabWidget, &Tab::fileSaveFailed, this, [this, done, failed]() {
+            disconnect(*done);
+            disconnect(*failed);
+        });
+    } else if (!filePath.isEmpty()) {
         Executer::executePy(filePath, this);
     } else {
         QMessageBox::warning(this, "Error", "No file to execute!");
@@ -669,9 +836,10 @@ void App::exitApp() {
 void App::closeEvent(QCloseEvent *event) {
     // Check all tabs for unsaved changes
     bool hasUnsavedChanges = false;
+    bool discarding = false;
     
     for (int i = 0; i < tabWidget->count(); ++i) {
-        CustomTextEdit *editor = qobject_cast<CustomTextEdit*>(tabWidget->widget(i));
+        QWidget *editor = tabWidget->widget(i);
         if (editor && editor->property("isModified").toBool()) {
             hasUnsavedChanges = true;
             break;
@@ -687,7 +855,7 @@ void App::closeEvent(QCloseEvent *event) {
         if (reply == QMessageBox::Save) {
             // save all changed tabs
             for (int i = 0; i < tabWidget->count(); ++i) {
-                CustomTextEdit *editor = qobject_cast<CustomTextEdit*>(tabWidget->widget(i));
+                QWidget *editor = tabWidget->widget(i);
                 if (editor && editor->property("isModified").toBool()) {
                     tabWidget->setCurrentIndex(i);
                     QString filePath = editor->property("filePath").toString();
@@ -699,23 +867,94 @@ void App::closeEvent(QCloseEvent *event) {
                             QDir::homePath(),
                             "Python files (*.py);;Text files (*.txt);;All files (*)"
                         );
-                        if (!newFilePath.isEmpty()) {
-                            tabWidget->saveTabContent(editor, newFilePath);
+                        if (newFilePath.isEmpty()) {
+                            // Not saved and not let go: stay open, journal and all
+                            event->ignore();
+                            return;
                         }
+                        tabWidget->saveTabContent(editor, newFilePath);
                     } else {
                         tabWidget->saveTabContent(editor, filePath);
                     }
+                    // Refused right away (still loading, the encoding question)
+                    if (!Tab::isSaving(editor) && editor->property("isModified").toBool()) {
+                        event->ignore();
+                        return;
+                    }
                 }
             }
         } else if (reply == QMessageBox::Cancel) {
             event->ignore();
             return;
+        } else {
+            discarding = true;
         }
     }
     
+    // The tabs above write in parallel; closing waits for all of them and
+    // doesn't happen if one failed, its error is up and the text still here
+    if (tabWidget->hasPendingSaves()) {
+        event->ignore();
+        connect(tabWidget, &Tab::allSavesFinished, this, [this](bool ok) {
+            if (ok) {
+                close();
+            }
+        }, Qt::SingleShotConnection);
+        return;
+    }
+    
+    // Saved tabs dropped their journals already, the rest only go when
+    // the user let them go
+    saveSession();
+    if (discarding) {
+        tabWidget->discardJournals();
+    }
     event->accept();
 }
 
+QString App::sessionFile() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/session.json";
+}
+
+void App::saveSession() {
+    QDir().mkpath(QFileInfo(sessionFile()).path());
+    QSaveFile file(sessionFile());
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QJsonDocument(tabWidget->sessionState()).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+}
+
+bool App::restoreSession() {
+    QFile file(sessionFile());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    return tabWidget->restoreSession(QJsonDocument::fromJson(file.readAll()).object()) > 0;
+}
+
+void App::offerRecovery() {
+    const QStringList journals = EditJournal::orphaned();
+    if (journals.isEmpty()) {
+        return;
+    }
+    
+    QMessageBox::StandardButton reply;
+    reply = QMessageBox::question(this, "Restore unsaved changes",
+                                  QString("Malachite IDE was not closed properly. Restore %1 unsaved document(s)?")
+                                      .arg(journals.size()),
+                                  QMessageBox::Yes | QMessageBox::No);
+    for (const QString &journal : journals) {
+        QString filePath;
+        QString text;
+        if (reply == QMessageBox::Yes && EditJournal::replay(journal, &filePath, &text)) {
+            tabWidget->restoreTab(filePath, text);
+        }
+        // The restored tabs keep journals of their own
+        QFile::remove(journal);
+    }
+}
+
 CustomTextEdit* App::createEditor() {
     return tabWidget->createEditor();
 }
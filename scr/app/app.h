@@ -11,6 +11,8 @@
 #include <QLabel>
 #include <QPoint>
 #include "tab/tab.h"
+#include "engine_search/engine.h"
+#include "outline/outline.h"
 
 class App : public QWidget
 {
@@ -32,6 +34,12 @@ private slots:
     void exitApp();
     void updateWindowTitle();
     void updateCursorInfo();
+    void updateLargeFileIndicator();
+    void showSearchEngine();
+    void openSymbol(const QString &filePath, int line);
+    void openOutlineItem(const QModelIndex &index);
+    // Journals a crashed session left, restored if the user wants them
+    void offerRecovery();
     
     // File Explorer slots
     void onFileDoubleClicked(const QModelIndex &index);
@@ -51,10 +59,16 @@ protected:
 private:
     void setupUI();
     void setupContextMenu();
+    // The menu for the current editor, if it has none yet
+    void attachContextMenu();
     void setupMenuBar();
     void setupFileExplorer();
     void setupConnections();
     void setupStatusBar();
+    // Open files with cursors, scroll positions and folds, kept across runs
+    static QString sessionFile();
+    void saveSession();
+    bool restoreSession();
 
     QMenuBar *menuBar;
     QSplitter *splitter;
@@ -63,10 +77,14 @@ private:
     QFileSystemModel *fileModel;
     QTreeView *fileTree;
     QWidget *explorerPanel;
+    QTreeView *outlineTree;
+    OutlineModel *outlineModel;
     QStatusBar *statusBar;
     QLabel *lineLabel;
     QLabel *indentLabel;
+    QLabel *largeFileLabel;
     QDialog *miniWindow;
+    SearchEngine *searchEngine;
     QMetaObject::Connection currentEditorCursorConnection;
 };
 
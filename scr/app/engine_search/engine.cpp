@@ -0,0 +1,632 @@
+#include "engine.h"
+#include "../../parser/syntaxtree.h"
+#include "../../text/fuzzymatcher.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QFileSystemWatcher>
+#include <QThreadPool>
+#include <QtAlgorithms>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
+#include <iterator>
+
+struct IndexedFile {
+    qint64 modified = 0;
+    qint64 size = 0;
+    QVector<Symbol> symbols;
+};
+
+// One searchable name, key is the lowercased name
+struct NameEntry {
+    QString key;
+    QString file;
+    int symbol;
+};
+
+struct SymbolIndexData {
+    QString root;
+    QHash<QString, IndexedFile> files;
+    QSet<QString> dirs;
+    QVector<NameEntry> names;   // sorted by key
+    std::shared_ptr<const FuzzyCandidates> completions;  // distinct names
+    bool unsaved = false;
+};
+
+namespace {
+
+constexpr quint32 cacheMagic = 0x4d53594d;  // "MSYM"
+constexpr quint32 cacheVersion = 1;
+
+// File system events come in bursts, wait for the burst to end
+constexpr int updateDelayMs = 300;
+constexpr int saveDelayMs = 2000;
+
+struct FileResult {
+    QString path;
+    IndexedFile file;
+    bool exists = false;
+};
+
+bool isSkippedDir(const QString &name)
+{
+    return name == QLatin1String("__pycache__") || name == QLatin1String("node_modules");
+}
+
+bool entryLess(const NameEntry &a, const NameEntry &b)
+{
+    return a.key < b.key;
+}
+
+QString childScope(const QString &scope, const QString &name)
+{
+    return scope.isEmpty() ? name : scope + QLatin1Char('.') + name;
+}
+
+// Classes and defs at any depth, imports and assigned names at module level only
+void collectSymbols(const SyntaxNode &node, int start, const QString &scope, bool moduleLevel,
+                    QVector<Symbol> &symbols)
+{
+    for (int i = 0; i < node.children.size(); ++i) {
+        const SyntaxNode &child = *node.children.at(i);
+        const int line = start + node.childOffsets.at(i);
+
+        switch (child.kind) {
+        case SyntaxNode::Class:
+        case SyntaxNode::Function:
+            if (!child.name.isEmpty()) {
+                symbols.append({child.name, scope, line,
+                                child.kind == SyntaxNode::Class ? Symbol::Class : Symbol::Function});
+            }
+            collectSymbols(child, line, childScope(scope, child.name), false, symbols);
+            break;
+        case SyntaxNode::Block:
+            // if __name__ == ..., try: import x ... still the same scope
+            collectSymbols(child, line, scope, moduleLevel, symbols);
+            break;
+        case SyntaxNode::Import:
+        case SyntaxNode::Statement:
+            if (moduleLevel) {
+                for (const QString &target : child.targets) {
+                    if (!target.contains(QLatin1Char('.'))) {
+                        symbols.append({target, scope, line,
+                                        child.kind == SyntaxNode::Import ? Symbol::Import : Symbol::Variable});
+                    }
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Runs on the pool: same parser the editor uses, on the file's lines
+FileResult indexFile(const QString &path)
+{
+    FileResult result;
+    result.path = path;
+
+    const QFileInfo info(path);
+    result.exists = info.isFile();
+    if (!result.exists) {
+        return result;
+    }
+    result.file.modified = info.lastModified().toMSecsSinceEpoch();
+    result.file.size = info.size();
+
+    // Still recorded, so it isn't looked at again until it changes
+    QFile file(path);
+    if (result.file.size > SearchEngine::maxFileSize || !file.open(QIODevice::ReadOnly)) {
+        return result;
+    }
+
+    QStringList lines = QString::fromUtf8(file.readAll()).split(QLatin1Char('\n'));
+    for (QString &line : lines) {
+        if (line.endsWith(QLatin1Char('\r'))) {
+            line.chop(1);
+        }
+    }
+    const SyntaxNodePtr tree = SyntaxTree::parse(lines, nullptr, TreeEdit{0, -1, int(lines.size()) - 1});
+    collectSymbols(*tree, 0, QString(), true, result.file.symbols);
+    return result;
+}
+
+// Python files below `dirPath`, hidden and cache directories left out
+void scanTree(const QString &dirPath, QStringList &files, QSet<QString> &dirs)
+{
+    QStringList stack{dirPath};
+    while (!stack.isEmpty()) {
+        const QString dir = stack.takeLast();
+        dirs.insert(dir);
+        const QFileInfoList entries = QDir(dir).entryInfoList(
+            QStringList() << "*.py", QDir::Files | QDir::AllDirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+        for (const QFileInfo &entry : entries) {
+            if (entry.isDir()) {
+                if (!isSkippedDir(entry.fileName())) {
+                    stack.append(entry.filePath());
+                }
+            } else {
+                files.append(entry.filePath());
+            }
+        }
+    }
+}
+
+// Drops a deleted directory, its subdirectories and their files
+void removeTree(SymbolIndexData &data, const QString &dir, QSet<QString> &touched)
+{
+    const QString prefix = dir + QLatin1Char('/');
+    for (auto it = data.files.begin(); it != data.files.end();) {
+        if (it.key().startsWith(prefix)) {
+            touched.insert(it.key());
+            it = data.files.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = data.dirs.begin(); it != data.dirs.end();) {
+        if (*it == dir || it->startsWith(prefix)) {
+            it = data.dirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Each distinct name once, with a bonus for how many files define it
+std::shared_ptr<const FuzzyCandidates> buildCompletions(const SymbolIndexData &data)
+{
+    QHash<QString, int> definitions;
+    definitions.reserve(data.names.size());
+    for (auto it = data.files.cbegin(); it != data.files.cend(); ++it) {
+        for (const Symbol &symbol : it->symbols) {
+            ++definitions[symbol.name];
+        }
+    }
+
+    auto candidates = std::make_shared<FuzzyCandidates>();
+    candidates->reserve(int(definitions.size()), int(definitions.size()) * 12);
+    for (auto it = definitions.cbegin(); it != definitions.cend(); ++it) {
+        candidates->append(it.key(), qMin(6, 2 * (31 - qCountLeadingZeroBits(quint32(it.value())))));
+    }
+    return candidates;
+}
+
+bool isCurrent(const IndexedFile &file, const QFileInfo &info)
+{
+    return file.modified == info.lastModified().toMSecsSinceEpoch() && file.size == info.size();
+}
+
+void addNames(const QString &path, const IndexedFile &file, QVector<NameEntry> &names)
+{
+    for (int i = 0; i < file.symbols.size(); ++i) {
+        names.append({file.symbols.at(i).name.toLower(), path, i});
+    }
+}
+
+QHash<QString, IndexedFile> loadCache(const QString &cacheFile, const QString &root)
+{
+    QHash<QString, IndexedFile> files;
+    QFile file(cacheFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return files;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    QString cachedRoot;
+    qint32 count = 0;
+    in >> magic >> version >> cachedRoot >> count;
+    if (magic != cacheMagic || version != cacheVersion || cachedRoot != root) {
+        return files;
+    }
+
+    files.reserve(count);
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString path;
+        IndexedFile entry;
+        qint32 symbolCount = 0;
+        in >> path >> entry.modified >> entry.size >> symbolCount;
+        entry.symbols.reserve(symbolCount);
+        for (qint32 s = 0; s < symbolCount && in.status() == QDataStream::Ok; ++s) {
+            Symbol symbol;
+            quint8 kind = 0;
+            in >> symbol.name >> symbol.scope >> symbol.line >> kind;
+            symbol.kind = Symbol::Kind(kind);
+            entry.symbols.append(symbol);
+        }
+        files.insert(path, entry);
+    }
+
+    // A truncated cache is worth nothing, start over
+    if (in.status() != QDataStream::Ok) {
+        files.clear();
+    }
+    return files;
+}
+
+} // namespace
+
+SearchEngine::SearchEngine(QObject *parent)
+    : QObject(parent)
+    , fsWatcher(new QFileSystemWatcher(this))
+{
+    updateTimer.setSingleShot(true);
+    updateTimer.setInterval(updateDelayMs);
+    connect(&updateTimer, &QTimer::timeout, this, &SearchEngine::startUpdate);
+
+    saveTimer.setSingleShot(true);
+    saveTimer.setInterval(saveDelayMs);
+    connect(&saveTimer, &QTimer::timeout, this, [this]() {
+        QtConcurrent::run(&SearchEngine::saveIndex, index, cacheFile());
+    });
+
+    connect(fsWatcher, &QFileSystemWatcher::directoryChanged, this, &SearchEngine::onDirectoryChanged);
+}
+
+SearchEngine::~SearchEngine()
+{
+    releaseWatchers();
+
+    // Quitting right after a change: write it now, the timer won't fire anymore
+    if (saveTimer.isActive()) {
+        saveIndex(index, cacheFile());
+    }
+}
+
+void SearchEngine::openFolder(const QString &rootPath)
+{
+    const QString path = QDir(rootPath).absolutePath();
+    if (path == root && (index || buildWatcher)) {
+        return;
+    }
+
+    if (saveTimer.isActive()) {
+        saveTimer.stop();
+        QtConcurrent::run(&SearchEngine::saveIndex, index, cacheFile());
+    }
+    releaseWatchers();
+    updateTimer.stop();
+    pendingFiles.clear();
+    pendingDirs.clear();
+    if (!fsWatcher->directories().isEmpty()) {
+        fsWatcher->removePaths(fsWatcher->directories());
+    }
+
+    root = path;
+    index.reset();
+
+    buildWatcher = new QFutureWatcher<SymbolIndexPtr>(this);
+    connect(buildWatcher, &QFutureWatcher<SymbolIndexPtr>::finished, this, &SearchEngine::onBuildFinished);
+    buildWatcher->setFuture(QtConcurrent::run(&SearchEngine::buildIndex, root, cacheFile()));
+    emit indexingStarted();
+}
+
+void SearchEngine::updateFile(const QString &filePath)
+{
+    const QString path = QFileInfo(filePath).absoluteFilePath();
+    if (root.isEmpty() || !path.startsWith(root + QLatin1Char('/')) || !path.endsWith(QLatin1String(".py"))) {
+        return;
+    }
+    pendingFiles.insert(path);
+    updateTimer.start();
+}
+
+void SearchEngine::onDirectoryChanged(const QString &path)
+{
+    pendingDirs.insert(path);
+    updateTimer.start();
+}
+
+void SearchEngine::startUpdate()
+{
+    // One pass at a time; whatever piles up meanwhile goes into the next one
+    if (!index || buildWatcher || updateWatcher || (pendingFiles.isEmpty() && pendingDirs.isEmpty())) {
+        return;
+    }
+
+    const QSet<QString> files = pendingFiles;
+    const QSet<QString> dirs = pendingDirs;
+    pendingFiles.clear();
+    pendingDirs.clear();
+
+    updateWatcher = new QFutureWatcher<SymbolIndexPtr>(this);
+    connect(updateWatcher, &QFutureWatcher<SymbolIndexPtr>::finished, this, &SearchEngine::onUpdateFinished);
+    updateWatcher->setFuture(QtConcurrent::run(&SearchEngine::applyChanges, index, files, dirs));
+}
+
+void SearchEngine::onBuildFinished()
+{
+    const SymbolIndexPtr result = buildWatcher->result();
+    buildWatcher->deleteLater();
+    buildWatcher = nullptr;
+
+    adopt(result);
+    if (result->unsaved) {
+        scheduleSave();
+    }
+    emit indexingFinished();
+    startUpdate();
+}
+
+void SearchEngine::onUpdateFinished()
+{
+    const SymbolIndexPtr result = updateWatcher->result();
+    updateWatcher->deleteLater();
+    updateWatcher = nullptr;
+
+    if (result != index) {
+        adopt(result);
+        scheduleSave();
+    }
+    startUpdate();
+}
+
+void SearchEngine::adopt(const SymbolIndexPtr &data)
+{
+    index = data;
+
+    // Watch new directories, forget removed ones
+    const QStringList watched = fsWatcher->directories();
+    const QSet<QString> current(watched.cbegin(), watched.cend());
+    QStringList added;
+    QStringList removed;
+    for (const QString &dir : data->dirs) {
+        if (!current.contains(dir)) {
+            added << dir;
+        }
+    }
+    for (const QString &dir : watched) {
+        if (!data->dirs.contains(dir)) {
+            removed << dir;
+        }
+    }
+    if (!removed.isEmpty()) {
+        fsWatcher->removePaths(removed);
+    }
+    if (!added.isEmpty()) {
+        fsWatcher->addPaths(added);
+    }
+
+    emit indexUpdated();
+}
+
+void SearchEngine::scheduleSave()
+{
+    saveTimer.start();
+}
+
+void SearchEngine::releaseWatchers()
+{
+    // Running passes finish on their own, their results are just dropped
+    for (QFutureWatcher<SymbolIndexPtr> **watcher : {&buildWatcher, &updateWatcher}) {
+        if (*watcher) {
+            (*watcher)->disconnect(this);
+            (*watcher)->deleteLater();
+            *watcher = nullptr;
+        }
+    }
+}
+
+QString SearchEngine::cacheFile() const
+{
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    const QByteArray id = QCryptographicHash::hash(root.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return dir + "/symbols-" + QString::fromLatin1(id) + ".idx";
+}
+
+int SearchEngine::fileCount() const
+{
+    return index ? int(index->files.size()) : 0;
+}
+
+int SearchEngine::symbolCount() const
+{
+    return index ? int(index->names.size()) : 0;
+}
+
+QVector<SymbolLocation> SearchEngine::find(const QString &prefix, int limit) const
+{
+    QVector<SymbolLocation> result;
+    if (!index || prefix.isEmpty()) {
+        return result;
+    }
+
+    const QString key = prefix.toLower();
+    auto it = std::lower_bound(index->names.cbegin(), index->names.cend(), key,
+                               [](const NameEntry &entry, const QString &k) { return entry.key < k; });
+    for (; it != index->names.cend() && result.size() < limit && it->key.startsWith(key); ++it) {
+        const auto file = index->files.constFind(it->file);
+        if (file != index->files.cend()) {
+            result.append({file->symbols.at(it->symbol), it->file});
+        }
+    }
+    return result;
+}
+
+void SearchEngine::collect(const FuzzyMatcher &matcher, FuzzyTopK &top) const
+{
+    if (index && index->completions) {
+        matcher.collect(*index->completions, top);
+    }
+}
+
+SymbolIndexPtr SearchEngine::buildIndex(const QString &rootPath, const QString &cacheFile)
+{
+    auto data = std::make_shared<SymbolIndexData>();
+    data->root = rootPath;
+
+    const QHash<QString, IndexedFile> cached = loadCache(cacheFile, rootPath);
+    QStringList files;
+    scanTree(rootPath, files, data->dirs);
+
+    // Unchanged files come straight from the cache
+    QStringList stale;
+    for (const QString &path : files) {
+        const auto it = cached.constFind(path);
+        if (it != cached.cend() && isCurrent(*it, QFileInfo(path))) {
+            data->files.insert(path, *it);
+        } else {
+            stale << path;
+        }
+    }
+
+    // The rest is parsed on every core
+    QThreadPool pool;
+    const QList<FileResult> results = QtConcurrent::blockingMapped(&pool, stale, &indexFile);
+    for (const FileResult &result : results) {
+        if (result.exists) {
+            data->files.insert(result.path, result.file);
+        }
+    }
+
+    data->names.reserve(data->files.size() * 16);
+    for (auto it = data->files.cbegin(); it != data->files.cend(); ++it) {
+        addNames(it.key(), it.value(), data->names);
+    }
+    std::sort(data->names.begin(), data->names.end(), entryLess);
+    data->completions = buildCompletions(*data);
+
+    data->unsaved = !stale.isEmpty() || cached.size() != data->files.size();
+    return data;
+}
+
+SymbolIndexPtr SearchEngine::applyChanges(const SymbolIndexPtr &data, const QSet<QString> &files,
+                                          const QSet<QString> &dirs)
+{
+    // Containers are implicitly shared, only what changes gets copied
+    auto next = std::make_shared<SymbolIndexData>(*data);
+    QSet<QString> touched;
+    QSet<QString> reindex;
+
+    for (const QString &dir : dirs) {
+        if (!QFileInfo(dir).isDir()) {
+            removeTree(*next, dir, touched);
+            continue;
+        }
+
+        // New, changed and deleted files directly in `dir`
+        QSet<QString> present;
+        QSet<QString> presentDirs;
+        const QFileInfoList entries = QDir(dir).entryInfoList(
+            QStringList() << "*.py", QDir::Files | QDir::AllDirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+        for (const QFileInfo &entry : entries) {
+            const QString path = entry.filePath();
+            if (entry.isDir()) {
+                if (isSkippedDir(entry.fileName())) {
+                    continue;
+                }
+                presentDirs.insert(path);
+                if (!next->dirs.contains(path)) {
+                    QStringList added;
+                    scanTree(path, added, next->dirs);
+                    reindex.unite(QSet<QString>(added.cbegin(), added.cend()));
+                }
+                continue;
+            }
+            present.insert(path);
+            const auto known = next->files.constFind(path);
+            if (known == next->files.cend() || !isCurrent(*known, entry)) {
+                reindex.insert(path);
+            }
+        }
+
+        QStringList gone;
+        for (auto it = next->files.cbegin(); it != next->files.cend(); ++it) {
+            if (!present.contains(it.key()) && QFileInfo(it.key()).path() == dir) {
+                gone << it.key();
+            }
+        }
+        for (const QString &path : gone) {
+            next->files.remove(path);
+            touched.insert(path);
+        }
+
+        QStringList goneDirs;
+        for (const QString &known : next->dirs) {
+            if (!presentDirs.contains(known) && QFileInfo(known).path() == dir) {
+                goneDirs << known;
+            }
+        }
+        for (const QString &known : goneDirs) {
+            removeTree(*next, known, touched);
+        }
+    }
+
+    // Saved files are reindexed even if the timestamp looks the same
+    reindex.unite(files);
+
+    const QStringList paths(reindex.cbegin(), reindex.cend());
+    QThreadPool pool;
+    const QList<FileResult> results = QtConcurrent::blockingMapped(&pool, paths, &indexFile);
+    for (const FileResult &result : results) {
+        touched.insert(result.path);
+        if (result.exists) {
+            next->files.insert(result.path, result.file);
+        } else {
+            next->files.remove(result.path);
+        }
+    }
+
+    if (touched.isEmpty() && next->dirs == data->dirs) {
+        return data;
+    }
+
+    // Drop the touched files' names and merge their new ones in, no full sort
+    QVector<NameEntry> added;
+    for (const QString &path : touched) {
+        const auto it = next->files.constFind(path);
+        if (it != next->files.cend()) {
+            addNames(path, *it, added);
+        }
+    }
+    std::sort(added.begin(), added.end(), entryLess);
+
+    QVector<NameEntry> kept;
+    kept.reserve(data->names.size());
+    std::copy_if(data->names.cbegin(), data->names.cend(), std::back_inserter(kept),
+                 [&touched](const NameEntry &entry) { return !touched.contains(entry.file); });
+
+    next->names.clear();
+    next->names.reserve(kept.size() + added.size());
+    std::merge(kept.cbegin(), kept.cend(), added.cbegin(), added.cend(),
+               std::back_inserter(next->names), entryLess);
+    next->completions = buildCompletions(*next);
+    next->unsaved = true;
+    return next;
+}
+
+void SearchEngine::saveIndex(const SymbolIndexPtr &data, const QString &cacheFile)
+{
+    if (!data) {
+        return;
+    }
+    QDir().mkpath(QFileInfo(cacheFile).path());
+
+    QSaveFile file(cacheFile);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << cacheMagic << cacheVersion << data->root << qint32(data->files.size());
+    for (auto it = data->files.cbegin(); it != data->files.cend(); ++it) {
+        const IndexedFile &entry = it.value();
+        out << it.key() << entry.modified << entry.size << qint32(entry.symbols.size());
+        for (const Symbol &symbol : entry.symbols) {
+            out << symbol.name << symbol.scope << symbol.line << quint8(symbol.kind);
+        }
+    }
+    file.commit();
+}
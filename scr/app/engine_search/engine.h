@@ -1 +1,107 @@
-// TODO: IT
\ No newline at end of file
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QSet>
+#include <QTimer>
+#include <QFutureWatcher>
+#include <memory>
+
+class QFileSystemWatcher;
+class FuzzyMatcher;
+class FuzzyTopK;
+
+// One definition found in a workspace file
+struct Symbol {
+    enum Kind : quint8 {
+        Class,
+        Function,
+        Import,
+        Variable    // module-level name
+    };
+
+    QString name;
+    QString scope;  // enclosing class/def, empty at module level
+    int line = 0;   // 0-based
+    Kind kind = Variable;
+};
+
+struct SymbolLocation {
+    Symbol symbol;
+    QString file;
+};
+
+// Immutable snapshot of the whole index, built and replaced on worker threads
+struct SymbolIndexData;
+using SymbolIndexPtr = std::shared_ptr<const SymbolIndexData>;
+
+// Workspace symbol index behind completion and "Search in Engine".
+// Built on a thread pool when a folder is opened, saved to the cache
+// directory so the next start only reindexes files whose mtime or size
+// changed, and kept current from file system notifications and saves.
+class SearchEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SearchEngine(QObject *parent = nullptr);
+    ~SearchEngine();
+
+    void openFolder(const QString &rootPath);
+    QString rootPath() const { return root; }
+
+    // Reindex one file, e.g. right after it was saved
+    void updateFile(const QString &filePath);
+
+    // Case-insensitive prefix lookup, a binary search plus `limit` steps
+    QVector<SymbolLocation> find(const QString &prefix, int limit = 100) const;
+    // Fuzzy completion over every distinct name, names defined often rank higher
+    void collect(const FuzzyMatcher &matcher, FuzzyTopK &top) const;
+
+    bool isIndexing() const { return buildWatcher || updateWatcher; }
+    int fileCount() const;
+    int symbolCount() const;
+
+    // Files above this are skipped, they are data rather than code
+    static constexpr qint64 maxFileSize = 4 * 1024 * 1024;
+
+signals:
+    void indexingStarted();
+    void indexingFinished();
+    void indexUpdated();
+
+private slots:
+    void onBuildFinished();
+    void onUpdateFinished();
+    void onDirectoryChanged(const QString &path);
+    void startUpdate();
+
+private:
+    static SymbolIndexPtr buildIndex(const QString &rootPath, const QString &cacheFile);
+    static SymbolIndexPtr applyChanges(const SymbolIndexPtr &data, const QSet<QString> &files, const QSet<QString> &dirs);
+    static void saveIndex(const SymbolIndexPtr &data, const QString &cacheFile);
+
+    void adopt(const SymbolIndexPtr &data);
+    void scheduleSave();
+    void releaseWatchers();
+    QString cacheFile() const;
+
+    QString root;
+    SymbolIndexPtr index;
+
+    QFutureWatcher<SymbolIndexPtr> *buildWatcher = nullptr;
+    QFutureWatcher<SymbolIndexPtr> *updateWatcher = nullptr;
+
+    // Changes waiting for the next update pass
+    QSet<QString> pendingFiles;
+    QSet<QString> pendingDirs;
+    QTimer updateTimer;
+    QTimer saveTimer;
+
+    QFileSystemWatcher *fsWatcher = nullptr;
+};
+
+#endif // ENGINE_H
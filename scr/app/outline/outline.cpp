@@ -0,0 +1,247 @@
+#include "outline.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+bool isSymbol(const SyntaxNode &node)
+{
+    return node.kind == SyntaxNode::Class || node.kind == SyntaxNode::Function;
+}
+
+} // namespace
+
+OutlineModel::OutlineModel(QObject *parent)
+    : QAbstractItemModel(parent)
+{
+}
+
+OutlineModel::~OutlineModel() = default;
+
+void OutlineModel::setTree(SyntaxTree *newTree)
+{
+    if (tree == newTree) {
+        return;
+    }
+    if (tree) {
+        disconnect(tree, &SyntaxTree::treeUpdated, this, &OutlineModel::refresh);
+    }
+
+    beginResetModel();
+    tree = newTree;
+    root.children.clear();
+    root.node.reset();
+    if (tree && tree->root()) {
+        root.node = tree->root();
+        QVector<Entry> entries;
+        symbolsOf(*root.node, 0, entries);
+        root.children.reserve(entries.size());
+        for (const Entry &entry : entries) {
+            root.children.push_back(build(entry, &root));
+            root.children.back()->row = int(root.children.size()) - 1;
+        }
+    }
+    endResetModel();
+
+    if (tree) {
+        connect(tree, &SyntaxTree::treeUpdated, this, &OutlineModel::refresh);
+    }
+}
+
+// Symbols directly under `node`; if/with/try blocks are looked through,
+// the body of a def or class is left to that symbol's own children
+void OutlineModel::symbolsOf(const SyntaxNode &node, int base, QVector<Entry> &out)
+{
+    for (int i = 0; i < node.children.size(); ++i) {
+        const SyntaxNodePtr &child = node.children.at(i);
+        const int offset = base + node.childOffsets.at(i);
+        if (isSymbol(*child)) {
+            out.append(Entry{child, offset});
+        } else if (!child->children.isEmpty()) {
+            symbolsOf(*child, offset, out);
+        }
+    }
+}
+
+std::unique_ptr<OutlineModel::Item> OutlineModel::build(const Entry &entry, Item *parent)
+{
+    auto item = std::make_unique<Item>();
+    item->node = entry.node;
+    item->offset = entry.offset;
+    item->parent = parent;
+
+    QVector<Entry> entries;
+    symbolsOf(*entry.node, 0, entries);
+    item->children.reserve(entries.size());
+    for (const Entry &child : entries) {
+        item->children.push_back(build(child, item.get()));
+        item->children.back()->row = int(item->children.size()) - 1;
+    }
+    return item;
+}
+
+void OutlineModel::refresh()
+{
+    const SyntaxNodePtr node = tree ? tree->root() : SyntaxNodePtr();
+    if (node == root.node) {
+        return;
+    }
+
+    if (!node) {
+        if (!root.children.empty()) {
+            beginRemoveRows(QModelIndex(), 0, int(root.children.size()) - 1);
+            root.children.clear();
+            endRemoveRows();
+        }
+        root.node.reset();
+        return;
+    }
+
+    sync(&root, QModelIndex(), *node);
+    root.node = node;
+}
+
+// Brings item's children in line with the symbols under `node`. Rows that
+// kept their symbol (same node, or same kind and name) stay and keep their
+// view state; only the run in between is removed or inserted.
+void OutlineModel::sync(Item *item, const QModelIndex &index, const SyntaxNode &node)
+{
+    QVector<Entry> fresh;
+    symbolsOf(node, 0, fresh);
+
+    auto &children = item->children;
+    const int oldCount = int(children.size());
+    const int newCount = int(fresh.size());
+
+    const auto same = [](const Item &a, const Entry &b) {
+        return a.node == b.node || (a.node->kind == b.node->kind && a.node->name == b.node->name);
+    };
+    int head = 0;
+    while (head < oldCount && head < newCount && same(*children[head], fresh.at(head))) {
+        ++head;
+    }
+    int tail = 0;
+    while (tail < oldCount - head && tail < newCount - head
+           && same(*children[oldCount - 1 - tail], fresh.at(newCount - 1 - tail))) {
+        ++tail;
+    }
+
+    // In between, pair rows up in order (usually a name being typed) and
+    // remove or insert what's left over
+    const int oldMiddle = oldCount - head - tail;
+    const int newMiddle = newCount - head - tail;
+    const int paired = qMin(oldMiddle, newMiddle);
+    const int first = head + paired;
+    if (oldMiddle > newMiddle) {
+        beginRemoveRows(index, first, head + oldMiddle - 1);
+        children.erase(children.begin() + first, children.begin() + head + oldMiddle);
+        for (int i = first; i < newCount; ++i) {
+            children[i]->row = i;
+        }
+        endRemoveRows();
+    } else if (newMiddle > oldMiddle) {
+        beginInsertRows(index, first, head + newMiddle - 1);
+        std::vector<std::unique_ptr<Item>> added;
+        added.reserve(newMiddle - oldMiddle);
+        for (int i = first; i < head + newMiddle; ++i) {
+            added.push_back(build(fresh.at(i), item));
+        }
+        children.insert(children.begin() + first,
+                        std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+        for (int i = first; i < newCount; ++i) {
+            children[i]->row = i;
+        }
+        endInsertRows();
+    }
+
+    // Kept rows: a reused node means the whole subtree is unchanged
+    for (int i = 0; i < newCount; ++i) {
+        if (i >= first && i < head + newMiddle) {
+            continue;
+        }
+        Item *child = children[i].get();
+        const Entry &entry = fresh.at(i);
+        child->offset = entry.offset;
+        if (child->node == entry.node) {
+            continue;
+        }
+
+        const bool renamed = child->node->kind != entry.node->kind || child->node->name != entry.node->name;
+        const QModelIndex childIndex = createIndex(i, 0, child);
+        sync(child, childIndex, *entry.node);
+        child->node = entry.node;
+        if (renamed) {
+            emit dataChanged(childIndex, childIndex);
+        }
+    }
+}
+
+OutlineModel::Item *OutlineModel::itemAt(const QModelIndex &index) const
+{
+    return index.isValid() ? static_cast<Item *>(index.internalPointer()) : const_cast<Item *>(&root);
+}
+
+QModelIndex OutlineModel::indexOf(Item *item) const
+{
+    return item == &root ? QModelIndex() : createIndex(item->row, 0, item);
+}
+
+int OutlineModel::lineAt(const QModelIndex &index) const
+{
+    if (!index.isValid()) {
+        return -1;
+    }
+    int line = 0;
+    for (const Item *item = itemAt(index); item != &root; item = item->parent) {
+        line += item->offset;
+    }
+    return line;
+}
+
+QModelIndex OutlineModel::index(int row, int column, const QModelIndex &parent) const
+{
+    const Item *item = itemAt(parent);
+    if (column != 0 || row < 0 || row >= int(item->children.size())) {
+        return QModelIndex();
+    }
+    return createIndex(row, 0, item->children[row].get());
+}
+
+QModelIndex OutlineModel::parent(const QModelIndex &index) const
+{
+    if (!index.isValid()) {
+        return QModelIndex();
+    }
+    return indexOf(itemAt(index)->parent);
+}
+
+int OutlineModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.column() > 0) {
+        return 0;
+    }
+    return int(itemAt(parent)->children.size());
+}
+
+int OutlineModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent)
+    return 1;
+}
+
+QVariant OutlineModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid()) {
+        return QVariant();
+    }
+    const Item *item = itemAt(index);
+    switch (role) {
+    case Qt::DisplayRole:
+        return item->node->kind == SyntaxNode::Class ? QStringLiteral("class ") + item->node->name
+                                                     : item->node->name + QStringLiteral("()");
+    case Qt::ToolTipRole:
+        return QStringLiteral("Line %1").arg(lineAt(index) + 1);
+    default:
+        return QVariant();
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef OUTLINE_H
+#define OUTLINE_H
+
+#include <QAbstractItemModel>
+#include <QPointer>
+#include <QVector>
+#include <memory>
+#include <vector>
+#include "../../parser/syntaxtree.h"
+
+// Classes, methods and functions of one document as a tree. Follows the
+// document's SyntaxTree: every reparse is diffed into the model instead of
+// resetting it, and subtrees the parser reused (same node pointer) are
+// skipped without a look, so views keep their expansion and scroll.
+class OutlineModel : public QAbstractItemModel {
+    Q_OBJECT
+
+public:
+    explicit OutlineModel(QObject *parent = nullptr);
+    ~OutlineModel();
+
+    // The tree of the current editor, nullptr for none. Switching resets.
+    void setTree(SyntaxTree *tree);
+
+    // 0-based first line of the symbol, -1 for an invalid index
+    int lineAt(const QModelIndex &index) const;
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &index) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private slots:
+    void refresh();
+
+private:
+    struct Item {
+        SyntaxNodePtr node;
+        int offset = 0;  // first line relative to the parent symbol, as in the tree
+        int row = 0;
+        Item *parent = nullptr;
+        std::vector<std::unique_ptr<Item>> children;
+    };
+
+    // A symbol found under a node, offset relative to that node
+    struct Entry {
+        SyntaxNodePtr node;
+        int offset;
+    };
+
+    static void symbolsOf(const SyntaxNode &node, int base, QVector<Entry> &out);
+    static std::unique_ptr<Item> build(const Entry &entry, Item *parent);
+
+    void sync(Item *item, const QModelIndex &index, const SyntaxNode &node);
+    QModelIndex indexOf(Item *item) const;
+    Item *itemAt(const QModelIndex &index) const;
+
+    QPointer<SyntaxTree> tree;
+    Item root;
+};
+
+#endif // OUTLINE_H
@@ -2,8 +2,14 @@
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QFile>
-#include <QTextStream>
 #include <QFileInfo>
+#include <QJsonArray>
+#include <QPointer>
+#include <QScrollBar>
+#include <QTimer>
+#include "../../text/editjournal.h"
+#include "../../text/fileloader.h"
+#include "../../text/filesaver.h"
 
 // yes i know what i stupid junior without comments
 
@@ -107,6 +113,23 @@ CustomTextEdit* Tab::createEditor()
     editor->setLineNumberFont(QFont("Arial", 10));
     editor->setLineNumberMargin(8);
     
+    if (completionSource) {
+        editor->setCompletionSource(completionSource);
+    }
+    
+    // Undo stack clean state plus line hashes, no text comparisons
+    connect(editor, &CustomTextEdit::fileModified, this, [this, editor](bool modified) {
+        // Text still coming in from the file isn't an edit
+        if (editor->property("loading").toBool()) {
+            return;
+        }
+        editor->setProperty("isModified", modified);
+        updateTabTitle(indexOf(editor));
+        if (!modified && journalOf(editor)) {
+            journalOf(editor)->discard();
+        }
+    });
+    
     return editor;
 }
 
@@ -117,9 +140,9 @@ CustomTextEdit* Tab::getCurrentEditor()
 
 QString Tab::getCurrentFilePath()
 {
-    CustomTextEdit *editor = getCurrentEditor();
-    if (editor) {
-        return editor->property("filePath").toString();
+    QWidget *page = currentWidget();
+    if (page) {
+        return page->property("filePath").toString();
     }
     return QString();
 }
@@ -129,86 +152,410 @@ void Tab::newTab()
     CustomTextEdit *editor = createEditor();
     editor->setProperty("filePath", QString());
     editor->setProperty("isModified", false);
-    editor->setProperty("originalContent", "");
     
     int tabIndex = addTab(editor, "untitled.py");
     setCurrentIndex(tabIndex);
     
     new Parser(editor->document());
+    attachJournal(editor);
     
-    connect(editor, &CustomTextEdit::textChanged, this, [this, editor]() {
-        this->onEditorTextChanged(editor, "");
+    connect(editor, &CustomTextEdit::cursorPositionChanged, this, [this]() {
+        emit cursorPositionChanged();
     });
+}
+
+void Tab::restoreTab(const QString &filePath, const QString &text)
+{
+    CustomTextEdit *editor = createEditor();
+    editor->setProperty("filePath", filePath);
+    
+    // Saved back the way the file on disk is written
+    QFile file(filePath);
+    if (!filePath.isEmpty() && file.open(QIODevice::ReadOnly)) {
+        const QByteArray head = file.read(FileLoader::chunkBytes);
+        setTextFormat(editor, TextCodec::detect(head.constData(), head.size()));
+    }
+    
+    // Journaled again from the start, the old journal can go
+    attachJournal(editor);
+    editor->setPlainText(text);
+    editor->setModified(true);
+    editor->setProperty("isModified", true);
+    
+    if (filePath.isEmpty() || filePath.endsWith(".py", Qt::CaseInsensitive)) {
+        new Parser(editor->document());
+    }
+    
+    // The stale session may have a placeholder for the file, this replaces it
+    int tabIndex = placePage(editor, QString());
+    updateTabTitle(tabIndex);
+    setCurrentIndex(tabIndex);
     
     connect(editor, &CustomTextEdit::cursorPositionChanged, this, [this]() {
         emit cursorPositionChanged();
     });
+    emit currentTabChanged();
+}
+
+void Tab::attachJournal(CustomTextEdit *editor)
+{
+    // Too big to copy around on every compaction, the file on disk has to do
+    if (editor->property("largeFile").toBool()) {
+        return;
+    }
+    EditJournal *journal = new EditJournal(editor->document(), editor->modificationTracker(), editor);
+    journal->setFilePath(editor->property("filePath").toString());
+}
+
+EditJournal *Tab::journalOf(QWidget *page)
+{
+    return page ? page->findChild<EditJournal*>(QString(), Qt::FindDirectChildrenOnly) : nullptr;
+}
+
+void Tab::discardJournals()
+{
+    for (int i = 0; i < count(); ++i) {
+        if (EditJournal *journal = journalOf(widget(i))) {
+            journal->discard();
+        }
+    }
 }
 
 void Tab::openFileInTab(const QString &filePath)
 {
     for (int i = 0; i < count(); ++i) {
-        CustomTextEdit *editor = qobject_cast<CustomTextEdit*>(widget(i));
-        if (editor && editor->property("filePath").toString() == filePath) {
+        // A placeholder gets replaced by what is opened now
+        if (widget(i)->property("filePath").toString() == filePath && !isPlaceholder(widget(i))) {
             setCurrentIndex(i);
             return;
         }
     }
     
-    QFile file(filePath);
-    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QTextStream in(&file);
-        
+    // Too big to lay out at all: piece table over the mapped file
+    if (QFileInfo(filePath).size() >= pieceTableThreshold) {
+        openPieceTableTab(filePath);
+        return;
+    }
+    
+    QFileInfo fileInfo(filePath);
+    const bool largeFile = fileInfo.size() >= largeFileThreshold;
+    
+    CustomTextEdit *editor = createEditor(); 
+    editor->setLargeFileMode(largeFile);
+    editor->syntaxTree()->setEnabled(!largeFile && filePath.endsWith(".py", Qt::CaseInsensitive));
+    editor->identifierIndex()->setEnabled(!largeFile);
+    editor->setProperty("filePath", filePath);
+    editor->setProperty("isModified", false);
+    editor->setProperty("largeFile", largeFile);
+    
+    // The tab is there right away, the text follows from a worker thread
+    editor->setProperty("loading", true);
+    editor->setProperty("loadProgress", 0);
+    editor->setReadOnly(true);
+    editor->document()->setUndoRedoEnabled(false);
+    
+    int tabIndex = placePage(editor, QString());
+    updateTabTitle(tabIndex);
+    setCurrentIndex(tabIndex);
+    
+    connect(editor, &CustomTextEdit::cursorPositionChanged, this, [this]() {
+        emit cursorPositionChanged();
+    });
+    
+    // Owned by the editor, so closing the tab cancels the load.
+    // Large files are shown chunk by chunk, the rest in one go at the end.
+    FileLoader *loader = new FileLoader(filePath, editor);
+    loader->setProgressive(largeFile);
+    connect(loader, &FileLoader::progress, this, [this, editor](int percent) {
+        editor->setProperty("loadProgress", percent);
+        updateTabTitle(indexOf(editor));
+    });
+    connect(loader, &FileLoader::textReady, editor, [editor](const QString &text) {
+        if (editor->document()->isEmpty()) {
+            editor->setPlainText(text);
+        } else {
+            QTextCursor end(editor->document());
+            end.movePosition(QTextCursor::End);
+            end.insertText(text);
+        }
+    });
+    connect(loader, &FileLoader::finished, this, [this, editor, loader]() {
+        loader->deleteLater();
+        setTextFormat(editor, loader->format());
+        finishLoading(editor);
+    });
+    connect(loader, &FileLoader::failed, this, [this, editor, loader](const QString &error) {
+        loader->deleteLater();
+        removeTab(indexOf(editor));
+        editor->deleteLater();
+        QMessageBox::warning(this, "Error", "Error in file opening: " + error);
+        if (count() == 0) {
+            newTab();
+        }
+    });
+    loader->start();
+    
+    emit currentTabChanged();
+}
 
-        in.setAutoDetectUnicode(true);
-        
-        QString fileContent = in.readAll();
-        
-        CustomTextEdit *editor = createEditor(); 
-        editor->setPlainText(fileContent);
-        editor->setProperty("filePath", filePath);
-        editor->setProperty("isModified", false);
-        editor->setProperty("originalContent", fileContent);
-        
-        QFileInfo fileInfo(filePath);
-        QString tabName = fileInfo.fileName();
-        int tabIndex = addTab(editor, tabName);
-        setCurrentIndex(tabIndex);
-        
-        if (filePath.endsWith(".py", Qt::CaseInsensitive)) {
-            new Parser(editor->document());
+void Tab::finishLoading(CustomTextEdit *editor)
+{
+    const QString filePath = editor->property("filePath").toString();
+    const bool largeFile = editor->property("largeFile").toBool();
+    
+    editor->document()->setUndoRedoEnabled(true);
+    editor->setReadOnly(false);
+    editor->setProperty("loading", false);
+    editor->setModified(false);
+    editor->setProperty("isModified", false);
+    updateTabTitle(indexOf(editor));
+    attachJournal(editor);
+    if (EditJournal *journal = journalOf(editor)) {
+        journal->setBaseFile(filePath, textFormat(editor));
+    }
+    
+    if (filePath.endsWith(".py", Qt::CaseInsensitive)) {
+        Parser *parser = new Parser(editor->document());
+        if (largeFile) {
+            // Huge files: only what is on screen, ever
+            parser->highlightViewport(editor);
+        } else {
+            // Big files: visible part first, the rest on a worker thread
+            parser->highlightAsync(editor);
         }
-        
-        connect(editor, &CustomTextEdit::textChanged, this, [this, editor, fileContent]() {
-            this->onEditorTextChanged(editor, fileContent);
-        });
-        
-        connect(editor, &CustomTextEdit::cursorPositionChanged, this, [this]() {
-            emit cursorPositionChanged();
+    }
+    
+    // Where the session left it; folds wait for the syntax tree
+    const QVariant pendingCursor = editor->property("pendingCursor");
+    if (pendingCursor.isValid()) {
+        editor->setProperty("pendingCursor", QVariant());
+        QTextCursor cursor(editor->document());
+        cursor.setPosition(qBound(0, pendingCursor.toInt(), editor->document()->characterCount() - 1));
+        editor->setTextCursor(cursor);
+        const int scroll = editor->property("pendingScroll").toInt();
+        editor->setProperty("pendingScroll", QVariant());
+        // Once the scroll range knows about the text
+        QTimer::singleShot(0, editor, [editor, scroll]() {
+            editor->verticalScrollBar()->setValue(scroll);
         });
-        
-        file.close();
+    }
+    const QVariant pendingFolds = editor->property("pendingFolds");
+    if (pendingFolds.isValid()) {
+        editor->setProperty("pendingFolds", QVariant());
+        QList<int> lines;
+        for (const QVariant &line : pendingFolds.toList()) {
+            lines.append(line.toInt());
+        }
+        editor->restoreFolds(lines);
+    }
+    
+    const QVariant pendingLine = editor->property("pendingLine");
+    if (pendingLine.isValid()) {
+        editor->setProperty("pendingLine", QVariant());
+        editor->setTextCursor(QTextCursor(editor->document()->findBlockByNumber(pendingLine.toInt())));
+        editor->centerCursor();
+    }
+    
+    if (currentWidget() == editor) {
         emit currentTabChanged();
-    } else {
-        QMessageBox::warning(this, "Error", "Error in file opening!");
     }
 }
 
-void Tab::saveTabContent(CustomTextEdit *editor, const QString &filePath)
+void Tab::openPieceTableTab(const QString &filePath)
 {
-    QFile file(filePath);
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&file);
-        QString content = editor->toPlainText();
-        out << content;
-        file.close();
-        
-        editor->setProperty("isModified", false);
-        editor->setProperty("originalContent", content);
-        updateTabTitle(currentIndex());
-    } else {
-        QMessageBox::warning(this, "Error", "Error in file saving!");
+    LargeFileEdit *view = new LargeFileEdit(this);
+    QString error;
+    if (!view->openFile(filePath, &error)) {
+        delete view;
+        QMessageBox::warning(this, "Error", "Error in file opening: " + error);
+        return;
     }
+    view->setProperty("filePath", filePath);
+    view->setProperty("isModified", false);
+    view->setProperty("largeFile", true);
+    
+    connect(view, &LargeFileEdit::modificationChanged, this, [this, view](bool modified) {
+        view->setProperty("isModified", modified);
+        updateTabTitle(indexOf(view));
+    });
+    connect(view, &LargeFileEdit::cursorPositionChanged, this, [this]() {
+        emit cursorPositionChanged();
+    });
+    connect(view, &LargeFileEdit::saved, this, [this, view](const QString &filePath) {
+        view->setProperty("filePath", filePath);
+        updateTabTitle(indexOf(view));
+        emit fileSaved(filePath);
+    });
+    connect(view, &LargeFileEdit::saveFailed, this, [this, view](const QString &filePath, const QString &error) {
+        reportSaveFailure(view, filePath, error);
+    });
+    connect(view, &LargeFileEdit::saveIdle, this, [this, view]() {
+        finishSaving(view);
+    });
+    
+    int tabIndex = placePage(view, QFileInfo(filePath).fileName());
+    setCurrentIndex(tabIndex);
+    emit currentTabChanged();
+}
+
+void Tab::openViewerTab(const QString &filePath)
+{
+    for (int i = 0; i < count(); ++i) {
+        if (widget(i)->property("filePath").toString() == filePath && !isPlaceholder(widget(i))) {
+            setCurrentIndex(i);
+            return;
+        }
+    }
+    
+    LogViewer *viewer = new LogViewer(this);
+    QString error;
+    if (!viewer->openFile(filePath, &error)) {
+        delete viewer;
+        QMessageBox::warning(this, "Error", "Error in file opening: " + error);
+        return;
+    }
+    // Never modified, so save and close leave it alone
+    viewer->setProperty("filePath", filePath);
+    viewer->setProperty("isModified", false);
+    viewer->setProperty("largeFile", true);
+    
+    connect(viewer, &LogViewer::cursorPositionChanged, this, [this]() {
+        emit cursorPositionChanged();
+    });
+    
+    int tabIndex = placePage(viewer, QString());
+    updateTabTitle(tabIndex);
+    setCurrentIndex(tabIndex);
+    emit currentTabChanged();
+}
+
+void Tab::saveTabContent(QWidget *page, const QString &filePath)
+{
+    LargeFileEdit *view = qobject_cast<LargeFileEdit*>(page);
+    if (view) {
+        // The pieces are written on a worker, what's typed meanwhile stays
+        view->setProperty("saving", true);
+        updateTabTitle(indexOf(view));
+        view->saveFile(filePath);
+        return;
+    }
+    
+    CustomTextEdit *editor = qobject_cast<CustomTextEdit*>(page);
+    if (!editor) return;
+    
+    // Half a file would overwrite the whole one
+    if (editor->property("loading").toBool()) {
+        QMessageBox::warning(this, "Error", "The file is still loading.");
+        return;
+    }
+    
+    const QString text = editor->toPlainText();
+    TextCodec::Format format = textFormat(editor);
+    if (format.lossy || !TextCodec::canEncode(text, format.encoding)) {
+        // Either way the file wouldn't get back what's on screen
+        const QString reason = format.lossy
+            ? "The file had bytes that are not valid " + TextCodec::name(format.encoding)
+              + ", saving writes replacement characters in their place."
+            : "The text has characters " + TextCodec::name(format.encoding) + " can't hold.";
+        const QMessageBox::StandardButton reply = QMessageBox::question(
+            this, "Save changes", reason + "\nSave the file as UTF-8 instead?",
+            QMessageBox::Yes | QMessageBox::Cancel);
+        if (reply != QMessageBox::Yes) {
+            return;
+        }
+        format.encoding = TextCodec::Encoding::Utf8;
+        format.bom = false;
+        format.lossy = false;
+        setTextFormat(editor, format);
+    }
+    
+    // Only the copy is made here, encoding and writing happen on a worker.
+    // The revision tells whether the text is still what got written.
+    editor->setProperty("saving", true);
+    updateTabTitle(indexOf(editor));
+    saverFor(editor)->save(filePath, text, format, editor->document()->revision());
+}
+
+FileSaver *Tab::saverFor(CustomTextEdit *editor)
+{
+    FileSaver *saver = editor->findChild<FileSaver*>(QString(), Qt::FindDirectChildrenOnly);
+    if (saver) {
+        return saver;
+    }
+    
+    // Owned by the editor: closing the tab waits for its writes
+    saver = new FileSaver(editor);
+    connect(saver, &FileSaver::saved, this, [this, editor](const QString &filePath, int revision) {
+        if (journalOf(editor)) {
+            journalOf(editor)->setFilePath(filePath);
+        }
+        // Save As: only now is there a file to point at
+        editor->setProperty("filePath", filePath);
+        if (editor->document()->revision() == revision) {
+            editor->setModified(false);
+            if (journalOf(editor)) {
+                journalOf(editor)->setBaseFile(filePath, textFormat(editor));
+            }
+        } else if (journalOf(editor)) {
+            // Typed on while writing, the file is behind the document
+            journalOf(editor)->dropBaseFile();
+        }
+        updateTabTitle(indexOf(editor));
+        emit fileSaved(filePath);
+    });
+    connect(saver, &FileSaver::failed, this, [this, editor](const QString &filePath, const QString &error) {
+        reportSaveFailure(editor, filePath, error);
+    });
+    connect(saver, &FileSaver::idle, this, [this, editor]() {
+        finishSaving(editor);
+    });
+    return saver;
+}
+
+void Tab::reportSaveFailure(QWidget *page, const QString &filePath, const QString &error)
+{
+    saveFailed = true;
+    page->setProperty("closeAfterSave", QVariant());
+    emit fileSaveFailed(filePath, error);
+    // Typing goes on, the message waits for whenever it's looked at
+    QMessageBox *box = new QMessageBox(QMessageBox::Warning, "Error",
+                                       "Error in file saving: " + filePath + "\n" + error,
+                                       QMessageBox::Ok, this);
+    box->setAttribute(Qt::WA_DeleteOnClose);
+    box->open();
+}
+
+void Tab::finishSaving(QWidget *page)
+{
+    page->setProperty("saving", false);
+    updateTabTitle(indexOf(page));
+    if (page->property("closeAfterSave").toBool()) {
+        page->setProperty("closeAfterSave", QVariant());
+        // Typed into while saving: asking again beats losing it
+        if (!page->property("isModified").toBool()) {
+            removePage(page);
+        }
+    }
+    if (!hasPendingSaves()) {
+        const bool ok = !saveFailed;
+        saveFailed = false;
+        emit allSavesFinished(ok);
+    }
+}
+
+bool Tab::isSaving(QWidget *page)
+{
+    return page && page->property("saving").toBool();
+}
+
+bool Tab::hasPendingSaves() const
+{
+    for (int i = 0; i < count(); ++i) {
+        if (isSaving(widget(i))) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void Tab::closeCurrentTab()
@@ -220,27 +567,47 @@ void Tab::closeTab(int index)
 {
     if (index < 0) return;
     
-    CustomTextEdit *editor = qobject_cast<CustomTextEdit*>(widget(index));
-    if (editor && editor->property("isModified").toBool()) {
+    QWidget *page = widget(index);
+    if (page && page->property("isModified").toBool()) {
         QMessageBox::StandardButton reply;
         reply = QMessageBox::question(this, "Save changes", 
                                     "The document has been modified. Do you want to save changes?",
                                     QMessageBox::Save | QMessageBox::Discard | QMessageBox::Cancel);
         
         if (reply == QMessageBox::Save) {
-            QString filePath = editor->property("filePath").toString();
+            QString filePath = page->property("filePath").toString();
             if (filePath.isEmpty()) {
                 emit requestSaveAs();
                 return;
             } else {
-                saveTabContent(editor, filePath);
+                saveTabContent(page, filePath);
+                // Refused or failed right away: still the only copy
+                if (!isSaving(page) && page->property("isModified").toBool()) {
+                    return;
+                }
             }
         } else if (reply == QMessageBox::Cancel) {
             return;
         }
     }
     
-    removeTab(index);
+    // Stays open until the save is through, or failed and needs another go
+    if (isSaving(page)) {
+        page->setProperty("closeAfterSave", true);
+        return;
+    }
+    removePage(page);
+}
+
+void Tab::removePage(QWidget *page)
+{
+    // Saved or let go on purpose
+    if (EditJournal *journal = journalOf(page)) {
+        journal->discard();
+    }
+    removeTab(indexOf(page));
+    // Closes the mapped file of a LargeFileEdit too
+    page->deleteLater();
     
     if (count() == 0) {
         newTab();
@@ -263,30 +630,58 @@ void Tab::prevTab()
 
 void Tab::onTabChanged(int index)
 {
-    Q_UNUSED(index)
+    QWidget *page = widget(index);
+    if (isPlaceholder(page) && !restoring) {
+        // Not from inside the tab switch, opening switches tabs itself
+        QPointer<QWidget> guard(page);
+        QMetaObject::invokeMethod(this, [this, guard]() {
+            if (guard) {
+                materialize(guard);
+            }
+        }, Qt::QueuedConnection);
+    }
     emit currentTabChanged();
     emit cursorPositionChanged();
 }
 
-void Tab::onEditorTextChanged(CustomTextEdit *editor, const QString &originalContent)
+bool Tab::isLargeFile(QWidget *page)
 {
-    QString currentContent = editor->toPlainText();
-    bool isModified = (currentContent != originalContent);
-    
-    if (editor->property("isModified").toBool() != isModified) {
-        editor->setProperty("isModified", isModified);
-        updateTabTitle(indexOf(editor));
+    return page && page->property("largeFile").toBool();
+}
+
+TextCodec::Format Tab::textFormat(QWidget *page)
+{
+    TextCodec::Format format;
+#ifdef Q_OS_WIN
+    // New files, like QIODevice::Text used to write them
+    format.lineBreak = TextCodec::LineBreak::CrLf;
+#endif
+    if (!page || !page->property("encoding").isValid()) {
+        return format;
     }
+    format.encoding = TextCodec::Encoding(page->property("encoding").toInt());
+    format.bom = page->property("bom").toBool();
+    format.lineBreak = TextCodec::LineBreak(page->property("lineBreak").toInt());
+    format.lossy = page->property("lossy").toBool();
+    return format;
+}
+
+void Tab::setTextFormat(QWidget *page, const TextCodec::Format &format)
+{
+    page->setProperty("encoding", int(format.encoding));
+    page->setProperty("bom", format.bom);
+    page->setProperty("lineBreak", int(format.lineBreak));
+    page->setProperty("lossy", format.lossy);
 }
 
 void Tab::updateTabTitle(int index)
 {
     if (index < 0) return;
     
-    CustomTextEdit *editor = qobject_cast<CustomTextEdit*>(widget(index));
-    if (!editor) return;
+    QWidget *page = widget(index);
+    if (!page) return;
     
-    QString filePath = editor->property("filePath").toString();
+    QString filePath = page->property("filePath").toString();
     QString title;
     
     if (filePath.isEmpty()) {
@@ -296,9 +691,144 @@ void Tab::updateTabTitle(int index)
         title = fileInfo.fileName();
     }
     
-    if (editor->property("isModified").toBool()) {
+    if (qobject_cast<LogViewer*>(page)) {
+        title += " [read-only]";
+    }
+    if (page->property("loading").toBool()) {
+        title += QString(" [loading %1%]").arg(page->property("loadProgress").toInt());
+    }
+    if (isSaving(page)) {
+        title += " [saving...]";
+    }
+    if (page->property("isModified").toBool()) {
         title += " *";
     }
     
     setTabText(index, title);
-}
\ No newline at end of file
+}
+
+int Tab::placePage(QWidget *page, const QString &title)
+{
+    const QString filePath = page->property("filePath").toString();
+    for (int i = 0; i < count(); ++i) {
+        QWidget *placeholder = widget(i);
+        if (!isPlaceholder(placeholder) || placeholder->property("filePath").toString() != filePath) {
+            continue;
+        }
+        // Takes over its slot and what the session remembered
+        for (const char *name : {"pendingCursor", "pendingScroll", "pendingFolds"}) {
+            page->setProperty(name, placeholder->property(name));
+        }
+        const bool wasRestoring = restoring;
+        restoring = true;
+        insertTab(i, page, title);
+        removeTab(i + 1);
+        restoring = wasRestoring;
+        placeholder->deleteLater();
+        return i;
+    }
+    return addTab(page, title);
+}
+
+bool Tab::isPlaceholder(QWidget *page)
+{
+    return page && page->property("placeholder").toBool();
+}
+
+void Tab::materialize(QWidget *placeholder)
+{
+    const QString filePath = placeholder->property("filePath").toString();
+    if (placeholder->property("viewer").toBool()) {
+        openViewerTab(filePath);
+    } else {
+        openFileInTab(filePath);
+    }
+}
+
+QJsonObject Tab::sessionState() const
+{
+    QJsonArray tabs;
+    int current = -1;
+    for (int i = 0; i < count(); ++i) {
+        QWidget *page = widget(i);
+        const QString filePath = page->property("filePath").toString();
+        // Untitled text lives on in the crash journal only
+        if (filePath.isEmpty()) {
+            continue;
+        }
+        if (i == currentIndex()) {
+            current = tabs.size();
+        }
+        
+        QJsonObject tab;
+        tab["path"] = filePath;
+        if (qobject_cast<LogViewer*>(page) || page->property("viewer").toBool()) {
+            tab["viewer"] = true;
+        }
+        CustomTextEdit *editor = qobject_cast<CustomTextEdit*>(page);
+        if (editor && !editor->property("loading").toBool()) {
+            tab["cursor"] = editor->textCursor().position();
+            tab["scroll"] = editor->verticalScrollBar()->value();
+            QJsonArray folds;
+            for (int line : editor->foldedLines()) {
+                folds.append(line);
+            }
+            tab["folds"] = folds;
+        } else if (page->property("pendingCursor").isValid()) {
+            // Never shown, or still loading: what it was restored with
+            tab["cursor"] = page->property("pendingCursor").toInt();
+            tab["scroll"] = page->property("pendingScroll").toInt();
+            tab["folds"] = QJsonArray::fromVariantList(page->property("pendingFolds").toList());
+        }
+        tabs.append(tab);
+    }
+    
+    QJsonObject state;
+    state["tabs"] = tabs;
+    state["current"] = current;
+    return state;
+}
+
+int Tab::restoreSession(const QJsonObject &state)
+{
+    // Nothing is read or parsed here, a tab's file opens when it is shown
+    restoring = true;
+    int restored = 0;
+    int current = -1;
+    const QJsonArray tabs = state["tabs"].toArray();
+    for (int i = 0; i < tabs.size(); ++i) {
+        const QJsonObject tab = tabs.at(i).toObject();
+        const QString filePath = tab["path"].toString();
+        if (filePath.isEmpty() || !QFileInfo::exists(filePath)) {
+            continue;
+        }
+        
+        QWidget *placeholder = new QWidget(this);
+        placeholder->setProperty("placeholder", true);
+        placeholder->setProperty("filePath", filePath);
+        placeholder->setProperty("isModified", false);
+        placeholder->setProperty("viewer", tab["viewer"].toBool());
+        if (tab.contains("cursor")) {
+            placeholder->setProperty("pendingCursor", tab["cursor"].toInt());
+            placeholder->setProperty("pendingScroll", tab["scroll"].toInt());
+            placeholder->setProperty("pendingFolds", tab["folds"].toArray().toVariantList());
+        }
+        const int index = addTab(placeholder, QString());
+        updateTabTitle(index);
+        if (i == state["current"].toInt()) {
+            current = index;
+        }
+        ++restored;
+    }
+    restoring = false;
+    
+    if (restored > 0) {
+        const int index = current >= 0 ? current : count() - 1;
+        if (index == currentIndex()) {
+            onTabChanged(index);
+        } else {
+            setCurrentIndex(index);
+        }
+    }
+    return restored;
+}
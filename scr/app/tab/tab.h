@@ -4,8 +4,15 @@
 #include <QTabWidget>
 #include <QAction>
 #include <QMenu>
+#include <QJsonObject>
 #include "../../parser/parser.h"
 #include "../../text/CustomTextEdit.h"
+#include "../../text/largefileedit.h"
+#include "../../text/logviewer.h"
+#include "../../text/textcodec.h"
+
+class EditJournal;
+class FileSaver;
 
 class Tab : public QTabWidget
 {
@@ -20,9 +27,46 @@ public:
     QString getCurrentFilePath();
     
     void openFileInTab(const QString &filePath);
-    void saveTabContent(CustomTextEdit *editor, const QString &filePath);
+    // Unsaved text from a crash journal, modified from the start
+    void restoreTab(const QString &filePath, const QString &text);
+    // Quitting on purpose: nothing to recover next time
+    void discardJournals();
+    
+    // Paths, cursors, scroll positions and folds of the open files
+    QJsonObject sessionState() const;
+    // Placeholder tabs for them, each file opens once its tab is shown;
+    // returns how many came back
+    int restoreSession(const QJsonObject &state);
+    static bool isPlaceholder(QWidget *page);
+    // Read-only LogViewer tab, for files too big to edit at all
+    void openViewerTab(const QString &filePath);
+    // Works for CustomTextEdit and LargeFileEdit tabs alike. Editors are
+    // written on a worker thread, fileSaved() or fileSaveFailed() follows.
+    void saveTabContent(QWidget *page, const QString &filePath);
+    static bool isSaving(QWidget *page);
+    bool hasPendingSaves() const;
     void closeCurrentTab();
     void updateTabTitle(int index);
+    
+    // Files at least this big open in large-file mode
+    void setLargeFileThreshold(qint64 bytes) { largeFileThreshold = bytes; }
+    qint64 getLargeFileThreshold() const { return largeFileThreshold; }
+    static bool isLargeFile(QWidget *page);
+    
+    // Encoding and line breaks a page is saved with, what the file had when opened
+    static TextCodec::Format textFormat(QWidget *page);
+    static void setTextFormat(QWidget *page, const TextCodec::Format &format);
+    
+    // Files at least this big skip QTextDocument and open in a LargeFileEdit
+    void setPieceTableThreshold(qint64 bytes) { pieceTableThreshold = bytes; }
+    qint64 getPieceTableThreshold() const { return pieceTableThreshold; }
+    
+    // Files at least this big open from the Explorer in a read-only LogViewer
+    void setViewerThreshold(qint64 bytes) { viewerThreshold = bytes; }
+    qint64 getViewerThreshold() const { return viewerThreshold; }
+    
+    // Extra completion words for every editor created from now on
+    void setCompletionSource(CustomTextEdit::CompletionSource source) { completionSource = std::move(source); }
 
 public slots:
     void newTab();
@@ -34,19 +78,42 @@ signals:
     void currentTabChanged();
     void requestSaveAs();
     void cursorPositionChanged(); 
+    void fileSaved(const QString &filePath);
+    void fileSaveFailed(const QString &filePath, const QString &error);
+    // The last running save is done; ok unless one of them failed
+    void allSavesFinished(bool ok);
 
 private slots:
     void onTabChanged(int index);
-    void onEditorTextChanged(CustomTextEdit *editor, const QString &originalContent);
 
 private:
     void setupTabWidget();
     void setupActions();
+    void openPieceTableTab(const QString &filePath);
+    // Undo, parser and title once a FileLoader has delivered everything
+    void finishLoading(CustomTextEdit *editor);
+    FileSaver *saverFor(CustomTextEdit *editor);
+    // What FileSaver and LargeFileEdit saves end with
+    void reportSaveFailure(QWidget *page, const QString &filePath, const QString &error);
+    void finishSaving(QWidget *page);
+    void attachJournal(CustomTextEdit *editor);
+    static EditJournal *journalOf(QWidget *page);
+    void removePage(QWidget *page);
+    // addTab(), or into the slot of the placeholder for the same file
+    int placePage(QWidget *page, const QString &title);
+    void materialize(QWidget *placeholder);
     
     QAction *nextTabAction;
     QAction *prevTabAction;
     QAction *newTabAction;
     QAction *closeTabAction;
+    
+    qint64 largeFileThreshold = 8 * 1024 * 1024;
+    qint64 pieceTableThreshold = 64 * 1024 * 1024;
+    qint64 viewerThreshold = 1024 * 1024 * 1024;
+    CustomTextEdit::CompletionSource completionSource;
+    bool saveFailed = false;  // since allSavesFinished() last went out
+    bool restoring = false;   // placeholders stay placeholders meanwhile
 };
 
 #endif // TAB_H
\ No newline at end of file
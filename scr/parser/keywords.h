@@ -0,0 +1,252 @@
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include <array>
+#include <cstdint>
+
+// Python keywords, builtins and exception names.
+// Single source for the highlighter and the completer, hashed at compile time.
+namespace Keywords {
+
+enum class Kind : unsigned char {
+    None,
+    Keyword,    // language keywords
+    Special,    // self, cls
+    Builtin,    // built-in functions and types
+    Exception,  // built-in exceptions
+    Dunder,     // __name__ and friends
+    Module      // common modules, completion only
+};
+
+struct Entry {
+    const char *word;
+    Kind kind;
+};
+
+inline constexpr Entry entries[] = {
+    // Keywords
+    {"False", Kind::Keyword}, {"None", Kind::Keyword}, {"True", Kind::Keyword},
+    {"and", Kind::Keyword}, {"as", Kind::Keyword}, {"assert", Kind::Keyword},
+    {"async", Kind::Keyword}, {"await", Kind::Keyword}, {"break", Kind::Keyword},
+    {"class", Kind::Keyword}, {"continue", Kind::Keyword}, {"def", Kind::Keyword},
+    {"del", Kind::Keyword}, {"elif", Kind::Keyword}, {"else", Kind::Keyword},
+    {"except", Kind::Keyword}, {"finally", Kind::Keyword}, {"for", Kind::Keyword},
+    {"from", Kind::Keyword}, {"global", Kind::Keyword}, {"if", Kind::Keyword},
+    {"import", Kind::Keyword}, {"in", Kind::Keyword}, {"is", Kind::Keyword},
+    {"lambda", Kind::Keyword}, {"nonlocal", Kind::Keyword}, {"not", Kind::Keyword},
+    {"or", Kind::Keyword}, {"pass", Kind::Keyword}, {"raise", Kind::Keyword},
+    {"return", Kind::Keyword}, {"try", Kind::Keyword}, {"while", Kind::Keyword},
+    {"with", Kind::Keyword}, {"yield", Kind::Keyword},
+
+    // Special identifiers
+    {"self", Kind::Special}, {"cls", Kind::Special},
+
+    // Built-in functions
+    {"abs", Kind::Builtin}, {"all", Kind::Builtin}, {"any", Kind::Builtin},
+    {"ascii", Kind::Builtin}, {"bin", Kind::Builtin}, {"bool", Kind::Builtin},
+    {"breakpoint", Kind::Builtin}, {"bytearray", Kind::Builtin}, {"bytes", Kind::Builtin},
+    {"callable", Kind::Builtin}, {"chr", Kind::Builtin}, {"classmethod", Kind::Builtin},
+    {"compile", Kind::Builtin}, {"complex", Kind::Builtin}, {"delattr", Kind::Builtin},
+    {"dict", Kind::Builtin}, {"dir", Kind::Builtin}, {"divmod", Kind::Builtin},
+    {"enumerate", Kind::Builtin}, {"eval", Kind::Builtin}, {"exec", Kind::Builtin},
+    {"filter", Kind::Builtin}, {"float", Kind::Builtin}, {"format", Kind::Builtin},
+    {"frozenset", Kind::Builtin}, {"getattr", Kind::Builtin}, {"globals", Kind::Builtin},
+    {"hasattr", Kind::Builtin}, {"hash", Kind::Builtin}, {"help", Kind::Builtin},
+    {"hex", Kind::Builtin}, {"id", Kind::Builtin}, {"input", Kind::Builtin},
+    {"int", Kind::Builtin}, {"isinstance", Kind::Builtin}, {"issubclass", Kind::Builtin},
+    {"iter", Kind::Builtin}, {"len", Kind::Builtin}, {"list", Kind::Builtin},
+    {"locals", Kind::Builtin}, {"map", Kind::Builtin}, {"max", Kind::Builtin},
+    {"memoryview", Kind::Builtin}, {"min", Kind::Builtin}, {"next", Kind::Builtin},
+    {"object", Kind::Builtin}, {"oct", Kind::Builtin}, {"open", Kind::Builtin},
+    {"ord", Kind::Builtin}, {"pow", Kind::Builtin}, {"print", Kind::Builtin},
+    {"property", Kind::Builtin}, {"range", Kind::Builtin}, {"repr", Kind::Builtin},
+    {"reversed", Kind::Builtin}, {"round", Kind::Builtin}, {"set", Kind::Builtin},
+    {"setattr", Kind::Builtin}, {"slice", Kind::Builtin}, {"sorted", Kind::Builtin},
+    {"staticmethod", Kind::Builtin}, {"str", Kind::Builtin}, {"sum", Kind::Builtin},
+    {"super", Kind::Builtin}, {"tuple", Kind::Builtin}, {"type", Kind::Builtin},
+    {"vars", Kind::Builtin}, {"zip", Kind::Builtin},
+
+    // Exceptions
+    {"BaseException", Kind::Exception}, {"Exception", Kind::Exception},
+    {"ArithmeticError", Kind::Exception}, {"BufferError", Kind::Exception},
+    {"LookupError", Kind::Exception}, {"AssertionError", Kind::Exception},
+    {"AttributeError", Kind::Exception}, {"EOFError", Kind::Exception},
+    {"FloatingPointError", Kind::Exception}, {"GeneratorExit", Kind::Exception},
+    {"ImportError", Kind::Exception}, {"ModuleNotFoundError", Kind::Exception},
+    {"IndexError", Kind::Exception}, {"KeyError", Kind::Exception},
+    {"KeyboardInterrupt", Kind::Exception}, {"MemoryError", Kind::Exception},
+    {"NameError", Kind::Exception}, {"NotImplementedError", Kind::Exception},
+    {"OSError", Kind::Exception}, {"OverflowError", Kind::Exception},
+    {"RecursionError", Kind::Exception}, {"ReferenceError", Kind::Exception},
+    {"RuntimeError", Kind::Exception}, {"StopIteration", Kind::Exception},
+    {"StopAsyncIteration", Kind::Exception}, {"SyntaxError", Kind::Exception},
+    {"IndentationError", Kind::Exception}, {"TabError", Kind::Exception},
+    {"SystemError", Kind::Exception}, {"SystemExit", Kind::Exception},
+    {"TypeError", Kind::Exception}, {"UnboundLocalError", Kind::Exception},
+    {"UnicodeError", Kind::Exception}, {"UnicodeDecodeError", Kind::Exception},
+    {"UnicodeEncodeError", Kind::Exception}, {"UnicodeTranslateError", Kind::Exception},
+    {"ValueError", Kind::Exception}, {"ZeroDivisionError", Kind::Exception},
+    {"EnvironmentError", Kind::Exception}, {"IOError", Kind::Exception},
+    {"WindowsError", Kind::Exception}, {"BlockingIOError", Kind::Exception},
+    {"ChildProcessError", Kind::Exception}, {"ConnectionError", Kind::Exception},
+    {"BrokenPipeError", Kind::Exception}, {"ConnectionAbortedError", Kind::Exception},
+    {"ConnectionRefusedError", Kind::Exception}, {"ConnectionResetError", Kind::Exception},
+    {"FileExistsError", Kind::Exception}, {"FileNotFoundError", Kind::Exception},
+    {"InterruptedError", Kind::Exception}, {"IsADirectoryError", Kind::Exception},
+    {"NotADirectoryError", Kind::Exception}, {"PermissionError", Kind::Exception},
+    {"ProcessLookupError", Kind::Exception}, {"TimeoutError", Kind::Exception},
+
+    // constants
+    {"__init__", Kind::Dunder}, {"__name__", Kind::Dunder}, {"__main__", Kind::Dunder},
+    {"__file__", Kind::Dunder}, {"__doc__", Kind::Dunder}, {"__package__", Kind::Dunder},
+    {"__version__", Kind::Dunder},
+
+    // Common modules
+    {"os", Kind::Module}, {"sys", Kind::Module}, {"json", Kind::Module},
+    {"re", Kind::Module}, {"datetime", Kind::Module}, {"math", Kind::Module},
+    {"random", Kind::Module}, {"collections", Kind::Module}, {"itertools", Kind::Module},
+    {"functools", Kind::Module}, {"typing", Kind::Module}
+};
+
+inline constexpr int count = int(sizeof(entries) / sizeof(entries[0]));
+
+// Open addressing table, at least 2.5x bigger than the word count
+inline constexpr int tableSize = 512;
+inline constexpr std::uint32_t tableMask = tableSize - 1;
+static_assert(count * 5 / 2 <= tableSize, "keyword table too full");
+
+constexpr int wordLength(const char *word)
+{
+    int length = 0;
+    while (word[length]) {
+        ++length;
+    }
+    return length;
+}
+
+// Seeded FNV-1a over code units, works for char, char16_t and ushort input
+template <typename CharT>
+constexpr std::uint32_t hash(const CharT *s, int length, std::uint32_t seed)
+{
+    std::uint32_t h = 2166136261u ^ seed;
+    for (int i = 0; i < length; ++i) {
+        h ^= static_cast<std::uint32_t>(s[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+constexpr std::array<short, tableSize> buildTable(std::uint32_t seed)
+{
+    std::array<short, tableSize> table{};
+    for (int i = 0; i < tableSize; ++i) {
+        table[i] = -1;
+    }
+    for (int i = 0; i < count; ++i) {
+        std::uint32_t slot = hash(entries[i].word, wordLength(entries[i].word), seed) & tableMask;
+        while (table[slot] != -1) {
+            slot = (slot + 1) & tableMask;
+        }
+        table[slot] = short(i);
+    }
+    return table;
+}
+
+// Worst number of slots any word has to look at
+constexpr int longestProbe(const std::array<short, tableSize> &table, std::uint32_t seed)
+{
+    int longest = 0;
+    for (int i = 0; i < count; ++i) {
+        std::uint32_t slot = hash(entries[i].word, wordLength(entries[i].word), seed) & tableMask;
+        int probes = 1;
+        while (table[slot] != i) {
+            slot = (slot + 1) & tableMask;
+            ++probes;
+        }
+        longest = probes > longest ? probes : longest;
+    }
+    return longest;
+}
+
+// Tries a few seeds at compile time and keeps the one with the shortest probes
+constexpr std::uint32_t findSeed()
+{
+    std::uint32_t bestSeed = 0;
+    int bestProbe = tableSize;
+    for (std::uint32_t seed = 0; seed < 64; ++seed) {
+        const int probe = longestProbe(buildTable(seed), seed);
+        if (probe < bestProbe) {
+            bestProbe = probe;
+            bestSeed = seed;
+        }
+    }
+    return bestSeed;
+}
+
+inline constexpr std::uint32_t seed = findSeed();
+inline constexpr std::array<short, tableSize> table = buildTable(seed);
+
+constexpr int minLength()
+{
+    int shortest = 1 << 30;
+    for (int i = 0; i < count; ++i) {
+        const int length = wordLength(entries[i].word);
+        shortest = length < shortest ? length : shortest;
+    }
+    return shortest;
+}
+
+constexpr int maxLength()
+{
+    int longest = 0;
+    for (int i = 0; i < count; ++i) {
+        const int length = wordLength(entries[i].word);
+        longest = length > longest ? length : longest;
+    }
+    return longest;
+}
+
+inline constexpr int shortestWord = minLength();
+inline constexpr int longestWord = maxLength();
+
+// Every lookup is one hash and at most three slot compares
+static_assert(longestProbe(table, seed) <= 3, "keyword hash clusters too much, change tableSize");
+
+template <typename CharT>
+constexpr bool equals(const char *word, const CharT *s, int length)
+{
+    for (int i = 0; i < length; ++i) {
+        if (static_cast<std::uint32_t>(s[i]) != static_cast<unsigned char>(word[i])) {
+            return false;
+        }
+    }
+    return word[length] == '\0';
+}
+
+// Kind of the identifier s[0..length), Kind::None if it isn't in the table
+template <typename CharT>
+constexpr Kind lookup(const CharT *s, int length)
+{
+    if (length < shortestWord || length > longestWord) {
+        return Kind::None;
+    }
+    std::uint32_t slot = hash(s, length, seed) & tableMask;
+    for (;;) {
+        const int index = table[slot];
+        if (index < 0) {
+            return Kind::None;
+        }
+        if (equals(entries[index].word, s, length)) {
+            return entries[index].kind;
+        }
+        slot = (slot + 1) & tableMask;
+    }
+}
+
+static_assert(lookup("lambda", 6) == Kind::Keyword, "keyword lookup broken");
+static_assert(lookup("zip", 3) == Kind::Builtin, "keyword lookup broken");
+static_assert(lookup("zipp", 4) == Kind::None, "keyword lookup broken");
+
+} // namespace Keywords
+
+#endif // KEYWORDS_H
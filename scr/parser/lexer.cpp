@@ -0,0 +1,401 @@
+#include "lexer.h"
+#include "keywords.h"
+
+namespace {
+
+inline bool isIdentStart(QChar c)
+{
+    const ushort u = c.unicode();
+    if (u < 128) {
+        return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || u == '_';
+    }
+    return c.isLetter();
+}
+
+inline bool isIdentChar(QChar c)
+{
+    const ushort u = c.unicode();
+    if (u < 128) {
+        return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z')
+            || (u >= '0' && u <= '9') || u == '_';
+    }
+    return c.isLetterOrNumber();
+}
+
+inline bool isDigit(QChar c)
+{
+    return c.unicode() >= '0' && c.unicode() <= '9';
+}
+
+inline bool isHexDigit(QChar c)
+{
+    const ushort u = c.unicode() | 0x20;
+    return isDigit(c) || (u >= 'a' && u <= 'f');
+}
+
+inline ushort lower(QChar c)
+{
+    const ushort u = c.unicode();
+    return (u >= 'A' && u <= 'Z') ? u | 0x20 : u;
+}
+
+// r, u, f, b and the two letter combos rb/br/rf/fr, any case
+bool isStringPrefix(const QChar *s, int length)
+{
+    if (length == 1) {
+        const ushort c = lower(s[0]);
+        return c == 'r' || c == 'u' || c == 'f' || c == 'b';
+    }
+    if (length == 2) {
+        const ushort a = lower(s[0]);
+        const ushort b = lower(s[1]);
+        if (a == 'r') return b == 'b' || b == 'f';
+        if (b == 'r') return a == 'b' || a == 'f';
+    }
+    return false;
+}
+
+int scanNumber(const QChar *s, int i, int n)
+{
+    if (s[i] == QLatin1Char('0') && i + 1 < n) {
+        const ushort base = lower(s[i + 1]);
+        if (base == 'x' || base == 'o' || base == 'b') {
+            i += 2;
+            while (i < n && (isHexDigit(s[i]) || s[i] == QLatin1Char('_'))) {
+                ++i;
+            }
+            return i;
+        }
+    }
+
+    while (i < n && (isDigit(s[i]) || s[i] == QLatin1Char('_'))) {
+        ++i;
+    }
+    if (i < n && s[i] == QLatin1Char('.')) {
+        ++i;
+        while (i < n && (isDigit(s[i]) || s[i] == QLatin1Char('_'))) {
+            ++i;
+        }
+    }
+    if (i < n && lower(s[i]) == 'e') {
+        int j = i + 1;
+        if (j < n && (s[j] == QLatin1Char('+') || s[j] == QLatin1Char('-'))) {
+            ++j;
+        }
+        if (j < n && isDigit(s[j])) {
+            i = j;
+            while (i < n && (isDigit(s[i]) || s[i] == QLatin1Char('_'))) {
+                ++i;
+            }
+        }
+    }
+    if (i < n && lower(s[i]) == 'j') {
+        ++i;
+    }
+    return i;
+}
+
+} // namespace
+
+TokenType Lexer::classifyIdentifier(const QChar *data, int length, bool *found)
+{
+    // One hash and a couple of compares against the compile-time table
+    const Keywords::Kind kind = Keywords::lookup(reinterpret_cast<const ushort *>(data), length);
+    switch (kind) {
+    case Keywords::Kind::Keyword:
+    case Keywords::Kind::Special:
+        *found = true;
+        return TokenType::Keyword;
+    case Keywords::Kind::Builtin:
+    case Keywords::Kind::Exception:
+    case Keywords::Kind::Dunder:
+        *found = true;
+        return TokenType::Builtin;
+    default:
+        *found = false;
+        return TokenType::Keyword;
+    }
+}
+
+int LexState::pack() const
+{
+    if (frames.size() <= 2 && bracketDepth < 256) {
+        int packed = bracketDepth | (int(frames.size()) << 8);
+        for (int i = 0; i < frames.size(); ++i) {
+            packed |= int(uchar(frames.at(i))) << (10 + 8 * i);
+        }
+        return packed;
+    }
+    const size_t h = qHash(frames, size_t(bracketDepth));
+    return overflowBit | int((h ^ (h >> 31)) & (overflowBit - 1));
+}
+
+LexState LexState::unpack(int packed)
+{
+    LexState state;
+    if (packed <= 0 || (packed & overflowBit)) {
+        return state;
+    }
+    state.bracketDepth = packed & 0xFF;
+    const int count = (packed >> 8) & 0x3;
+    for (int i = 0; i < count; ++i) {
+        state.frames.append(char((packed >> (10 + 8 * i)) & 0xFF));
+    }
+    return state;
+}
+
+namespace {
+
+inline uchar topFrame(const LexState &state)
+{
+    return state.frames.isEmpty() ? 0 : uchar(state.frames.at(state.frames.size() - 1));
+}
+
+inline void setTopFrame(LexState &state, uchar frame)
+{
+    state.frames[state.frames.size() - 1] = char(frame);
+}
+
+// Color of a string frame, spec frames use the string they belong to
+TokenType stringType(const LexState &state)
+{
+    for (int i = state.frames.size() - 1; i >= 0; --i) {
+        const uchar frame = uchar(state.frames.at(i));
+        if ((frame & LexState::frameKindMask) == LexState::StringFrame) {
+            if (frame & LexState::Triple) {
+                return TokenType::MultiLineString;
+            }
+            return (frame & LexState::DoubleQuote) ? TokenType::DoubleString : TokenType::SingleString;
+        }
+    }
+    return TokenType::SingleString;
+}
+
+uchar stringFrame(const QChar *prefix, int prefixLength, QChar quote, bool triple)
+{
+    uchar frame = LexState::StringFrame;
+    if (quote == QLatin1Char('"')) frame |= LexState::DoubleQuote;
+    if (triple) frame |= LexState::Triple;
+    for (int i = 0; i < prefixLength; ++i) {
+        if (lower(prefix[i]) == 'f') frame |= LexState::Formatted;
+    }
+    return frame;
+}
+
+void addToken(QVector<Token> &tokens, int start, int end, TokenType type)
+{
+    if (end > start) {
+        tokens.append({start, end - start, type});
+    }
+}
+
+} // namespace
+
+void Lexer::tokenize(const QString &text, LexState &state, QVector<Token> &tokens)
+{
+    const QChar *s = text.constData();
+    const int n = text.length();
+    int i = 0;
+
+    // Start of the string piece being scanned, a line can begin inside one
+    int segment = 0;
+    // Not inside a string or brackets: a continuation line is no line start
+    bool lineStart = state.frames.isEmpty() && state.bracketDepth == 0;
+    bool continued = false;
+
+    while (i < n) {
+        const uchar top = topFrame(state);
+        const uchar kind = top & LexState::frameKindMask;
+
+        // Inside a string body
+        if (kind == LexState::StringFrame) {
+            const QChar quote = (top & LexState::DoubleQuote) ? QLatin1Char('"') : QLatin1Char('\'');
+            const bool triple = top & LexState::Triple;
+            const bool formatted = top & LexState::Formatted;
+            const TokenType type = stringType(state);
+            bool left = false;
+
+            while (i < n) {
+                const QChar c = s[i];
+                if (c == QLatin1Char('\\')) {
+                    i += 2;
+                    continue;
+                }
+                if (formatted && (c == QLatin1Char('{') || c == QLatin1Char('}'))) {
+                    if (i + 1 < n && s[i + 1] == c) {
+                        i += 2;
+                        continue;
+                    }
+                    if (c == QLatin1Char('{')) {
+                        // Replacement field, the brace stays string colored
+                        addToken(tokens, segment, i + 1, type);
+                        state.frames.append(char(LexState::FieldFrame));
+                        ++i;
+                        left = true;
+                        break;
+                    }
+                    ++i;
+                    continue;
+                }
+                if (c == quote) {
+                    if (!triple) {
+                        ++i;
+                    } else if (i + 2 < n && s[i + 1] == quote && s[i + 2] == quote) {
+                        i += 3;
+                    } else {
+                        ++i;
+                        continue;
+                    }
+                    addToken(tokens, segment, i, type);
+                    state.frames.chop(1);
+                    left = true;
+                    break;
+                }
+                ++i;
+            }
+
+            if (!left) {
+                // A backslash as the very last character continues the line
+                continued = i > n;
+                addToken(tokens, segment, n, type);
+                i = n;
+            }
+            continue;
+        }
+
+        // Format spec after ':' in a replacement field, string colored
+        if (kind == LexState::SpecFrame) {
+            const TokenType type = stringType(state);
+            while (i < n && s[i] != QLatin1Char('{') && s[i] != QLatin1Char('}')) {
+                ++i;
+            }
+            if (i < n && s[i] == QLatin1Char('{')) {
+                addToken(tokens, segment, i + 1, type);
+                state.frames.append(char(LexState::FieldFrame));
+            } else {
+                addToken(tokens, segment, i, type);
+                if (i < n) {
+                    // '}' closes both the spec and its field
+                    state.frames.chop(2);
+                    segment = i;
+                }
+            }
+            ++i;
+            continue;
+        }
+
+        const QChar c = s[i];
+        const ushort u = c.unicode();
+        const bool inField = kind == LexState::FieldFrame;
+
+        if (u == ' ' || u == '\t') {
+            ++i;
+            continue;
+        }
+
+        if (u == '#') {
+            tokens.append({i, n - i, TokenType::Comment});
+            break;
+        }
+
+        if (u == '"' || u == '\'') {
+            segment = i;
+            if (i + 2 < n && s[i + 1] == c && s[i + 2] == c) {
+                state.frames.append(char(stringFrame(s, 0, c, true)));
+                i += 3;
+            } else {
+                state.frames.append(char(stringFrame(s, 0, c, false)));
+                ++i;
+            }
+            lineStart = false;
+            continue;
+        }
+
+        if (isDigit(c) || (u == '.' && i + 1 < n && isDigit(s[i + 1]))) {
+            const int start = i;
+            i = scanNumber(s, i, n);
+            tokens.append({start, i - start, TokenType::Number});
+            lineStart = false;
+            continue;
+        }
+
+        if (isIdentStart(c)) {
+            const int start = i;
+            while (i < n && isIdentChar(s[i])) {
+                ++i;
+            }
+
+            // String prefixes like r"..." or f'...' belong to the string
+            if (i < n && (s[i] == QLatin1Char('"') || s[i] == QLatin1Char('\''))
+                && isStringPrefix(s + start, i - start)) {
+                const QChar quote = s[i];
+                const bool triple = i + 2 < n && s[i + 1] == quote && s[i + 2] == quote;
+                state.frames.append(char(stringFrame(s + start, i - start, quote, triple)));
+                segment = start;
+                i += triple ? 3 : 1;
+                lineStart = false;
+                continue;
+            }
+
+            bool found = false;
+            const TokenType type = classifyIdentifier(s + start, i - start, &found);
+            if (found) {
+                tokens.append({start, i - start, type});
+            }
+            lineStart = false;
+            continue;
+        }
+
+        // Decorators only at the start of a line, so `a @ b` stays plain,
+        // and `(a\n @b)` too
+        if (u == '@' && lineStart && i + 1 < n && isIdentStart(s[i + 1])) {
+            const int start = i++;
+            while (i < n && (isIdentChar(s[i]) || s[i] == QLatin1Char('.'))) {
+                ++i;
+            }
+            tokens.append({start, i - start, TokenType::Decorator});
+            lineStart = false;
+            continue;
+        }
+
+        if (u == '(' || u == '[' || u == '{') {
+            if (inField) {
+                const int depth = topFrame(state) & LexState::maxFieldDepth;
+                setTopFrame(state, LexState::FieldFrame | qMin(depth + 1, LexState::maxFieldDepth));
+            } else {
+                ++state.bracketDepth;
+            }
+        } else if (u == ')' || u == ']' || u == '}') {
+            if (inField) {
+                const int depth = topFrame(state) & LexState::maxFieldDepth;
+                if (depth > 0) {
+                    setTopFrame(state, LexState::FieldFrame | (depth - 1));
+                } else if (u == '}') {
+                    // End of the replacement field, back in the string
+                    state.frames.chop(1);
+                    segment = i;
+                }
+            } else if (state.bracketDepth > 0) {
+                --state.bracketDepth;
+            }
+        } else if (u == ':' && inField && (topFrame(state) & LexState::maxFieldDepth) == 0) {
+            state.frames.append(char(LexState::SpecFrame));
+            segment = i;
+        }
+
+        lineStart = false;
+        ++i;
+    }
+
+    // Single quoted strings end with the line unless it ends in a backslash,
+    // and take any replacement fields opened inside them along
+    if (!continued) {
+        for (int f = 0; f < state.frames.size(); ++f) {
+            const uchar frame = uchar(state.frames.at(f));
+            if ((frame & LexState::frameKindMask) == LexState::StringFrame && !(frame & LexState::Triple)) {
+                state.frames.truncate(f);
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+// What a span of text is. Also used as index into the highlighter formats.
+enum class TokenType : quint8 {
+    Keyword,
+    Builtin,
+    DoubleString,
+    SingleString,
+    MultiLineString,
+    Comment,
+    Number,
+    Decorator,
+    Count
+};
+
+struct Token {
+    int start;
+    int length;
+    TokenType type;
+};
+
+// Everything the lexer needs to continue on the next line: open brackets
+// and the stack of strings / f-string replacement fields we are inside.
+struct LexState {
+    // Frame bytes, innermost last
+    enum Frame : uchar {
+        StringFrame = 0x40,  // | DoubleQuote | Triple | Formatted
+        FieldFrame = 0x80,   // | brace depth inside the {expression}
+        SpecFrame = 0xC0     // after ':' in a replacement field
+    };
+    enum StringFlag : uchar {
+        DoubleQuote = 0x01,
+        Triple = 0x02,
+        Formatted = 0x04
+    };
+    static constexpr uchar frameKindMask = 0xC0;
+    static constexpr int maxFieldDepth = 0x3F;
+
+    int bracketDepth = 0;
+    QByteArray frames;
+
+    // Packs into a non-negative int for QSyntaxHighlighter. States that don't
+    // fit set overflowBit and carry a hash instead; the full state then has
+    // to be kept next to the block.
+    static constexpr int overflowBit = 1 << 30;
+    int pack() const;
+    static LexState unpack(int packed);
+
+    bool operator==(const LexState &other) const {
+        return bracketDepth == other.bracketDepth && frames == other.frames;
+    }
+    bool operator!=(const LexState &other) const { return !(*this == other); }
+};
+
+// Hand-written Python tokenizer. Walks a line once and emits
+// non-overlapping spans, so nothing gets painted twice.
+class Lexer
+{
+public:
+    // Appends the tokens of `text` to `tokens` and advances `state` to the end of line
+    static void tokenize(const QString &text, LexState &state, QVector<Token> &tokens);
+
+private:
+    static TokenType classifyIdentifier(const QChar *data, int length, bool *found);
+};
+
+#endif // LEXER_H
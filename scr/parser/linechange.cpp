@@ -0,0 +1,23 @@
+#include "linechange.h"
+#include <QTextDocument>
+
+LineChange LineChange::of(const QTextDocument *doc, int position, int added, int mirrorLines)
+{
+    LineChange change;
+    change.delta = doc->blockCount() - mirrorLines;
+    QTextBlock first = doc->findBlock(position);
+    QTextBlock last = doc->findBlock(position + added);
+    if (!first.isValid()) {
+        first = doc->lastBlock();
+    }
+    if (!last.isValid()) {
+        last = doc->lastBlock();
+    }
+
+    change.first = first;
+    change.start = first.blockNumber();
+    change.newEnd = last.blockNumber();
+    change.oldEnd = change.newEnd - change.delta;
+    change.valid = change.oldEnd >= change.start - 1 && change.oldEnd < mirrorLines;
+    return change;
+}
@@ -0,0 +1,24 @@
+#ifndef LINECHANGE_H
+#define LINECHANGE_H
+
+#include <QTextBlock>
+
+class QTextDocument;
+
+// The lines a QTextDocument::contentsChange touched, for anything keeping
+// one entry per line (SyntaxTree, IdentifierIndex, ModificationTracker,
+// EditJournal). Lines start..oldEnd of the mirror became start..newEnd of
+// the document; oldEnd is start - 1 when lines were only inserted.
+struct LineChange {
+    QTextBlock first;  // block of line `start`, now
+    int start = 0;
+    int oldEnd = 0;
+    int newEnd = 0;
+    int delta = 0;     // lines gained, negative when lost
+    bool valid = false;  // false: the mirror is out of step, rebuild it
+
+    // `mirrorLines` is what the mirror had before the change
+    static LineChange of(const QTextDocument *doc, int position, int added, int mirrorLines);
+};
+
+#endif // LINECHANGE_H
@@ -1,172 +1,359 @@
 #include "parser.h"
+#include "tokencache.h"
+#include <QPlainTextEdit>
+#include <QScrollBar>
+#include <QtConcurrent/QtConcurrentRun>
 
-Parser::Parser(QTextDocument *parent) : QSyntaxHighlighter(parent) {
-    HighlightingRule rule;
+namespace {
 
+// Extra blocks around the visible range that are highlighted inline
+constexpr int viewportMargin = 50;
+
+// Used until the view has been laid out and knows its height
+constexpr int minimumViewLines = 100;
+
+} // namespace
+
+SyntaxStyle::SyntaxStyle() {
+    QTextCharFormat keywordFormat;
     keywordFormat.setForeground(QColor(248, 131, 66));
     keywordFormat.setFontWeight(QFont::Bold);
-    QStringList keywordPatterns;
-    QStringList keywordBuiltIn;
-    
-    keywordPatterns 
-        << "\\bFalse\\b" << "\\bNone\\b" << "\\bTrue\\b" 
-        << "\\band\\b" << "\\bas\\b" << "\\bassert\\b" << "\\basync\\b" 
-        << "\\bawait\\b" << "\\bbreak\\b" << "\\bclass\\b" << "\\bcontinue\\b" 
-        << "\\bdef\\b" << "\\bdel\\b" << "\\belif\\b" << "\\belse\\b" 
-        << "\\bexcept\\b" << "\\bfinally\\b" << "\\bfor\\b" << "\\bfrom\\b" 
-        << "\\bglobal\\b" << "\\bif\\b" << "\\bimport\\b" << "\\bin\\b" 
-        << "\\bis\\b" << "\\blambda\\b" << "\\bnonlocal\\b" << "\\bnot\\b" 
-        << "\\bor\\b" << "\\bpass\\b" << "\\braise\\b" << "\\breturn\\b" 
-        << "\\btry\\b" << "\\bwhile\\b" << "\\bwith\\b" << "\\byield\\b"
-        
-        // special ids
-        << "\\bself\\b" << "\\bcls\\b";
-
-    keywordBuiltIn 
-        << "\\babs\\b" << "\\ball\\b" << "\\bany\\b" << "\\bascii\\b" 
-        << "\\bbin\\b" << "\\bbool\\b" << "\\bbreakpoint\\b" << "\\bbytearray\\b" 
-        << "\\bbytes\\b" << "\\bcallable\\b" << "\\bchr\\b" << "\\bclassmethod\\b" 
-        << "\\bcompile\\b" << "\\bcomplex\\b" << "\\bdelattr\\b" << "\\bdict\\b" 
-        << "\\bdir\\b" << "\\bdivmod\\b" << "\\benumerate\\b" << "\\beval\\b" 
-        << "\\bexec\\b" << "\\bfilter\\b" << "\\bfloat\\b" << "\\bformat\\b" 
-        << "\\bfrozenset\\b" << "\\bgetattr\\b" << "\\bglobals\\b" << "\\bhasattr\\b" 
-        << "\\bhash\\b" << "\\bhelp\\b" << "\\bhex\\b" << "\\bid\\b" 
-        << "\\binput\\b" << "\\bint\\b" << "\\bisinstance\\b" << "\\bissubclass\\b" 
-        << "\\biter\\b" << "\\blen\\b" << "\\blist\\b" << "\\blocals\\b" 
-        << "\\bmap\\b" << "\\bmax\\b" << "\\bmemoryview\\b" << "\\bmin\\b" 
-        << "\\bnext\\b" << "\\bobject\\b" << "\\boct\\b" << "\\bopen\\b" 
-        << "\\bord\\b" << "\\bpow\\b" << "\\bprint\\b" << "\\bproperty\\b" 
-        << "\\brange\\b" << "\\brepr\\b" << "\\breversed\\b" << "\\bround\\b" 
-        << "\\bset\\b" << "\\bsetattr\\b" << "\\bslice\\b" << "\\bsorted\\b" 
-        << "\\bstaticmethod\\b" << "\\bstr\\b" << "\\bsum\\b" << "\\bsuper\\b" 
-        << "\\btuple\\b" << "\\btype\\b" << "\\bvars\\b" << "\\bzip\\b" 
-        
-        // Exceptions
-        << "\\bBaseException\\b" << "\\bException\\b" << "\\bArithmeticError\\b" 
-        << "\\bBufferError\\b" << "\\bLookupError\\b" << "\\bAssertionError\\b" 
-        << "\\bAttributeError\\b" << "\\bEOFError\\b" << "\\bFloatingPointError\\b" 
-        << "\\bGeneratorExit\\b" << "\\bImportError\\b" << "\\bModuleNotFoundError\\b" 
-        << "\\bIndexError\\b" << "\\bKeyError\\b" << "\\bKeyboardInterrupt\\b" 
-        << "\\bMemoryError\\b" << "\\bNameError\\b" << "\\bNotImplementedError\\b" 
-        << "\\bOSError\\b" << "\\bOverflowError\\b" << "\\bRecursionError\\b" 
-        << "\\bReferenceError\\b" << "\\bRuntimeError\\b" << "\\bStopIteration\\b" 
-        << "\\bStopAsyncIteration\\b" << "\\bSyntaxError\\b" << "\\bIndentationError\\b" 
-        << "\\bTabError\\b" << "\\bSystemError\\b" << "\\bSystemExit\\b" 
-        << "\\bTypeError\\b" << "\\bUnboundLocalError\\b" << "\\bUnicodeError\\b" 
-        << "\\bUnicodeDecodeError\\b" << "\\bUnicodeEncodeError\\b" << "\\bUnicodeTranslateError\\b" 
-        << "\\bValueError\\b" << "\\bZeroDivisionError\\b" << "\\bEnvironmentError\\b" 
-        << "\\bIOError\\b" << "\\bWindowsError\\b" << "\\bBlockingIOError\\b" 
-        << "\\bChildProcessError\\b" << "\\bConnectionError\\b" << "\\bBrokenPipeError\\b" 
-        << "\\bConnectionAbortedError\\b" << "\\bConnectionRefusedError\\b" << "\\bConnectionResetError\\b" 
-        << "\\bFileExistsError\\b" << "\\bFileNotFoundError\\b" << "\\bInterruptedError\\b" 
-        << "\\bIsADirectoryError\\b" << "\\bNotADirectoryError\\b" << "\\bPermissionError\\b" 
-        << "\\bProcessLookupError\\b" << "\\bTimeoutError\\b"
-        
-        // constants
-        << "\\b__name__\\b" << "\\b__main__\\b" << "\\b__file__\\b" << "\\b__doc__\\b"
-        << "\\b__package__\\b" << "\\b__version__\\b";
-
-    for (const QString &pattern : keywordPatterns) {
-        rule.pattern = QRegularExpression(pattern);
-        rule.format = keywordFormat;
-        highlightingRules.append(rule);
-    } 
-    
+    formats[int(TokenType::Keyword)] = keywordFormat;
+
     // build in funcs (purple)
     keywordFormat.setForeground(QColor(200, 1, 218));
-    for (const QString &pattern : keywordBuiltIn) {
-        rule.pattern = QRegularExpression(pattern);
-        rule.format = keywordFormat;
-        highlightingRules.append(rule);
-    }
+    formats[int(TokenType::Builtin)] = keywordFormat;
 
     // strings (green) ""
-    doubleStringFormat.setForeground(QColor(0, 158, 0));
-    rule.pattern = QRegularExpression("\".*?\"");
-    rule.format = doubleStringFormat;
-    highlightingRules.append(rule);
+    formats[int(TokenType::DoubleString)].setForeground(QColor(0, 158, 0));
 
     // strings (green) ''
-    singleStringFormat.setForeground(Qt::darkGreen);
-    rule.pattern = QRegularExpression("\'.*?\'");
-    rule.format = singleStringFormat;
-    highlightingRules.append(rule);
+    formats[int(TokenType::SingleString)].setForeground(Qt::darkGreen);
 
     // Many strings (triple quotes)
-    multiLineStringFormat.setForeground(QColor(0, 128, 0)); 
-    rule.pattern = QRegularExpression("\"\"\".*?\"\"\"");
-    rule.format = multiLineStringFormat;
-    highlightingRules.append(rule);
-    
-    rule.pattern = QRegularExpression("\'\'\'.*?\'\'\'");
-    rule.format = multiLineStringFormat;
-    highlightingRules.append(rule);
+    formats[int(TokenType::MultiLineString)].setForeground(QColor(0, 128, 0));
 
     // comments (gray)
-    commentFormat.setForeground(Qt::gray);
-    rule.pattern = QRegularExpression("#[^\n]*");
-    rule.format = commentFormat;
-    highlightingRules.append(rule);
-
-    // numbers (red)
-    numberFormat.setForeground(Qt::red);
-    rule.pattern = QRegularExpression("\\b\\d+\\.?\\d*\\b");
-    rule.format = numberFormat;
-    highlightingRules.append(rule);
-    
-    // hexademicimal numbers
-    rule.pattern = QRegularExpression("\\b0[xX][0-9a-fA-F]+\\b");
-    rule.format = numberFormat;
-    highlightingRules.append(rule);
-    // something else
-    // 8
-    rule.pattern = QRegularExpression("\\b0[oO][0-7]+\\b");
-    rule.format = numberFormat;
-    highlightingRules.append(rule);
-    
-    // 2
-    rule.pattern = QRegularExpression("\\b0[bB][01]+\\b");
-    rule.format = numberFormat;
-    highlightingRules.append(rule);
-
-    decoratorFormat.setForeground(QColor(0, 100, 200));  
+    formats[int(TokenType::Comment)].setForeground(Qt::gray);
+
+    // numbers (red), also hex, octal and binary
+    formats[int(TokenType::Number)].setForeground(Qt::red);
+
+    QTextCharFormat decoratorFormat;
+    decoratorFormat.setForeground(QColor(0, 100, 200));
     decoratorFormat.setFontWeight(QFont::Bold);
-    rule.pattern = QRegularExpression("@\\w+");
-    rule.format = decoratorFormat;
-    highlightingRules.append(rule);
+    formats[int(TokenType::Decorator)] = decoratorFormat;
+}
+
+const SyntaxStyle &SyntaxStyle::instance() {
+    static const SyntaxStyle shared;
+    return shared;
+}
+
+Parser::Parser(QTextDocument *parent)
+    : QSyntaxHighlighter(static_cast<QObject *>(parent))
+    , style(SyntaxStyle::instance()) {
+    applyTimer.setInterval(0);
+    connect(&applyTimer, &QTimer::timeout, this, &Parser::applyPendingChunk);
+
+    // Attached by hand so our slots run before and after the highlighter's own
+    if (parent) {
+        connect(parent, &QTextDocument::contentsChange, this, &Parser::onEditStarted);
+        setDocument(parent);
+        connect(parent, &QTextDocument::contentsChange, this, &Parser::onEditFinished);
+    }
+}
+
+Parser::~Parser() {
+    cancelAsync();
 }
 
 void Parser::highlightBlock(const QString &text) {
-    for (const HighlightingRule &rule : highlightingRules) {
-        QRegularExpressionMatchIterator matchIterator = rule.pattern.globalMatch(text);
-        while (matchIterator.hasNext()) {
-            QRegularExpressionMatch match = matchIterator.next();
-            setFormat(match.capturedStart(), match.capturedLength(), rule.format);
+    ++blocksThisEdit;
+    const int packedIn = qMax(previousBlockState(), 0);
+
+    const bool applying = applyLine && currentBlock() == applyBlock;
+
+    if (!applying && (asyncRunning || viewportOnly)) {
+        // Off screen and not reached by the worker yet (or never will be in
+        // viewport-only mode): leave it, before even hashing the line
+        const int blockNumber = currentBlock().blockNumber();
+        if ((viewportOnly || blockNumber >= frontier) && !isNearViewport(blockNumber)) {
+            return;
+        }
+    }
+
+    const size_t hash = qHash(text);
+    TokenCache &cache = TokenCache::instance();
+
+    // Result from the background pass, still valid if neither the line
+    // nor the state coming into it changed since the snapshot
+    if (applying) {
+        if (applyLine->inState == packedIn && applyLine->hash == hash) {
+            cache.insert(hash, text, packedIn, applyLine->tokens, applyLine->outState);
+            setOutgoingState(applyLine->outState);
+            applyTokens(applyLine->tokens);
+            return;
         }
+        ++rejectedLines;
+    }
+
+    // Same text coming in with the same state gives the same tokens
+    if (const TokenCache::Entry *entry = cache.find(hash, text, packedIn)) {
+        setOutgoingState(entry->outState);
+        applyTokens(entry->tokens);
+        return;
+    }
+
+    // Single pass over the line, spans never overlap. The vector goes
+    // into the cache as is, so it is not reused between blocks.
+    LexState state = incomingState();
+    QVector<Token> tokens;
+    Lexer::tokenize(text, state, tokens);
+    cache.insert(hash, text, packedIn, tokens, state);
+    setOutgoingState(state);
+    applyTokens(tokens);
+}
+
+LexState Parser::incomingState() const {
+    const int packed = previousBlockState();
+    if (packed > 0 && (packed & LexState::overflowBit)) {
+        const BlockData *data = static_cast<const BlockData *>(currentBlock().previous().userData());
+        return data ? data->state : LexState();
     }
-    
-    setCurrentBlockState(0);
-    
-    highlightMultiLine(text, "\"\"\"", multiLineStringFormat);
-    highlightMultiLine(text, "'''", multiLineStringFormat);
+    return LexState::unpack(packed);
 }
 
-void Parser::highlightMultiLine(const QString &text, const QString &delimiter, const QTextCharFormat &format) {
-    int startIndex = 0;
-    if (previousBlockState() != 1) {
-        startIndex = text.indexOf(delimiter);
+void Parser::setOutgoingState(const LexState &state) {
+    // QSyntaxHighlighter keeps going to the next block only while this value
+    // changes, so an exact state is what stops re-highlighting early
+    const int packed = state.pack();
+    if (packed & LexState::overflowBit) {
+        setCurrentBlockUserData(new BlockData(state));
+    } else if (currentBlockUserData()) {
+        setCurrentBlockUserData(nullptr);
     }
+    setCurrentBlockState(packed);
+}
 
-    while (startIndex >= 0) {
-        int endIndex = text.indexOf(delimiter, startIndex + delimiter.length());
-        int commentLength;
-        if (endIndex == -1) {
-            setCurrentBlockState(1);
-            commentLength = text.length() - startIndex;
-        } else {
-            commentLength = endIndex - startIndex + delimiter.length();
+void Parser::onEditStarted() {
+    if (editDepth++ == 0) {
+        blocksThisEdit = 0;
+    }
+}
+
+void Parser::onEditFinished() {
+    // Format updates emit contentsChange too, only the outermost one is the edit
+    if (--editDepth == 0 && blocksThisEdit > 0) {
+        lastEditBlocks = blocksThisEdit;
+        emit editRehighlighted(lastEditBlocks);
+    }
+}
+
+void Parser::applyTokens(const QVector<Token> &lineTokens) {
+    for (const Token &token : lineTokens) {
+        setFormat(token.start, token.length, style.format(token.type));
+    }
+}
+
+void Parser::highlightAsync(QPlainTextEdit *editor) {
+    QTextDocument *doc = document();
+    if (!doc || !editor || doc->blockCount() < asyncThreshold) {
+        return;
+    }
+
+    cancelAsync();
+    attachView(editor);
+    viewportOnly = false;
+
+    updateViewRange();
+    asyncRunning = true;
+    workerDone = false;
+    frontier = 0;
+    rejectedLines = 0;
+
+    // The snapshot is a plain QString, the worker never touches the document.
+    // Raw text keeps every character as the blocks have it, so line hashes match.
+    watcher = new QFutureWatcher<HighlightChunk>(this);
+    connect(watcher, &QFutureWatcher<HighlightChunk>::resultsReadyAt, this, &Parser::onChunksReady);
+    connect(watcher, &QFutureWatcher<HighlightChunk>::finished, this, &Parser::onWorkerFinished);
+    watcher->setFuture(QtConcurrent::run(&Parser::tokenizeSnapshot, doc->toRawText(), chunkSize));
+
+    // Paint the visible part now, before the first chunk arrives
+    highlightVisibleBlocks();
+}
+
+void Parser::highlightViewport(QPlainTextEdit *editor) {
+    if (!document() || !editor) {
+        return;
+    }
+
+    cancelAsync();
+    attachView(editor);
+    viewportOnly = true;
+    updateViewRange();
+
+    // Lines above the margin are never lexed, so a string opened far above
+    // the viewport is missed. That is the price of not touching the whole file.
+    highlightVisibleBlocks();
+}
+
+void Parser::attachView(QPlainTextEdit *editor) {
+    if (view == editor) {
+        return;
+    }
+    if (view) {
+        disconnect(view->verticalScrollBar(), nullptr, this, nullptr);
+    }
+    view = editor;
+    connect(view->verticalScrollBar(), &QScrollBar::valueChanged, this, &Parser::onViewScrolled);
+}
+
+void Parser::highlightVisibleBlocks() {
+    // Starts a little above the view so states flow into the first visible line
+    QTextBlock block = document()->findBlockByNumber(qMax(0, viewFirst - viewportMargin));
+    while (block.isValid() && block.blockNumber() <= viewLast) {
+        rehighlightBlock(block);
+        block = block.next();
+    }
+}
+
+void Parser::tokenizeSnapshot(QPromise<HighlightChunk> &promise, const QString &text, int chunkSize) {
+    HighlightChunk chunk;
+    LexState state;
+    int blockNumber = 0;
+    int start = 0;
+    const int length = text.length();
+
+    while (start <= length) {
+        if (promise.isCanceled()) {
+            return;
+        }
+
+        int end = text.indexOf(QChar::ParagraphSeparator, start);
+        if (end < 0) {
+            end = length;
+        }
+
+        const QString line = QString::fromRawData(text.constData() + start, end - start);
+        HighlightLine result;
+        result.hash = qHash(line);
+        result.inState = state.pack();
+        Lexer::tokenize(line, state, result.tokens);
+        result.outState = state;
+        chunk.lines.append(std::move(result));
+        ++blockNumber;
+
+        if (chunk.lines.size() >= chunkSize) {
+            promise.addResult(std::move(chunk));
+            chunk = HighlightChunk();
+            chunk.firstBlock = blockNumber;
+        }
+        start = end + 1;
+    }
+
+    if (!chunk.lines.isEmpty()) {
+        promise.addResult(std::move(chunk));
+    }
+}
+
+void Parser::onChunksReady(int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+        pendingChunks.append(watcher->resultAt(i));
+    }
+    if (!applyTimer.isActive()) {
+        applyTimer.start();
+    }
+}
+
+void Parser::onWorkerFinished() {
+    workerDone = true;
+    if (pendingChunks.isEmpty()) {
+        finishAsync();
+    }
+}
+
+void Parser::applyPendingChunk() {
+    if (pendingChunks.isEmpty()) {
+        applyTimer.stop();
+        if (workerDone) {
+            finishAsync();
         }
-        setFormat(startIndex, commentLength, format);
-        startIndex = text.indexOf(delimiter, startIndex + commentLength);
+        return;
     }
-}
\ No newline at end of file
+
+    // One chunk per event loop pass keeps typing and scrolling responsive
+    const HighlightChunk chunk = pendingChunks.takeFirst();
+    QTextBlock block = document()->findBlockByNumber(chunk.firstBlock);
+    for (const HighlightLine &line : chunk.lines) {
+        if (!block.isValid()) {
+            break;
+        }
+        applyLine = &line;
+        applyBlock = block;
+        frontier = block.blockNumber() + 1;
+        rehighlightBlock(block);
+        block = block.next();
+    }
+    applyLine = nullptr;
+    applyBlock = QTextBlock();
+}
+
+void Parser::onViewScrolled() {
+    const int oldFirst = viewFirst;
+    const int oldLast = viewLast;
+    updateViewRange();
+    if (!asyncRunning && !viewportOnly) {
+        return;
+    }
+
+    // Scrolled ahead of the worker: highlight the newly visible blocks inline
+    const int first = viewportOnly ? qMax(0, viewFirst - viewportMargin) : qMax(viewFirst, frontier);
+    QTextBlock block = document()->findBlockByNumber(first);
+    while (block.isValid() && block.blockNumber() <= viewLast) {
+        const int blockNumber = block.blockNumber();
+        if (blockNumber < oldFirst || blockNumber > oldLast) {
+            rehighlightBlock(block);
+        }
+        block = block.next();
+    }
+}
+
+void Parser::updateViewRange() {
+    if (!view) {
+        return;
+    }
+    viewFirst = view->cursorForPosition(QPoint(0, 0)).blockNumber();
+    viewLast = view->cursorForPosition(QPoint(0, view->viewport()->height())).blockNumber();
+    viewLast = qMax(viewLast, viewFirst + minimumViewLines);
+}
+
+bool Parser::isNearViewport(int blockNumber) const {
+    return blockNumber >= viewFirst - viewportMargin && blockNumber <= viewLast + viewportMargin;
+}
+
+void Parser::releaseWatcher() {
+    if (watcher) {
+        watcher->disconnect(this);
+        watcher->cancel();
+        watcher->deleteLater();
+        watcher = nullptr;
+    }
+}
+
+void Parser::cancelAsync() {
+    releaseWatcher();
+    applyTimer.stop();
+    pendingChunks.clear();
+    asyncRunning = false;
+}
+
+void Parser::finishAsync() {
+    asyncRunning = false;
+    releaseWatcher();
+
+    // Lines edited off screen while the worker ran got no valid result, start over
+    if (rejectedLines > 0) {
+        highlightAsync(view);
+    }
+}
@@ -3,34 +3,127 @@
 
 #include <QSyntaxHighlighter>
 #include <QTextCharFormat>
-#include <QRegularExpression>
+#include <QTextBlock>
+#include <QFutureWatcher>
+#include <QPromise>
+#include <QPointer>
+#include <QTimer>
+#include "lexer.h"
+
+class QPlainTextEdit;
+
+// Formats for every TokenType. Built once on first use and shared read-only
+// by all Parser instances, so a new tab's highlighter costs almost nothing.
+class SyntaxStyle {
+public:
+    static const SyntaxStyle &instance();
+    const QTextCharFormat &format(TokenType type) const { return formats[int(type)]; }
+
+private:
+    SyntaxStyle();
+    QTextCharFormat formats[int(TokenType::Count)];
+};
+
+// Full lexer state of a block whose state didn't fit into the packed int
+class BlockData : public QTextBlockUserData {
+public:
+    explicit BlockData(const LexState &state) : state(state) {}
+    LexState state;
+};
+
+// Tokens of one line as computed by the background pass
+struct HighlightLine {
+    QVector<Token> tokens;
+    size_t hash = 0;
+    int inState = 0;        // packed
+    LexState outState;
+};
+
+// A run of consecutive lines handed from the worker to the GUI thread
+struct HighlightChunk {
+    int firstBlock = 0;
+    QVector<HighlightLine> lines;
+};
 
 class Parser : public QSyntaxHighlighter {
     Q_OBJECT
 
 public:
     Parser(QTextDocument *parent = nullptr);
+    ~Parser();
+
+    // Viewport-first mode: highlights what `view` shows right away and
+    // tokenizes the rest of the document on a worker thread
+    void highlightAsync(QPlainTextEdit *view);
+    bool isHighlightingAsync() const { return asyncRunning; }
+
+    // Large-file mode: only blocks in or near the viewport of `view` are ever
+    // highlighted, there is no background pass over the rest of the document
+    void highlightViewport(QPlainTextEdit *view);
+    bool isViewportOnly() const { return viewportOnly; }
+
+    // Lines per worker chunk, also the number of blocks applied per event loop pass
+    void setChunkSize(int blocks) { chunkSize = qMax(1, blocks); }
+    int highlightChunkSize() const { return chunkSize; }
+
+    // Documents smaller than this are highlighted synchronously as before
+    static constexpr int asyncThreshold = 2000;
+
+    // How many blocks the last edit re-highlighted before the state converged
+    int lastEditBlockCount() const { return lastEditBlocks; }
+
+signals:
+    void editRehighlighted(int blocks);
 
 protected:
     void highlightBlock(const QString &text) override;
 
+private slots:
+    void onEditStarted();
+    void onEditFinished();
+    void onChunksReady(int begin, int end);
+    void onWorkerFinished();
+    void applyPendingChunk();
+    void onViewScrolled();
+
 private:
-    struct HighlightingRule {
-        QRegularExpression pattern;
-        QTextCharFormat format;
-    };
-
-    QVector<HighlightingRule> highlightingRules;
-
-    QTextCharFormat keywordFormat;
-    QTextCharFormat doubleStringFormat;
-    QTextCharFormat singleStringFormat;
-    QTextCharFormat multiLineStringFormat;
-    QTextCharFormat commentFormat;
-    QTextCharFormat numberFormat;
-    QTextCharFormat decoratorFormat;
-
-    void highlightMultiLine(const QString &text, const QString &delimiter, const QTextCharFormat &format);
+    static void tokenizeSnapshot(QPromise<HighlightChunk> &promise, const QString &text, int chunkSize);
+
+    LexState incomingState() const;
+    void setOutgoingState(const LexState &state);
+    void applyTokens(const QVector<Token> &lineTokens);
+    void attachView(QPlainTextEdit *editor);
+    void highlightVisibleBlocks();
+    void updateViewRange();
+    bool isNearViewport(int blockNumber) const;
+    void releaseWatcher();
+    void cancelAsync();
+    void finishAsync();
+
+    const SyntaxStyle &style;
+
+    // Re-highlight counter, editDepth tracks nested contentsChange signals
+    int editDepth = 0;
+    int blocksThisEdit = 0;
+    int lastEditBlocks = 0;
+
+    // Background pass, a fresh watcher per run so stale results never arrive
+    QFutureWatcher<HighlightChunk> *watcher = nullptr;
+    QVector<HighlightChunk> pendingChunks;
+    QTimer applyTimer;
+    QPointer<QPlainTextEdit> view;
+    int chunkSize = 500;
+    bool asyncRunning = false;
+    bool viewportOnly = false;
+    bool workerDone = false;
+    int frontier = 0;       // blocks below this already got their worker result
+    int rejectedLines = 0;  // results dropped because the line was edited meanwhile
+    int viewFirst = 0;
+    int viewLast = 0;
+
+    // Set while a worker result is being applied to `applyBlock`
+    const HighlightLine *applyLine = nullptr;
+    QTextBlock applyBlock;
 };
 
-#endif // PARSER_H
\ No newline at end of file
+#endif // PARSER_H
@@ -0,0 +1,801 @@
+#include "syntaxtree.h"
+#include "lexer.h"
+#include "linechange.h"
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+
+namespace {
+
+constexpr int indentWidth = 4;
+constexpr int tabWidth = 8;
+
+int indentOf(const QString &text)
+{
+    int width = 0;
+    for (const QChar c : text) {
+        if (c == QLatin1Char(' ')) {
+            ++width;
+        } else if (c == QLatin1Char('\t')) {
+            width = (width / tabWidth + 1) * tabWidth;
+        } else {
+            break;
+        }
+    }
+    return width;
+}
+
+// Blank or comment-only, such lines never start a statement
+bool isTrivia(QStringView text)
+{
+    for (const QChar c : text) {
+        if (c != QLatin1Char(' ') && c != QLatin1Char('\t') && c != QLatin1Char('\f')) {
+            return c == QLatin1Char('#');
+        }
+    }
+    return true;
+}
+
+bool isStringOrComment(TokenType type)
+{
+    return type == TokenType::DoubleString || type == TokenType::SingleString
+        || type == TokenType::MultiLineString || type == TokenType::Comment;
+}
+
+// Blanks out strings and comments so only code is left, columns unchanged
+void maskTokens(QString &text, const QVector<Token> &tokens)
+{
+    QChar *data = text.data();
+    for (const Token &token : tokens) {
+        if (isStringOrComment(token.type)) {
+            std::fill(data + token.start, data + token.start + token.length, QLatin1Char(' '));
+        }
+    }
+}
+
+bool endsWithBackslash(const QString &code)
+{
+    for (int i = code.size() - 1; i >= 0; --i) {
+        if (!code.at(i).isSpace()) {
+            return code.at(i) == QLatin1Char('\\');
+        }
+    }
+    return false;
+}
+
+bool isIdentStart(QChar c)
+{
+    return c.isLetter() || c == QLatin1Char('_');
+}
+
+bool isIdentChar(QChar c)
+{
+    return c.isLetterOrNumber() || c == QLatin1Char('_');
+}
+
+int skipSpaces(const QString &code, int i)
+{
+    while (i < code.size() && code.at(i).isSpace()) {
+        ++i;
+    }
+    return i;
+}
+
+// Identifier at i (dots allowed if `dotted`), advances i past it
+QString readName(const QString &code, int &i, bool dotted = false)
+{
+    i = skipSpaces(code, i);
+    const int start = i;
+    if (i < code.size() && isIdentStart(code.at(i))) {
+        while (i < code.size() && (isIdentChar(code.at(i)) || (dotted && code.at(i) == QLatin1Char('.')))) {
+            ++i;
+        }
+    }
+    return code.mid(start, i - start);
+}
+
+bool isDottedName(const QString &text)
+{
+    if (text.isEmpty() || !isIdentStart(text.at(0)) || text.endsWith(QLatin1Char('.'))) {
+        return false;
+    }
+    for (const QChar c : text) {
+        if (!isIdentChar(c) && c != QLatin1Char('.')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// "a, (b as c)" -> parts without brackets or line continuations
+QStringList nameList(QString list)
+{
+    for (QChar &c : list) {
+        if (c == QLatin1Char('(') || c == QLatin1Char(')') || c == QLatin1Char('\\')) {
+            c = QLatin1Char(' ');
+        }
+    }
+    QStringList parts;
+    for (const QString &part : list.split(QLatin1Char(','))) {
+        const QString trimmed = part.simplified();
+        if (!trimmed.isEmpty()) {
+            parts << trimmed;
+        }
+    }
+    return parts;
+}
+
+// "x as y" binds y, "a.b" binds a
+QString boundName(const QString &part, bool firstComponent)
+{
+    const int as = part.indexOf(QLatin1String(" as "));
+    if (as >= 0) {
+        return part.mid(as + 4).trimmed();
+    }
+    return firstComponent ? part.section(QLatin1Char('.'), 0, 0) : part;
+}
+
+void addTargets(const QString &segment, QStringList &targets)
+{
+    QString text = segment;
+
+    // Annotation: only the name before ':' is bound
+    int depth = 0;
+    for (int i = 0; i < text.size(); ++i) {
+        const QChar c = text.at(i);
+        if (c == QLatin1Char('(') || c == QLatin1Char('[') || c == QLatin1Char('{')) {
+            ++depth;
+        } else if (c == QLatin1Char(')') || c == QLatin1Char(']') || c == QLatin1Char('}')) {
+            --depth;
+        } else if (c == QLatin1Char(':') && depth == 0) {
+            text.truncate(i);
+            break;
+        }
+    }
+
+    // Tuple unpacking; subscripts like a[i] turn into "a i" and get dropped
+    for (QChar &c : text) {
+        if (c == QLatin1Char('(') || c == QLatin1Char(')') || c == QLatin1Char('[') || c == QLatin1Char(']')) {
+            c = QLatin1Char(' ');
+        }
+    }
+    for (const QString &part : text.split(QLatin1Char(','))) {
+        QString name = part.trimmed();
+        if (name.startsWith(QLatin1Char('*'))) {
+            name = name.mid(1);
+        }
+        if (isDottedName(name)) {
+            targets << name;
+        }
+    }
+}
+
+void collectAssignments(const QString &code, bool opensBlock, QStringList &targets)
+{
+    static const QString augmented = QStringLiteral("=!<>:+-*/%&|^@");
+    int depth = 0;
+    int segment = 0;
+    int colon = -1;
+
+    for (int i = 0; i < code.size(); ++i) {
+        const QChar c = code.at(i);
+        if (c == QLatin1Char('(') || c == QLatin1Char('[') || c == QLatin1Char('{')) {
+            ++depth;
+        } else if (c == QLatin1Char(')') || c == QLatin1Char(']') || c == QLatin1Char('}')) {
+            depth = qMax(0, depth - 1);
+        } else if (depth == 0 && c == QLatin1Char(':') && colon < 0) {
+            colon = i;
+        } else if (depth == 0 && c == QLatin1Char('=')) {
+            if (i + 1 < code.size() && code.at(i + 1) == QLatin1Char('=')) {
+                ++i;
+                continue;
+            }
+            if (i > 0 && augmented.contains(code.at(i - 1))) {
+                continue;
+            }
+            addTargets(code.mid(segment, i - segment), targets);
+            segment = i + 1;
+        }
+    }
+
+    // Bare annotation "x: int"
+    if (segment == 0 && colon > 0 && !opensBlock) {
+        addTargets(code.left(colon), targets);
+    }
+}
+
+void classify(const QString &code, SyntaxNode &node)
+{
+    static const QStringList blockKeywords = {
+        "if", "elif", "else", "for", "while", "with", "try", "except", "finally"
+    };
+    static const QStringList flowKeywords = {
+        "return", "pass", "raise", "break", "continue"
+    };
+
+    int end = code.size();
+    while (end > 0 && code.at(end - 1).isSpace()) {
+        --end;
+    }
+    const bool opensBlock = end > 0 && code.at(end - 1) == QLatin1Char(':');
+    if (opensBlock) {
+        node.flags |= SyntaxNode::OpensBlock;
+    }
+
+    int i = skipSpaces(code, 0);
+    if (i < code.size() && code.at(i) == QLatin1Char('@')) {
+        ++i;
+        node.kind = SyntaxNode::Decorator;
+        node.name = readName(code, i, true);
+        return;
+    }
+
+    QString word = readName(code, i);
+    if (word == QLatin1String("async")) {
+        word = readName(code, i);
+    }
+
+    if (word == QLatin1String("class") || word == QLatin1String("def")) {
+        node.kind = word == QLatin1String("class") ? SyntaxNode::Class : SyntaxNode::Function;
+        node.name = readName(code, i);
+    } else if (blockKeywords.contains(word)
+               || (opensBlock && (word == QLatin1String("match") || word == QLatin1String("case")))) {
+        node.kind = SyntaxNode::Block;
+        node.name = word;
+    } else if (word == QLatin1String("import")) {
+        node.kind = SyntaxNode::Import;
+        for (const QString &part : nameList(code.mid(i))) {
+            if (node.name.isEmpty()) {
+                node.name = part.section(QLatin1Char(' '), 0, 0);
+            }
+            node.targets << boundName(part, true);
+        }
+    } else if (word == QLatin1String("from")) {
+        node.kind = SyntaxNode::Import;
+        const int import = code.indexOf(QLatin1String(" import "), i);
+        if (import >= 0) {
+            node.name = code.mid(i, import - i).simplified().remove(QLatin1Char(' '));
+            for (const QString &part : nameList(code.mid(import + 8))) {
+                if (part != QLatin1String("*")) {
+                    node.targets << boundName(part, false);
+                }
+            }
+        }
+    } else {
+        node.kind = SyntaxNode::Statement;
+        if (flowKeywords.contains(word)) {
+            node.flags |= SyntaxNode::EndsFlow;
+        }
+        collectAssignments(code, opensBlock, node.targets);
+    }
+}
+
+// One pass over the lines. Statements that begin where a statement of the old
+// tree began, with the same indentation and outside the edited lines, are
+// taken over whole instead of being parsed again.
+class TreeBuilder
+{
+public:
+    TreeBuilder(const QVector<QString> &lines, const SyntaxNodePtr &old, const TreeEdit &edit)
+        : lines(lines), count(int(lines.size())), old(old), edit(edit) {}
+
+    SyntaxNodePtr build()
+    {
+        auto module = std::make_shared<SyntaxNode>();
+        module->kind = SyntaxNode::Module;
+        module->indent = -1;
+
+        int line = 0;
+        while (line < count && isTrivia(lines.at(line))) {
+            ++line;
+        }
+        parseBody(line, -1, 0, *module);
+
+        module->lineCount = count;
+        module->trailingTrivia = module->children.isEmpty() ? count : module->children.last()->trailingTrivia;
+        return module;
+    }
+
+private:
+    void parseBody(int &line, int parentIndent, int parentStart, SyntaxNode &parent)
+    {
+        while (line < count) {
+            const int indent = indentOf(lines.at(line));
+            if (indent <= parentIndent) {
+                break;
+            }
+            const int start = line;
+            SyntaxNodePtr child = reusable(line, indent);
+            if (child) {
+                line += child->lineCount;
+            } else {
+                child = parseStatement(line, indent);
+            }
+            parent.childOffsets.append(start - parentStart);
+            parent.children.append(std::move(child));
+        }
+    }
+
+    SyntaxNodePtr parseStatement(int &line, int indent)
+    {
+        struct Open {
+            int line;
+            int column;
+            QChar bracket;
+        };
+
+        auto node = std::make_shared<SyntaxNode>();
+        node->indent = indent;
+        const int start = line;
+
+        LexState state;
+        QVector<Token> tokens;
+        QVector<Open> open;
+        QString code;
+        bool continued = false;
+
+        // The logical line: brackets, strings and backslashes carry it on
+        do {
+            QString masked = lines.at(line);
+            tokens.clear();
+            Lexer::tokenize(masked, state, tokens);
+            maskTokens(masked, tokens);
+
+            for (int column = 0; column < masked.size(); ++column) {
+                const QChar c = masked.at(column);
+                if (c == QLatin1Char('(') || c == QLatin1Char('[') || c == QLatin1Char('{')) {
+                    open.append({line - start, column, c});
+                } else if (c == QLatin1Char(')') || c == QLatin1Char(']') || c == QLatin1Char('}')) {
+                    const QChar expected = c == QLatin1Char(')') ? QLatin1Char('(')
+                                         : c == QLatin1Char(']') ? QLatin1Char('[') : QLatin1Char('{');
+                    if (!open.isEmpty() && open.last().bracket == expected) {
+                        const Open o = open.takeLast();
+                        node->brackets.append({o.line, o.column, line - start, column});
+                    }
+                }
+            }
+
+            continued = state.bracketDepth > 0 || !state.frames.isEmpty() || endsWithBackslash(masked);
+            if (!code.isEmpty()) {
+                code += QLatin1Char(' ');
+            }
+            code += masked;
+            ++line;
+        } while (continued && line < count);
+
+        for (const Open &o : open) {
+            node->brackets.append({o.line, o.column, -1, -1});
+        }
+        node->headerLines = line - start;
+        classify(code, *node);
+
+        // Blank and comment lines after a statement hang off it
+        int trivia = 0;
+        while (line < count && isTrivia(lines.at(line))) {
+            ++line;
+            ++trivia;
+        }
+        if (line < count && indentOf(lines.at(line)) > indent) {
+            parseBody(line, indent, start, *node);
+        }
+
+        node->lineCount = line - start;
+        node->trailingTrivia = node->children.isEmpty() ? trivia : node->children.last()->trailingTrivia;
+        return node;
+    }
+
+    // Old node starting at the same place, if nothing it depends on was edited
+    SyntaxNodePtr reusable(int line, int indent) const
+    {
+        if (!old) {
+            return nullptr;
+        }
+
+        int oldLine;
+        if (line < edit.start) {
+            oldLine = line;
+        } else if (line > edit.newEnd) {
+            oldLine = line - edit.newEnd + edit.oldEnd;
+        } else {
+            return nullptr;
+        }
+
+        const SyntaxNode *node = old.get();
+        int start = 0;
+        for (;;) {
+            const QVector<int> &offsets = node->childOffsets;
+            const auto it = std::upper_bound(offsets.cbegin(), offsets.cend(), oldLine - start);
+            if (it == offsets.cbegin()) {
+                return nullptr;
+            }
+            const int index = int(it - offsets.cbegin()) - 1;
+            const int childStart = start + offsets.at(index);
+            const SyntaxNodePtr &child = node->children.at(index);
+            if (oldLine >= childStart + child->lineCount) {
+                return nullptr;
+            }
+            if (childStart == oldLine) {
+                if (child->indent != indent) {
+                    return nullptr;
+                }
+                // Before the edit, the line that ended the node must be untouched too
+                if (line < edit.start && childStart + child->lineCount >= edit.start) {
+                    return nullptr;
+                }
+                return child;
+            }
+            node = child.get();
+            start = childStart;
+        }
+    }
+
+    const QVector<QString> &lines;
+    const int count;
+    const SyntaxNodePtr old;
+    const TreeEdit edit;
+};
+
+// `first` maps text A to B, `second` B to C: one edit mapping A to C
+TreeEdit compose(const TreeEdit &first, const TreeEdit &second)
+{
+    TreeEdit merged;
+    merged.start = qMin(first.start, second.start);
+    merged.oldEnd = second.oldEnd > first.newEnd ? first.oldEnd + (second.oldEnd - first.newEnd) : first.oldEnd;
+    merged.newEnd = first.newEnd > second.oldEnd ? first.newEnd + (second.newEnd - second.oldEnd) : second.newEnd;
+    return merged;
+}
+
+} // namespace
+
+SyntaxTree::SyntaxTree(QTextDocument *document, QObject *parent)
+    : QObject(parent)
+    , doc(document) {
+    // Connected before any highlighter, so the mirror is current when the
+    // highlighter's own format-only contentsChange signals come through
+    connect(doc, &QTextDocument::contentsChange, this, &SyntaxTree::onContentsChange);
+    resync();
+}
+
+SyntaxTree::~SyntaxTree() {
+    releaseWatcher();
+}
+
+void SyntaxTree::setEnabled(bool on) {
+    if (enabled == on) {
+        return;
+    }
+    enabled = on;
+    if (enabled) {
+        resync();
+        return;
+    }
+
+    releaseWatcher();
+    lines.clear();
+    lines.squeeze();
+    tree.reset();
+    dirty = false;
+    treeBehind = false;
+    emit treeUpdated();
+}
+
+bool SyntaxTree::isUpToDate() const {
+    return enabled && tree && !dirty && !watcher;
+}
+
+void SyntaxTree::resync() {
+    if (!enabled) {
+        return;
+    }
+
+    lines.clear();
+    lines.reserve(doc->blockCount());
+    for (QTextBlock block = doc->begin(); block.isValid(); block = block.next()) {
+        lines.append(block.text());
+    }
+
+    releaseWatcher();
+    tree.reset();
+    treeBehind = false;
+    pending = TreeEdit{0, -1, int(lines.size()) - 1};
+    dirty = true;
+    startParse();
+}
+
+void SyntaxTree::onContentsChange(int position, int removed, int added) {
+    Q_UNUSED(removed)
+    if (!enabled) {
+        return;
+    }
+
+    const LineChange change = LineChange::of(doc, position, added, int(lines.size()));
+    if (!change.valid) {
+        resync();
+        return;
+    }
+    const QTextBlock first = change.first;
+    const int start = change.start;
+    const int oldEnd = change.oldEnd;
+    const int newEnd = change.newEnd;
+    const int delta = change.delta;
+
+    // The highlighter's format updates arrive here too, with the text unchanged
+    if (delta == 0) {
+        bool changed = false;
+        QTextBlock block = first;
+        for (int i = start; i <= newEnd && !changed; ++i, block = block.next()) {
+            changed = block.text() != lines.at(i);
+        }
+        if (!changed) {
+            return;
+        }
+    }
+
+    // Only the touched lines are copied, the rest of the mirror stays shared
+    const int common = qMin(oldEnd, newEnd) - start + 1;
+    QTextBlock block = first;
+    for (int i = 0; i < common; ++i, block = block.next()) {
+        lines[start + i] = block.text();
+    }
+    if (delta > 0) {
+        lines.insert(start + common, delta, QString());
+        for (int i = 0; i < delta; ++i, block = block.next()) {
+            lines[start + common + i] = block.text();
+        }
+    } else if (delta < 0) {
+        lines.remove(start + common, -delta);
+    }
+
+    addEdit(start, oldEnd, newEnd);
+    startParse();
+}
+
+void SyntaxTree::addEdit(int start, int oldEnd, int newEnd) {
+    const TreeEdit edit{start, oldEnd, newEnd};
+    if (tree) {
+        sinceTree = treeBehind ? compose(sinceTree, edit) : edit;
+        treeBehind = true;
+    }
+
+    if (!dirty) {
+        pending = edit;
+        dirty = true;
+        return;
+    }
+
+    // `pending` maps the tree's text to the text before this edit,
+    // this edit maps that to the current text
+    pending = compose(pending, edit);
+}
+
+void SyntaxTree::startParse() {
+    // One parse at a time, edits made meanwhile go into the next one
+    if (!enabled || !dirty || watcher) {
+        return;
+    }
+
+    const TreeEdit edit = pending;
+    dirty = false;
+
+    watcher = new QFutureWatcher<SyntaxNodePtr>(this);
+    connect(watcher, &QFutureWatcher<SyntaxNodePtr>::finished, this, &SyntaxTree::onParseFinished);
+    watcher->setFuture(QtConcurrent::run(&SyntaxTree::parse, lines, tree, edit));
+}
+
+void SyntaxTree::onParseFinished() {
+    const SyntaxNodePtr result = watcher->result();
+    releaseWatcher();
+
+    tree = result;
+    // What was typed during the parse is still ahead of it
+    sinceTree = pending;
+    treeBehind = dirty;
+    emit treeUpdated();
+    startParse();
+}
+
+void SyntaxTree::releaseWatcher() {
+    if (watcher) {
+        watcher->disconnect(this);
+        watcher->deleteLater();
+        watcher = nullptr;
+    }
+}
+
+SyntaxNodePtr SyntaxTree::parse(const QVector<QString> &lines, const SyntaxNodePtr &old, const TreeEdit &edit) {
+    return TreeBuilder(lines, old, edit).build();
+}
+
+const SyntaxNodePtr *SyntaxTree::innermostAt(int line, int *start) const {
+    // Raw pointers down, the path is never copied: the gutter asks per painted line
+    const SyntaxNodePtr *found = &tree;
+    *start = 0;
+    if (!tree || line < 0 || line >= tree->lineCount) {
+        return found;
+    }
+
+    const SyntaxNode *node = tree.get();
+    int nodeStart = 0;
+    for (;;) {
+        const QVector<int> &offsets = node->childOffsets;
+        const auto it = std::upper_bound(offsets.cbegin(), offsets.cend(), line - nodeStart);
+        if (it == offsets.cbegin()) {
+            break;
+        }
+        const int index = int(it - offsets.cbegin()) - 1;
+        const int childStart = nodeStart + offsets.at(index);
+        const SyntaxNodePtr &child = node->children.at(index);
+        if (line >= childStart + child->lineCount) {
+            break;
+        }
+        found = &child;
+        *start = childStart;
+        node = child.get();
+        nodeStart = childStart;
+    }
+    return found;
+}
+
+int SyntaxTree::toTreeLine(int line) const {
+    if (!treeBehind || line < sinceTree.start) {
+        return line;
+    }
+    return line > sinceTree.newEnd ? line - sinceTree.newEnd + sinceTree.oldEnd : -1;
+}
+
+int SyntaxTree::fromTreeLine(int line) const {
+    if (!treeBehind || line < sinceTree.start) {
+        return line;
+    }
+    return line > sinceTree.oldEnd ? line - sinceTree.oldEnd + sinceTree.newEnd : -1;
+}
+
+SyntaxTree::NodeRef SyntaxTree::nodeAt(int line) const {
+    int start;
+    const SyntaxNodePtr *node = innermostAt(line, &start);
+    return NodeRef{*node, start};
+}
+
+QVector<SyntaxTree::NodeRef> SyntaxTree::pathAt(int line) const {
+    QVector<NodeRef> path;
+    if (!tree || line < 0 || line >= tree->lineCount) {
+        return path;
+    }
+
+    const SyntaxNode *node = tree.get();
+    int start = 0;
+    for (;;) {
+        const QVector<int> &offsets = node->childOffsets;
+        const auto it = std::upper_bound(offsets.cbegin(), offsets.cend(), line - start);
+        if (it == offsets.cbegin()) {
+            break;
+        }
+        const int index = int(it - offsets.cbegin()) - 1;
+        const int childStart = start + offsets.at(index);
+        const SyntaxNodePtr &child = node->children.at(index);
+        if (line >= childStart + child->lineCount) {
+            break;
+        }
+        path.append({child, childStart});
+        node = child.get();
+        start = childStart;
+    }
+    return path;
+}
+
+int SyntaxTree::foldEndAt(int line) const {
+    const int treeLine = toTreeLine(line);
+    if (treeLine < 0) {
+        return -1;
+    }
+    int start;
+    const SyntaxNodePtr *node = innermostAt(treeLine, &start);
+    if (!*node || node == &tree || start != treeLine) {
+        return -1;
+    }
+    const int end = treeLine + (*node)->contentLines() - 1;
+    if (end <= treeLine) {
+        return -1;
+    }
+    // Ends among the edits: they count as part of it
+    const int current = fromTreeLine(end);
+    return current >= 0 ? current : sinceTree.newEnd;
+}
+
+bool SyntaxTree::matchBracket(int line, int column, int *matchLine, int *matchColumn) const {
+    const int treeLine = toTreeLine(line);
+    if (treeLine < 0) {
+        return false;
+    }
+    const NodeRef ref = nodeAt(treeLine);
+    if (!ref.isValid()) {
+        return false;
+    }
+
+    for (const BracketPair &pair : ref.node->brackets) {
+        if (pair.closeLine < 0) {
+            continue;
+        }
+        int partnerLine = -1;
+        if (ref.line + pair.openLine == treeLine && pair.openColumn == column) {
+            partnerLine = ref.line + pair.closeLine;
+            *matchColumn = pair.closeColumn;
+        } else if (ref.line + pair.closeLine == treeLine && pair.closeColumn == column) {
+            partnerLine = ref.line + pair.openLine;
+            *matchColumn = pair.openColumn;
+        } else {
+            continue;
+        }
+        // The partner's line may have been edited since
+        *matchLine = fromTreeLine(partnerLine);
+        return *matchLine >= 0;
+    }
+    return false;
+}
+
+bool SyntaxTree::enclosingBracket(int line, int column, int *openLine, int *openColumn) const {
+    const NodeRef ref = nodeAt(line);
+    if (!ref.isValid()) {
+        return false;
+    }
+
+    // Opened before the position and closed at or after it; the latest such is innermost
+    bool found = false;
+    const int relative = line - ref.line;
+    for (const BracketPair &pair : ref.node->brackets) {
+        const bool openedBefore = pair.openLine < relative
+            || (pair.openLine == relative && pair.openColumn < column);
+        const bool closedAfter = pair.closeLine < 0 || pair.closeLine > relative
+            || (pair.closeLine == relative && pair.closeColumn >= column);
+        if (!openedBefore || !closedAfter) {
+            continue;
+        }
+        if (!found || pair.openLine > *openLine - ref.line
+            || (pair.openLine == *openLine - ref.line && pair.openColumn > *openColumn)) {
+            *openLine = ref.line + pair.openLine;
+            *openColumn = pair.openColumn;
+            found = true;
+        }
+    }
+    return found;
+}
+
+int SyntaxTree::indentForNewLine(int line, int column) const {
+    if (!isUpToDate() || line < 0 || line >= lines.size()) {
+        return -1;
+    }
+
+    const NodeRef ref = nodeAt(line);
+    if (!ref.isValid() || ref.node->kind == SyntaxNode::Module) {
+        return -1;
+    }
+    const SyntaxNode &node = *ref.node;
+
+    int openLine;
+    int openColumn;
+    if (enclosingBracket(line, column, &openLine, &openColumn)) {
+        // Nothing after the bracket: hanging indent, otherwise line up with it
+        const QString &text = lines.at(openLine);
+        const int end = openLine == line ? column : text.size();
+        if (isTrivia(QStringView(text).mid(openColumn + 1, end - openColumn - 1))) {
+            return node.indent + indentWidth;
+        }
+        return openColumn + 1;
+    }
+
+    // Blank and comment lines keep whatever indentation they have
+    const int headerEnd = ref.line + node.headerLines;
+    if (line >= headerEnd) {
+        return -1;
+    }
+    if (line == headerEnd - 1 && isTrivia(QStringView(lines.at(line)).mid(column))) {
+        if (node.flags & SyntaxNode::OpensBlock) {
+            return node.indent + indentWidth;
+        }
+        if (node.flags & SyntaxNode::EndsFlow) {
+            return qMax(0, node.indent - indentWidth);
+        }
+    }
+    return node.indent;
+}
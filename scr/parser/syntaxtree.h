@@ -0,0 +1,153 @@
+#ifndef SYNTAXTREE_H
+#define SYNTAXTREE_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QStringList>
+#include <QVector>
+#include <memory>
+
+class QTextDocument;
+class SyntaxNode;
+
+// Nodes are immutable once built, so the GUI thread and the parser thread can
+// share them and a new tree can point at every subtree of the old one it reuses
+using SyntaxNodePtr = std::shared_ptr<const SyntaxNode>;
+
+// Two brackets of one statement, lines relative to the statement start.
+// closeLine is -1 while the bracket is never closed.
+struct BracketPair {
+    int openLine;
+    int openColumn;
+    int closeLine;
+    int closeColumn;
+};
+
+// One logical line of Python and, for compound statements, its indented body.
+// Nothing here knows its absolute position: children are stored as offsets
+// from their parent, so a subtree stays valid wherever the edit moved it.
+class SyntaxNode {
+public:
+    enum Kind : quint8 {
+        Module,
+        Class,
+        Function,
+        Block,      // if, for, while, with, try, ... (name is the keyword)
+        Import,
+        Decorator,
+        Statement
+    };
+
+    enum Flag : quint8 {
+        OpensBlock = 0x01,  // header ends with ':'
+        EndsFlow = 0x02     // return, pass, raise, break, continue
+    };
+
+    Kind kind = Statement;
+    quint8 flags = 0;
+    int indent = 0;
+    int headerLines = 0;     // physical lines of the logical line itself
+    int lineCount = 0;       // header, body and trailing blank/comment lines
+    int trailingTrivia = 0;  // blank or comment-only lines at the end of lineCount
+    QString name;            // class/def name, block keyword, imported module
+    QStringList targets;     // names bound by an assignment or import
+    QVector<BracketPair> brackets;
+    QVector<int> childOffsets;
+    QVector<SyntaxNodePtr> children;
+
+    // Lines that carry code, without the blank lines hanging off the end
+    int contentLines() const { return lineCount - trailingTrivia; }
+};
+
+// Inclusive line range that changed: [start, oldEnd] in the text the tree was
+// built from became [start, newEnd] in the current text
+struct TreeEdit {
+    int start = 0;
+    int oldEnd = -1;
+    int newEnd = -1;
+};
+
+// Concrete syntax tree of a document, kept up to date as it is edited.
+// Each change only reparses the statements it touched, on a worker thread,
+// against a snapshot of the lines. Outline, folding, indentation and bracket
+// matching all read from here instead of scanning the text themselves.
+class SyntaxTree : public QObject {
+    Q_OBJECT
+
+public:
+    explicit SyntaxTree(QTextDocument *document, QObject *parent = nullptr);
+    ~SyntaxTree();
+
+    // Disabled trees drop everything and ignore edits (large or non-Python files)
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled; }
+
+    SyntaxNodePtr root() const { return tree; }
+
+    // True when the tree describes the current text, not an older snapshot
+    bool isUpToDate() const;
+
+    // A node together with its absolute first line
+    struct NodeRef {
+        SyntaxNodePtr node;
+        int line = -1;
+        bool isValid() const { return bool(node); }
+    };
+
+    // Innermost node whose lines contain `line`, the module if none does
+    NodeRef nodeAt(int line) const;
+    // Every node from the outermost statement down to nodeAt(line)
+    QVector<NodeRef> pathAt(int line) const;
+
+    // Bracket at (line, column) and where its partner is. Like foldEndAt(),
+    // works off the last tree while a parse is behind.
+    bool matchBracket(int line, int column, int *matchLine, int *matchColumn) const;
+    // Innermost bracket still open at (line, column)
+    bool enclosingBracket(int line, int column, int *openLine, int *openColumn) const;
+    // Indentation for a line break at (line, column), -1 if the tree can't tell
+    int indentForNewLine(int line, int column) const;
+    // Last line of the fold starting at `line`: a compound statement or a
+    // bracket spanning lines, blank lines at the end left out. -1 if none.
+    // While a parse is behind it comes from the last tree, -1 on the lines
+    // edited since.
+    int foldEndAt(int line) const;
+
+    // Builds a tree for `lines`, reusing the nodes of `old` outside `edit`
+    static SyntaxNodePtr parse(const QVector<QString> &lines, const SyntaxNodePtr &old, const TreeEdit &edit);
+
+signals:
+    void treeUpdated();
+
+private slots:
+    void onContentsChange(int position, int removed, int added);
+    void onParseFinished();
+
+private:
+    void resync();
+    void addEdit(int start, int oldEnd, int newEnd);
+    void startParse();
+    void releaseWatcher();
+    // nodeAt() without the copies: where the node is held, and its first line
+    const SyntaxNodePtr *innermostAt(int line, int *start) const;
+    // Current line to the tree's and back, -1 for a line the edits touched
+    int toTreeLine(int line) const;
+    int fromTreeLine(int line) const;
+
+    QTextDocument *doc;
+    bool enabled = true;
+
+    // Line texts as of the last contentsChange, the snapshot source
+    QVector<QString> lines;
+
+    // Edits since the snapshot the current tree (or running parse) was made from
+    TreeEdit pending;
+    bool dirty = false;
+    // Edits since the text `tree` describes, running parse or not
+    TreeEdit sinceTree;
+    bool treeBehind = false;
+
+    SyntaxNodePtr tree;
+    QFutureWatcher<SyntaxNodePtr> *watcher = nullptr;
+};
+
+#endif // SYNTAXTREE_H
@@ -0,0 +1,61 @@
+#include "tokencache.h"
+
+namespace {
+
+// Default cap, a few hundred thousand typical lines
+constexpr qsizetype defaultMaxBytes = 32 * 1024 * 1024;
+
+qsizetype entryCost(const QString &text, const QVector<Token> &tokens, const LexState &outState)
+{
+    return qsizetype(sizeof(TokenCache::Entry)) + 64 + text.size() * qsizetype(sizeof(QChar))
+        + tokens.size() * qsizetype(sizeof(Token)) + outState.frames.size();
+}
+
+} // namespace
+
+TokenCache::TokenCache()
+    : cache(defaultMaxBytes)
+{
+}
+
+TokenCache &TokenCache::instance()
+{
+    static TokenCache shared;
+    return shared;
+}
+
+const TokenCache::Entry *TokenCache::find(size_t lineHash, const QString &text, int inState)
+{
+    const Entry *entry = cache.object(Key{lineHash, int(text.size()), inState});
+    if (entry && entry->text != text) {
+        // Another line with the same hash
+        entry = nullptr;
+    }
+    if (entry) {
+        ++hitCount;
+    } else {
+        ++missCount;
+    }
+    return entry;
+}
+
+void TokenCache::insert(size_t lineHash, const QString &text, int inState,
+                        const QVector<Token> &tokens, const LexState &outState)
+{
+    // QString, QVector and QByteArray are implicitly shared, the copy is cheap
+    cache.insert(Key{lineHash, int(text.size()), inState}, new Entry{text, tokens, outState},
+                 entryCost(text, tokens, outState));
+}
+
+double TokenCache::hitRate() const
+{
+    const quint64 total = hitCount + missCount;
+    return total ? double(hitCount) / double(total) : 0.0;
+}
+
+void TokenCache::clear()
+{
+    cache.clear();
+    hitCount = 0;
+    missCount = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef TOKENCACHE_H
+#define TOKENCACHE_H
+
+#include <QCache>
+#include "lexer.h"
+
+// Token spans of already seen lines, keyed by (line hash, length, incoming state).
+// Shared by every Parser in the process, so undo/redo, reloads and pastes of
+// known lines skip the lexer. Least recently used lines go first once the
+// memory cap is reached. Entries keep a copy of their line, counted against
+// the cap, so a hash collision is a miss rather than wrong colours.
+class TokenCache
+{
+public:
+    struct Entry {
+        QString text;
+        QVector<Token> tokens;
+        LexState outState;
+    };
+
+    static TokenCache &instance();
+
+    // lineHash is qHash(text)
+    const Entry *find(size_t lineHash, const QString &text, int inState);
+    void insert(size_t lineHash, const QString &text, int inState,
+                const QVector<Token> &tokens, const LexState &outState);
+
+    void setMaxBytes(qsizetype bytes) { cache.setMaxCost(bytes); }
+    qsizetype maxBytes() const { return cache.maxCost(); }
+    qsizetype usedBytes() const { return cache.totalCost(); }
+
+    quint64 hits() const { return hitCount; }
+    quint64 misses() const { return missCount; }
+    double hitRate() const;
+    void clear();
+
+private:
+    TokenCache();
+
+    struct Key {
+        size_t hash;
+        int length;
+        int state;
+
+        bool operator==(const Key &other) const {
+            return hash == other.hash && length == other.length && state == other.state;
+        }
+    };
+    friend size_t qHash(const Key &key, size_t seed) {
+        return qHashMulti(seed, key.hash, key.length, key.state);
+    }
+
+    QCache<Key, Entry> cache;
+    quint64 hitCount = 0;
+    quint64 missCount = 0;
+};
+
+#endif // TOKENCACHE_H
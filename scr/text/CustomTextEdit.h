@@ -5,11 +5,24 @@
 #include <QWidget>
 #include <QCompleter>
 #include <QPainter>
+#include <QStaticText>
 #include <QTextBlock>
 #include <QScrollBar>
 #include <QAbstractItemView>
 #include <QKeyEvent>
+#include <QMouseEvent>
 #include <QHash>
+#include <QVarLengthArray>
+#include <QCoreApplication>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include "../parser/keywords.h"
+#include "../parser/syntaxtree.h"
+#include "identifierindex.h"
+#include "modificationtracker.h"
+#include "minimap.h"
+#include "completionmodel.h"
 
 //------------------>  maybe here bug!!!!!!!!!!!!!!!!!!!!! <--------------
 
@@ -25,6 +38,7 @@ public:
 
 protected:
     void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
 
 private:
     CustomTextEdit *textEdit;
@@ -42,9 +56,14 @@ public:
     void setCompleter(QCompleter *completer);
     QCompleter *completer() const { return m_completer; }
     
+    // Extra completion words besides the keywords, e.g. workspace symbols
+    using CompletionSource = CompletionModel::Source;
+    void setCompletionSource(CompletionSource source);
+    
     // Line numbering methods
     int lineNumberAreaWidth() const;
     void lineNumberAreaPaintEvent(QPaintEvent *event);
+    void lineNumberAreaMousePressEvent(QMouseEvent *event);
     void updateLineNumberAreaWidth(int newBlockCount);
     void updateLineNumberArea(const QRect &rect, int dy);
     void resizeEvent(QResizeEvent *event) override;
@@ -68,32 +87,90 @@ public:
     void setFilePath(const QString &path) { m_filePath = path; }
     QString filePath() const { return m_filePath; }
     
-    // Modification tracking
-    bool isModified() const { return m_isModified; }
-    void setModified(bool modified) { m_isModified = modified; }
+    // Modification tracking, setModified(false) marks the text as saved
+    bool isModified() const { return m_modificationTracker->isModified(); }
+    void setModified(bool modified);
+    ModificationTracker *modificationTracker() const { return m_modificationTracker; }
+    
+    // Large files track changes through the undo stack alone
+    void setLargeFileMode(bool enabled);
+    bool isLargeFileMode() const { return m_largeFileMode; }
+    
+    // Python structure of the buffer, shared by indentation, brackets and friends
+    SyntaxTree *syntaxTree() const { return m_syntaxTree; }
+    
+    // Identifiers of the buffer with their counts, the first completion source
+    IdentifierIndex *identifierIndex() const { return m_identifierIndex; }
+    
+    // Folding. Ranges come from the syntax tree, a folded range is just its
+    // blocks hidden with zero lines, so layout and painting never see them.
+    bool fold(int line);
+    void unfold(int line);
+    bool isFolded(int line) const;
+    void toggleFold(int line);
+    void unfoldAll();
+    // Outermost folded lines, and folding them again (sessions). Restored
+    // folds wait for the syntax tree if it is still catching up.
+    QList<int> foldedLines() const;
+    void restoreFolds(const QList<int> &lines);
+    
+    // Multiple cursors. textCursor() is the main one, the extra ones get every
+    // edit too, all in one edit block: one document change, one undo step.
+    // Alt+Click adds a cursor, Ctrl+D the next occurrence, Alt+Shift+drag a
+    // column, Escape goes back to one.
+    QList<QTextCursor> extraCursors() const { return m_extraCursors; }
+    void addCursor(const QTextCursor &cursor);
+    void clearExtraCursors();
+    bool selectNextOccurrence();
+    
+    // Minimap at the right edge, on by default
+    void setMinimapVisible(bool visible);
+    bool isMinimapVisible() const { return m_minimap->isVisibleTo(this); }
 
 signals:
     void fileModified(bool modified);
 
 protected:
     void keyPressEvent(QKeyEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
     void focusInEvent(QFocusEvent *event) override;
     bool event(QEvent *event) override;
 
 private slots:
     void insertCompletion(const QString &completion);
-    void onTextChanged();
     void highlightCurrentLine();
+    void revealCursor();
 
 private:
-    // Auto-completion helpers
-    void handleAutoQuote(QChar quoteChar);
+    void addBracketMatch(QList<QTextEdit::ExtraSelection> &selections);
+    // Folding helpers
+    QTextBlock nextVisibleBlock(const QTextBlock &block) const;
+    int enclosingFoldStart(int line) const;
+    int foldMarkerWidth() const;
+    // Digit glyphs and sizes for the gutter, redone when its font changes
+    void updateGutterMetrics();
+    void updateMinimapGeometry();
+    void foldingChanged();
+    void applyPendingFolds();
+    // Multi-cursor helpers
+    void editAtCursors(const std::function<void(QTextCursor &)> &edit);
+    bool handleMultiCursorKey(QKeyEvent *event);
+    void mergeCursors();
+    void cursorsChanged();
+    int columnAt(const QPoint &pos) const;
+    void selectColumns(int line, int column);
+    // Auto-completion helpers, the ones taking a cursor work for any of them
+    void handleAutoQuote(QTextCursor &cursor, QChar quoteChar);
     void handleAutoBracket(QChar openingBracket);
     QString textUnderCursor() const;
-    void handleBackspace();
+    void handleBackspace(QTextCursor &cursor);
     void handleEnter();
+    int newLineIndent(const QTextCursor &cursor) const;
     void handleTabKey(bool shiftModifier);
-    void handleAutoClose(QChar opening, QChar closing);
+    void handleAutoClose(QTextCursor &cursor, QChar opening, QChar closing);
     
     // Completer management
     void showCompleter();
@@ -107,6 +184,7 @@ private:
     
     // Configuration
     static QStringList createPythonKeywords();
+    static const FuzzyCandidates &keywordCandidates();
     bool shouldSkipAutoComplete(QChar ch) const;
     bool isInsideQuotesOrComment(const QTextCursor &cursor) const;
     
@@ -129,20 +207,37 @@ private:
     
     // Member variables
     QCompleter *m_completer = nullptr;
+    CompletionSource m_completionSource;
+    CompletionModel *m_completionModel = nullptr;  // refilled for every prefix
     LineNumberArea *m_lineNumberArea = nullptr;
+    Minimap *m_minimap = nullptr;
+    SyntaxTree *m_syntaxTree = nullptr;
+    IdentifierIndex *m_identifierIndex = nullptr;
+    ModificationTracker *m_modificationTracker = nullptr;
     
     // Style properties for line numbers
     QColor m_lineNumberBgColor = QColor(240, 240, 240);
     QColor m_lineNumberTextColor = Qt::black;
     QColor m_currentLineColor = QColor(200, 200, 255);
     QFont m_lineNumberAreaFont;
+    QStaticText m_digitText[10];  // shaped once, painting a number is just placing them
+    int m_digitWidth = 0;         // widest digit, every digit gets this cell
+    int m_gutterLineHeight = 0;
+    int m_gutterWidth = -1;       // what the viewport margin was last set to
     Qt::Alignment m_lineNumberAlign = Qt::AlignRight;
     int m_lineNumberMarginPx = 5;
+    QColor m_bracketMatchColor = QColor(70, 90, 70);
+    
+    // Cursors besides textCursor(), QTextCursor keeps them in place on edits
+    QList<QTextCursor> m_extraCursors;
+    int m_columnAnchorLine = -1;  // Alt+Shift drag going on
+    int m_columnAnchorColumn = 0;
+    
+    QList<int> m_pendingFolds;  // restoreFolds() before the tree was ready
     
     // File management
     QString m_filePath;
-    QString m_originalContent;
-    bool m_isModified = false;
+    bool m_largeFileMode = false;
 };
 
 // Inline implementations
@@ -162,6 +257,11 @@ inline void LineNumberArea::paintEvent(QPaintEvent *event)
     textEdit->lineNumberAreaPaintEvent(event);
 }
 
+inline void LineNumberArea::mousePressEvent(QMouseEvent *event) 
+{
+    textEdit->lineNumberAreaMousePressEvent(event);
+}
+
 inline CustomTextEdit::CustomTextEdit(QWidget *parent) 
     : QPlainTextEdit(parent)
 {
@@ -178,9 +278,17 @@ inline CustomTextEdit::CustomTextEdit(QWidget *parent)
     setCenterOnScroll(false);
     setLineWrapMode(QPlainTextEdit::NoWrap);
     
+    // Before anything else watches the document, see SyntaxTree
+    m_syntaxTree = new SyntaxTree(document(), this);
+    m_identifierIndex = new IdentifierIndex(document(), this);
+    m_modificationTracker = new ModificationTracker(document(), this);
+    
     // Create completer
     createCompleter();
     
+    // Right margin for the minimap is set with the gutter's
+    m_minimap = new Minimap(this);
+    
     // Setup line number area
     setupLineNumberArea();
     
@@ -192,11 +300,13 @@ inline CustomTextEdit::~CustomTextEdit()
 {
     delete m_completer;
     delete m_lineNumberArea;
+    delete m_minimap;
 }
 
 inline void CustomTextEdit::setupLineNumberArea()
 {
     m_lineNumberArea = new LineNumberArea(this);
+    updateGutterMetrics();
     
     connect(this, &QPlainTextEdit::blockCountChanged, 
             this, &CustomTextEdit::updateLineNumberAreaWidth);
@@ -211,48 +321,70 @@ inline void CustomTextEdit::setupLineNumberArea()
 
 inline void CustomTextEdit::setupConnections()
 {
-    connect(this->document(), &QTextDocument::contentsChanged,
-            this, &CustomTextEdit::onTextChanged);
+    connect(m_modificationTracker, &ModificationTracker::modificationChanged,
+            this, &CustomTextEdit::fileModified);
+    
+    // Bracket match and fold markers redone for the new tree; in between
+    // they come from the last one, on the lines typing didn't touch
+    connect(m_syntaxTree, &SyntaxTree::treeUpdated,
+            this, &CustomTextEdit::highlightCurrentLine);
+    connect(m_syntaxTree, &SyntaxTree::treeUpdated,
+            m_lineNumberArea, QOverload<>::of(&QWidget::update));
+    connect(m_syntaxTree, &SyntaxTree::treeUpdated,
+            this, &CustomTextEdit::applyPendingFolds);
+    
+    connect(this, &QPlainTextEdit::cursorPositionChanged,
+            this, &CustomTextEdit::revealCursor);
 }
 
 inline void CustomTextEdit::createCompleter()
 {
-    QStringList keywords = createPythonKeywords();
-    QCompleter *completer = new QCompleter(keywords, this);
+    // Buffer words, then whatever setCompletionSource brings, then keywords.
+    // The model is already ranked and cut, the completer must not filter it.
+    m_completionModel = new CompletionModel(this);
+    m_completionModel->addSource([this](const FuzzyMatcher &matcher, FuzzyTopK &top) {
+        m_identifierIndex->collect(matcher, top);
+    });
+    m_completionModel->addSource([this](const FuzzyMatcher &matcher, FuzzyTopK &top) {
+        if (m_completionSource) {
+            m_completionSource(matcher, top);
+        }
+    });
+    m_completionModel->addSource([](const FuzzyMatcher &matcher, FuzzyTopK &top) {
+        matcher.collect(keywordCandidates(), top);
+    });
+
+    QCompleter *completer = new QCompleter(m_completionModel, this);
     setCompleter(completer);
+    completer->setCompletionMode(QCompleter::UnfilteredPopupCompletion);
+}
+
+inline void CustomTextEdit::setCompletionSource(CompletionSource source)
+{
+    m_completionSource = std::move(source);
+}
+
+inline const FuzzyCandidates &CustomTextEdit::keywordCandidates()
+{
+    static const FuzzyCandidates candidates = [] {
+        FuzzyCandidates keywords;
+        for (const QString &keyword : createPythonKeywords()) {
+            keywords.append(keyword);
+        }
+        return keywords;
+    }();
+    return candidates;
 }
 
 inline QStringList CustomTextEdit::createPythonKeywords()
 {
-    return {
-        // Keywords
-        "False", "None", "True", "and", "as", "assert", "async", 
-        "await", "break", "class", "continue", "def", "del", "elif", 
-        "else", "except", "finally", "for", "from", "global", "if", 
-        "import", "in", "is", "lambda", "nonlocal", "not", "or", 
-        "pass", "raise", "return", "try", "while", "with", "yield",
-        
-        // Special identifiers
-        "self", "cls", "__init__", "__name__", "__main__",
-        
-        // Built-in functions
-        "abs", "all", "any", "ascii", "bin", "bool", "breakpoint",
-        "bytearray", "bytes", "callable", "chr", "classmethod",
-        "compile", "complex", "delattr", "dict", "dir", "divmod",
-        "enumerate", "eval", "exec", "filter", "float", "format",
-        "frozenset", "getattr", "globals", "hasattr", "hash",
-        "help", "hex", "id", "input", "int", "isinstance",
-        "issubclass", "iter", "len", "list", "locals", "map",
-        "max", "memoryview", "min", "next", "object", "oct",
-        "open", "ord", "pow", "print", "property", "range",
-        "repr", "reversed", "round", "set", "setattr", "slice",
-        "sorted", "staticmethod", "str", "sum", "super", "tuple",
-        "type", "vars", "zip",
-        
-        // Common modules
-        "os", "sys", "json", "re", "datetime", "math", "random",
-        "collections", "itertools", "functools", "typing"
-    };
+    // Same table the highlighter classifies identifiers with
+    QStringList keywords;
+    keywords.reserve(Keywords::count);
+    for (const Keywords::Entry &entry : Keywords::entries) {
+        keywords << QString::fromLatin1(entry.word);
+    }
+    return keywords;
 }
 
 // Style methods implementation
@@ -282,6 +414,7 @@ inline void CustomTextEdit::setLineNumberFont(const QFont &font)
 {
     m_lineNumberAreaFont = font;
     if (m_lineNumberArea) {
+        updateGutterMetrics();
         m_lineNumberArea->update();
         updateLineNumberAreaWidth(0);
     }
@@ -300,6 +433,7 @@ inline void CustomTextEdit::setLineNumberMargin(int margin)
     m_lineNumberMarginPx = margin;
     if (m_lineNumberArea) {
         m_lineNumberArea->update();
+        updateLineNumberAreaWidth(0);
     }
 }
 
@@ -312,9 +446,22 @@ inline int CustomTextEdit::lineNumberAreaWidth() const
         ++digits;
     }
     
-    QFontMetrics fm(m_lineNumberAreaFont);
-    int space = m_lineNumberMarginPx * 2 + fm.horizontalAdvance(QLatin1Char('9')) * digits;
-    return space;
+    int space = m_lineNumberMarginPx * 2 + m_digitWidth * digits;
+    return space + foldMarkerWidth();
+}
+
+inline void CustomTextEdit::updateGutterMetrics()
+{
+    const QFontMetrics fm(m_lineNumberAreaFont);
+    m_gutterLineHeight = fm.height();
+    m_digitWidth = 0;
+    for (int d = 0; d < 10; ++d) {
+        const QChar digit(QLatin1Char(char('0' + d)));
+        m_digitText[d].setText(QString(digit));
+        m_digitText[d].setTextFormat(Qt::PlainText);
+        m_digitText[d].prepare(QTransform(), m_lineNumberAreaFont);
+        m_digitWidth = qMax(m_digitWidth, fm.horizontalAdvance(digit));
+    }
 }
 
 inline void CustomTextEdit::lineNumberAreaPaintEvent(QPaintEvent *event) 
@@ -323,40 +470,289 @@ inline void CustomTextEdit::lineNumberAreaPaintEvent(QPaintEvent *event)
     painter.fillRect(event->rect(), m_lineNumberBgColor);
     
     QTextBlock block = firstVisibleBlock();
-    int blockNumber = block.blockNumber();
     int top = qRound(blockBoundingGeometry(block).translated(contentOffset()).top());
     int bottom = top + qRound(blockBoundingRect(block).height());
     
+    // Everything per line below is cached: no metrics, strings or shaping
     painter.setFont(m_lineNumberAreaFont);
-    QFontMetrics fm(m_lineNumberAreaFont);
-    int lineHeight = fm.height();
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setBrush(m_lineNumberTextColor);
+    const int lineHeight = m_gutterLineHeight;
+    
+    // Fold markers sit between the numbers and the text
+    const int markerLeft = m_lineNumberArea->width() - foldMarkerWidth();
+    const int numberRight = markerLeft - m_lineNumberMarginPx;
+    const qreal markerSize = lineHeight / 4.0;
+    const int cursorBlock = textCursor().blockNumber();
+    // Numbers first with one pen, the markers after in a pass of their own
+    const QPen numberPen(m_lineNumberTextColor);
+    painter.setPen(numberPen);
+    QVarLengthArray<std::pair<int, bool>, 128> markers;
     
     while (block.isValid() && top <= event->rect().bottom()) {
+        // Jumps over folded ranges instead of walking their blocks
+        const QTextBlock next = nextVisibleBlock(block);
+        
         if (block.isVisible() && bottom >= event->rect().top()) {
-            QString number = QString::number(blockNumber + 1);
+            const int blockNumber = block.blockNumber();
             
             // Highlight current line
-            if (textCursor().blockNumber() == blockNumber) {
+            if (cursorBlock == blockNumber) {
                 painter.fillRect(0, top, m_lineNumberArea->width(), lineHeight, m_currentLineColor);
             }
             
-            // Draw line number
-            painter.setPen(m_lineNumberTextColor);
-            QRect numberRect(0, top, m_lineNumberArea->width() - m_lineNumberMarginPx, lineHeight);
-            painter.drawText(numberRect, m_lineNumberAlign | Qt::AlignVCenter, number);
+            // Draw line number, digits from the right
+            char digits[12];
+            int digitCount = 0;
+            for (int n = blockNumber + 1; n > 0; n /= 10) {
+                digits[digitCount++] = char(n % 10);
+            }
+            int x = numberRight - digitCount * m_digitWidth;
+            if (m_lineNumberAlign & Qt::AlignLeft) {
+                x = m_lineNumberMarginPx;
+            } else if (m_lineNumberAlign & Qt::AlignHCenter) {
+                x = (numberRight - digitCount * m_digitWidth) / 2;
+            }
+            for (int i = digitCount - 1; i >= 0; --i, x += m_digitWidth) {
+                painter.drawStaticText(x, top, m_digitText[int(digits[i])]);
+            }
+            
+            const bool folded = block.next().isValid() && !block.next().isVisible();
+            if (folded || m_syntaxTree->foldEndAt(blockNumber) >= 0) {
+                markers.append({top, folded});
+            }
         }
         
-        block = block.next();
+        block = next;
         top = bottom;
         bottom = top + qRound(blockBoundingRect(block).height());
-        ++blockNumber;
+    }
+    
+    // Right-pointing when folded, down when it could be
+    painter.setPen(Qt::NoPen);
+    const qreal centerX = markerLeft + foldMarkerWidth() / 2.0;
+    for (const auto &[markerTop, folded] : markers) {
+        const QPointF center(centerX, markerTop + lineHeight / 2.0);
+        QPointF marker[3];
+        if (folded) {
+            marker[0] = center + QPointF(-markerSize / 2, -markerSize);
+            marker[1] = center + QPointF(markerSize, 0);
+            marker[2] = center + QPointF(-markerSize / 2, markerSize);
+        } else {
+            marker[0] = center + QPointF(-markerSize, -markerSize / 2);
+            marker[1] = center + QPointF(markerSize, -markerSize / 2);
+            marker[2] = center + QPointF(0, markerSize);
+        }
+        painter.drawConvexPolygon(marker, 3);
+    }
+}
+
+inline void CustomTextEdit::lineNumberAreaMousePressEvent(QMouseEvent *event) 
+{
+    if (event->button() != Qt::LeftButton
+        || event->position().x() < m_lineNumberArea->width() - foldMarkerWidth()) {
+        return;
+    }
+    
+    // The gutter shares the viewport's y axis
+    const QTextBlock block = cursorForPosition(QPoint(0, qRound(event->position().y()))).block();
+    if (block.isValid()) {
+        toggleFold(block.blockNumber());
+    }
+}
+
+inline int CustomTextEdit::foldMarkerWidth() const
+{
+    return m_gutterLineHeight;
+}
+
+inline QTextBlock CustomTextEdit::nextVisibleBlock(const QTextBlock &block) const
+{
+    QTextBlock next = block.next();
+    if (next.isValid() && !next.isVisible()) {
+        // Hidden blocks have no lines, so the next line belongs to the next visible block
+        next = document()->findBlockByLineNumber(block.firstLineNumber() + qMax(1, block.lineCount()));
+        if (next.blockNumber() <= block.blockNumber()) {
+            return QTextBlock();
+        }
+    }
+    return next;
+}
+
+inline bool CustomTextEdit::isFolded(int line) const
+{
+    const QTextBlock block = document()->findBlockByNumber(line);
+    return block.isVisible() && block.next().isValid() && !block.next().isVisible();
+}
+
+inline bool CustomTextEdit::fold(int line)
+{
+    if (!m_syntaxTree->isUpToDate() || isFolded(line)) {
+        return false;
+    }
+    const int end = m_syntaxTree->foldEndAt(line);
+    if (end < 0) {
+        return false;
+    }
+    
+    const QTextBlock start = document()->findBlockByNumber(line);
+    QTextBlock block = start.next();
+    for (int i = line + 1; block.isValid() && i <= end; ++i, block = block.next()) {
+        block.setVisible(false);
+        block.setLineCount(0);
+    }
+    
+    // A cursor inside would be stranded, park it on the fold line
+    const int cursorLine = textCursor().blockNumber();
+    if (cursorLine > line && cursorLine <= end) {
+        QTextCursor cursor(start);
+        cursor.movePosition(QTextCursor::EndOfBlock);
+        setTextCursor(cursor);
+    }
+    
+    foldingChanged();
+    return true;
+}
+
+inline void CustomTextEdit::unfold(int line)
+{
+    if (!isFolded(line)) {
+        return;
+    }
+    
+    // Everything hidden right after the line, nested folds open with it
+    QTextBlock block = document()->findBlockByNumber(line).next();
+    for (; block.isValid() && !block.isVisible(); block = block.next()) {
+        block.setVisible(true);
+        block.setLineCount(qMax(1, block.layout()->lineCount()));
+    }
+    foldingChanged();
+}
+
+inline void CustomTextEdit::toggleFold(int line)
+{
+    if (isFolded(line)) {
+        unfold(line);
+    } else {
+        fold(line);
+    }
+}
+
+inline void CustomTextEdit::unfoldAll()
+{
+    bool changed = false;
+    for (QTextBlock block = document()->begin(); block.isValid(); block = block.next()) {
+        if (!block.isVisible()) {
+            block.setVisible(true);
+            block.setLineCount(qMax(1, block.layout()->lineCount()));
+            changed = true;
+        }
+    }
+    if (changed) {
+        foldingChanged();
+    }
+}
+
+inline QList<int> CustomTextEdit::foldedLines() const
+{
+    QList<int> lines;
+    for (QTextBlock block = document()->begin(); block.isValid(); block = nextVisibleBlock(block)) {
+        if (block.next().isValid() && !block.next().isVisible()) {
+            lines.append(block.blockNumber());
+        }
+    }
+    return lines;
+}
+
+inline void CustomTextEdit::restoreFolds(const QList<int> &lines)
+{
+    m_pendingFolds = lines;
+    applyPendingFolds();
+}
+
+inline void CustomTextEdit::applyPendingFolds()
+{
+    if (m_pendingFolds.isEmpty() || !m_syntaxTree->isUpToDate()) {
+        return;
+    }
+    const QList<int> lines = std::exchange(m_pendingFolds, QList<int>());
+    for (int line : lines) {
+        fold(line);
+    }
+}
+
+inline int CustomTextEdit::enclosingFoldStart(int line) const
+{
+    if (!m_syntaxTree->isUpToDate()) {
+        return -1;
+    }
+    if (!isFolded(line) && m_syntaxTree->foldEndAt(line) >= 0) {
+        return line;
+    }
+    
+    const QVector<SyntaxTree::NodeRef> path = m_syntaxTree->pathAt(line);
+    for (int i = int(path.size()) - 1; i >= 0; --i) {
+        const int start = path.at(i).line;
+        if (start != line && m_syntaxTree->foldEndAt(start) >= line) {
+            return start;
+        }
+    }
+    return -1;
+}
+
+inline void CustomTextEdit::foldingChanged()
+{
+    // Visibility changes aren't content changes: no contentsChange, no
+    // rehighlight, just new line counts for the layout and the scrollbar
+    auto *layout = qobject_cast<QPlainTextDocumentLayout *>(document()->documentLayout());
+    if (layout) {
+        layout->requestUpdate();
+        emit layout->documentSizeChanged(layout->documentSize());
+    }
+    viewport()->update();
+    m_lineNumberArea->update();
+}
+
+inline void CustomTextEdit::revealCursor()
+{
+    // Undo, search or go-to-line can land inside a fold: open it
+    QTextBlock block = textCursor().block();
+    while (block.isValid() && !block.isVisible()) {
+        const int start = document()->findBlockByLineNumber(qMax(0, block.firstLineNumber() - 1)).blockNumber();
+        if (!isFolded(start)) {
+            break;
+        }
+        unfold(start);
     }
 }
 
 inline void CustomTextEdit::updateLineNumberAreaWidth(int newBlockCount) 
 {
     Q_UNUSED(newBlockCount);
-    setViewportMargins(lineNumberAreaWidth(), 0, 0, 0);
+    // Comes with every full-viewport update, only relayout on a real change
+    const int width = lineNumberAreaWidth();
+    if (width == m_gutterWidth) {
+        return;
+    }
+    m_gutterWidth = width;
+    setViewportMargins(width, 0, m_minimap->isVisibleTo(this) ? Minimap::defaultWidth : 0, 0);
+    const QRect cr = contentsRect();
+    m_lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), width, cr.height()));
+    updateMinimapGeometry();
+}
+
+inline void CustomTextEdit::updateMinimapGeometry()
+{
+    // Between the text and the scroll bar
+    const QRect vr = viewport()->geometry();
+    m_minimap->setGeometry(vr.right() + 1, vr.top(), Minimap::defaultWidth, vr.height());
+}
+
+inline void CustomTextEdit::setMinimapVisible(bool visible)
+{
+    m_minimap->setVisible(visible);
+    m_gutterWidth = -1;
+    updateLineNumberAreaWidth(0);
 }
 
 inline void CustomTextEdit::updateLineNumberArea(const QRect &rect, int dy) 
@@ -379,6 +775,7 @@ inline void CustomTextEdit::resizeEvent(QResizeEvent *event)
     QRect cr = contentsRect();
     m_lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), 
                                         lineNumberAreaWidth(), cr.height()));
+    updateMinimapGeometry();
 }
 
 inline void CustomTextEdit::highlightCurrentLine() 
@@ -394,9 +791,55 @@ inline void CustomTextEdit::highlightCurrentLine()
         extraSelections.append(selection);
     }
     
+    // Selections of the extra cursors, their carets are drawn in paintEvent
+    for (const QTextCursor &cursor : std::as_const(m_extraCursors)) {
+        if (cursor.hasSelection()) {
+            QTextEdit::ExtraSelection selection;
+            selection.format.setBackground(palette().highlight());
+            selection.format.setForeground(palette().highlightedText());
+            selection.cursor = cursor;
+            extraSelections.append(selection);
+        }
+    }
+    
+    addBracketMatch(extraSelections);
     setExtraSelections(extraSelections);
 }
 
+inline void CustomTextEdit::addBracketMatch(QList<QTextEdit::ExtraSelection> &selections)
+{
+    // Bracket right after the cursor first, then the one before it
+    const QTextCursor cursor = textCursor();
+    const QString text = cursor.block().text();
+    const int line = cursor.blockNumber();
+    const int column = cursor.positionInBlock();
+    
+    for (int candidate : {column, column - 1}) {
+        if (candidate < 0 || candidate >= text.length() || !QStringLiteral("()[]{}").contains(text.at(candidate))) {
+            continue;
+        }
+        int matchLine;
+        int matchColumn;
+        if (!m_syntaxTree->matchBracket(line, candidate, &matchLine, &matchColumn)) {
+            continue;
+        }
+        
+        const int positions[] = {
+            cursor.block().position() + candidate,
+            document()->findBlockByNumber(matchLine).position() + matchColumn
+        };
+        for (int position : positions) {
+            QTextEdit::ExtraSelection selection;
+            selection.format.setBackground(m_bracketMatchColor);
+            selection.cursor = QTextCursor(document());
+            selection.cursor.setPosition(position);
+            selection.cursor.setPosition(position + 1, QTextCursor::KeepAnchor);
+            selections.append(selection);
+        }
+        return;
+    }
+}
+
 inline void CustomTextEdit::setCompleter(QCompleter *completer) 
 {
     if (m_completer) {
@@ -446,6 +889,10 @@ inline void CustomTextEdit::insertCompletion(const QString &completion)
     tc.movePosition(QTextCursor::Left, QTextCursor::KeepAnchor, prefixLength);
     tc.insertText(completion);
     setTextCursor(tc);
+    
+    if (m_completer->model() == m_completionModel) {
+        m_completionModel->accepted(completion);
+    }
 }
 
 inline QString CustomTextEdit::textUnderCursor() const 
@@ -482,6 +929,9 @@ inline void CustomTextEdit::updateCompleter()
     
     QString completionPrefix = textUnderCursor();
     if (completionPrefix != m_completer->completionPrefix()) {
+        if (m_completer->model() == m_completionModel) {
+            m_completionModel->update(completionPrefix);
+        }
         m_completer->setCompletionPrefix(completionPrefix);
         if (m_completer->popup()) {
             m_completer->popup()->setCurrentIndex(
@@ -513,11 +963,52 @@ inline void CustomTextEdit::keyPressEvent(QKeyEvent *event)
         }
     }
     
+    // Ctrl+Shift+[ folds the block around the cursor, Ctrl+Shift+] opens it
+    const Qt::KeyboardModifiers foldModifiers = Qt::ControlModifier | Qt::ShiftModifier;
+    if ((event->modifiers() & foldModifiers) == foldModifiers) {
+        const int line = textCursor().blockNumber();
+        switch (event->key()) {
+        case Qt::Key_BracketLeft:
+        case Qt::Key_BraceLeft: {
+            const int start = enclosingFoldStart(line);
+            if (start >= 0) {
+                fold(start);
+            }
+            event->accept();
+            return;
+        }
+        case Qt::Key_BracketRight:
+        case Qt::Key_BraceRight:
+            unfold(line);
+            event->accept();
+            return;
+        default:
+            break;
+        }
+    }
+    
+    if (event->key() == Qt::Key_D && event->modifiers() == Qt::ControlModifier) {
+        hideCompleter();
+        selectNextOccurrence();
+        event->accept();
+        return;
+    }
+    
+    if (!m_extraCursors.isEmpty()) {
+        hideCompleter();
+        if (handleMultiCursorKey(event)) {
+            event->accept();
+            return;
+        }
+        // Anything else is for the main cursor alone
+        clearExtraCursors();
+    }
+    
     // Handle special keys
     switch (event->key()) {
     case Qt::Key_Backspace:
         hideCompleter();
-        handleBackspace();
+        editAtCursors([this](QTextCursor &cursor) { handleBackspace(cursor); });
         event->accept();
         return;
         
@@ -533,27 +1024,27 @@ inline void CustomTextEdit::keyPressEvent(QKeyEvent *event)
         return;
         
     case Qt::Key_ParenLeft:
-        handleAutoClose('(', ')');
+        handleAutoBracket('(');
         event->accept();
         return;
         
     case Qt::Key_BracketLeft:
-        handleAutoClose('[', ']');
+        handleAutoBracket('[');
         event->accept();
         return;
         
     case Qt::Key_BraceLeft:
-        handleAutoClose('{', '}');
+        handleAutoBracket('{');
         event->accept();
         return;
         
     case Qt::Key_QuoteDbl:
-        handleAutoQuote('"');
+        editAtCursors([this](QTextCursor &cursor) { handleAutoQuote(cursor, '"'); });
         event->accept();
         return;
         
     case Qt::Key_Apostrophe:
-        handleAutoQuote('\'');
+        editAtCursors([this](QTextCursor &cursor) { handleAutoQuote(cursor, '\''); });
         event->accept();
         return;
         
@@ -599,6 +1090,314 @@ inline void CustomTextEdit::keyPressEvent(QKeyEvent *event)
     QPlainTextEdit::keyPressEvent(event);
 }
 
+inline bool CustomTextEdit::handleMultiCursorKey(QKeyEvent *event)
+{
+    const Qt::KeyboardModifiers modifiers = event->modifiers();
+    const QTextCursor::MoveMode mode = (modifiers & Qt::ShiftModifier) ? QTextCursor::KeepAnchor
+                                                                        : QTextCursor::MoveAnchor;
+    const bool byWord = modifiers & Qt::ControlModifier;
+    QTextCursor::MoveOperation move = QTextCursor::NoMove;
+    
+    switch (event->key()) {
+    case Qt::Key_Escape:
+        clearExtraCursors();
+        return true;
+    case Qt::Key_Left:
+        move = byWord ? QTextCursor::WordLeft : QTextCursor::Left;
+        break;
+    case Qt::Key_Right:
+        move = byWord ? QTextCursor::NextWord : QTextCursor::Right;
+        break;
+    case Qt::Key_Up:
+        move = QTextCursor::Up;
+        break;
+    case Qt::Key_Down:
+        move = QTextCursor::Down;
+        break;
+    case Qt::Key_Home:
+        move = QTextCursor::StartOfBlock;
+        break;
+    case Qt::Key_End:
+        move = QTextCursor::EndOfBlock;
+        break;
+    case Qt::Key_Backspace:
+        editAtCursors([this](QTextCursor &cursor) { handleBackspace(cursor); });
+        return true;
+    case Qt::Key_Delete:
+        editAtCursors([](QTextCursor &cursor) { cursor.deleteChar(); });
+        return true;
+    case Qt::Key_Return:
+    case Qt::Key_Enter: {
+        // Indents come from the text before any cursor changed it
+        QVector<int> indents;
+        indents.reserve(m_extraCursors.size() + 1);
+        for (const QTextCursor &cursor : std::as_const(m_extraCursors)) {
+            indents.append(newLineIndent(cursor));
+        }
+        indents.append(newLineIndent(textCursor()));
+        int i = 0;
+        editAtCursors([&indents, &i](QTextCursor &cursor) {
+            cursor.insertBlock();
+            cursor.insertText(QString(indents.at(i++), ' '));
+        });
+        return true;
+    }
+    case Qt::Key_Tab:
+    case Qt::Key_Backtab: {
+        const bool unindent = event->key() == Qt::Key_Backtab || (modifiers & Qt::ShiftModifier);
+        editAtCursors([unindent](QTextCursor &cursor) {
+            if (!unindent) {
+                cursor.insertText("    ");
+                return;
+            }
+            QTextCursor indent = cursor;
+            indent.movePosition(QTextCursor::StartOfBlock);
+            indent.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, 4);
+            if (indent.selectedText() == "    ") {
+                indent.removeSelectedText();
+            }
+        });
+        return true;
+    }
+    default:
+        break;
+    }
+    
+    if (move != QTextCursor::NoMove) {
+        QTextCursor primary = textCursor();
+        for (QTextCursor &cursor : m_extraCursors) {
+            cursor.movePosition(move, mode);
+        }
+        primary.movePosition(move, mode);
+        setTextCursor(primary);
+        mergeCursors();
+        cursorsChanged();
+        return true;
+    }
+    
+    const QString text = event->text();
+    if (text.isEmpty() || !text.at(0).isPrint() || (modifiers & Qt::ControlModifier)) {
+        return false;
+    }
+    const QChar typed = text.at(0);
+    if (typed == '"' || typed == '\'') {
+        editAtCursors([this, typed](QTextCursor &cursor) { handleAutoQuote(cursor, typed); });
+    } else if (bracketPairs().contains(typed)) {
+        handleAutoBracket(typed);
+    } else {
+        // Closing brackets step over the ones already there, like with one cursor
+        const bool closing = text.length() == 1 && QStringLiteral(")]}").contains(typed);
+        editAtCursors([this, &text, closing](QTextCursor &cursor) {
+            if (closing && !cursor.hasSelection() && document()->characterAt(cursor.position()) == text.at(0)) {
+                cursor.movePosition(QTextCursor::Right);
+            } else {
+                cursor.insertText(text);
+            }
+        });
+    }
+    return true;
+}
+
+inline void CustomTextEdit::editAtCursors(const std::function<void(QTextCursor &)> &edit)
+{
+    QTextCursor primary = textCursor();
+    if (m_extraCursors.isEmpty()) {
+        edit(primary);
+        setTextCursor(primary);
+        return;
+    }
+    
+    // The document sends one contentsChange for the whole block, so the
+    // highlighter, syntax tree and trackers catch up once, not per cursor
+    primary.beginEditBlock();
+    for (QTextCursor &cursor : m_extraCursors) {
+        edit(cursor);
+    }
+    edit(primary);
+    primary.endEditBlock();
+    
+    setTextCursor(primary);
+    mergeCursors();
+    cursorsChanged();
+}
+
+inline void CustomTextEdit::mergeCursors()
+{
+    // Cursors that ran into each other, e.g. by deleting the text between
+    // them, are one cursor from now on
+    auto collide = [](const QTextCursor &a, const QTextCursor &b) {
+        return a.selectionStart() == b.selectionStart()
+            || (a.selectionStart() < b.selectionEnd() && b.selectionStart() < a.selectionEnd());
+    };
+    std::sort(m_extraCursors.begin(), m_extraCursors.end(), [](const QTextCursor &a, const QTextCursor &b) {
+        return a.selectionStart() < b.selectionStart();
+    });
+    
+    const QTextCursor primary = textCursor();
+    QList<QTextCursor> kept;
+    kept.reserve(m_extraCursors.size());
+    for (const QTextCursor &cursor : std::as_const(m_extraCursors)) {
+        if (collide(cursor, primary) || (!kept.isEmpty() && collide(cursor, kept.last()))) {
+            continue;
+        }
+        kept.append(cursor);
+    }
+    m_extraCursors = kept;
+}
+
+inline void CustomTextEdit::cursorsChanged()
+{
+    highlightCurrentLine();
+    viewport()->update();
+}
+
+inline void CustomTextEdit::addCursor(const QTextCursor &cursor)
+{
+    // The new one becomes the main cursor, the old main one an extra
+    m_extraCursors.append(textCursor());
+    setTextCursor(cursor);
+    mergeCursors();
+    cursorsChanged();
+}
+
+inline void CustomTextEdit::clearExtraCursors()
+{
+    if (m_extraCursors.isEmpty()) {
+        return;
+    }
+    m_extraCursors.clear();
+    cursorsChanged();
+}
+
+inline bool CustomTextEdit::selectNextOccurrence()
+{
+    QTextCursor cursor = textCursor();
+    if (!cursor.hasSelection()) {
+        cursor.select(QTextCursor::WordUnderCursor);
+        if (!cursor.hasSelection()) {
+            return false;
+        }
+        setTextCursor(cursor);
+        cursorsChanged();
+        return true;
+    }
+    
+    // After the main cursor, wrapping around, stopping at one already taken
+    const QString text = cursor.selectedText();
+    QTextCursor found = document()->find(text, cursor.selectionEnd(), QTextDocument::FindCaseSensitively);
+    if (found.isNull()) {
+        found = document()->find(text, 0, QTextDocument::FindCaseSensitively);
+    }
+    if (found.isNull() || found.selectionStart() == cursor.selectionStart()) {
+        return false;
+    }
+    for (const QTextCursor &other : std::as_const(m_extraCursors)) {
+        if (other.selectionStart() == found.selectionStart()) {
+            return false;
+        }
+    }
+    addCursor(found);
+    return true;
+}
+
+inline int CustomTextEdit::columnAt(const QPoint &pos) const
+{
+    // Past the end of a line counts too, the font is monospaced
+    const qreal x = pos.x() - contentOffset().x() - document()->documentMargin();
+    return qMax(0, qRound(x / fontMetrics().horizontalAdvance(QLatin1Char(' '))));
+}
+
+inline void CustomTextEdit::selectColumns(int line, int column)
+{
+    // One cursor per visible line between the anchor and `line`, short
+    // lines get what they have of the column
+    const int step = line >= m_columnAnchorLine ? 1 : -1;
+    const int lines = qAbs(line - m_columnAnchorLine) + 1;
+    QList<QTextCursor> cursors;
+    QTextBlock block = document()->findBlockByNumber(m_columnAnchorLine);
+    for (int i = 0; i < lines && block.isValid(); ++i) {
+        if (block.isVisible()) {
+            const int length = block.length() - 1;
+            QTextCursor cursor(block);
+            cursor.setPosition(block.position() + qMin(m_columnAnchorColumn, length));
+            cursor.setPosition(block.position() + qMin(column, length), QTextCursor::KeepAnchor);
+            cursors.append(cursor);
+        }
+        block = step > 0 ? block.next() : block.previous();
+    }
+    if (cursors.isEmpty()) {
+        return;
+    }
+    
+    setTextCursor(cursors.takeLast());
+    m_extraCursors = cursors;
+    cursorsChanged();
+}
+
+inline void CustomTextEdit::paintEvent(QPaintEvent *event)
+{
+    QPlainTextEdit::paintEvent(event);
+    if (m_extraCursors.isEmpty()) {
+        return;
+    }
+    
+    // Carets of the extra cursors on screen, they don't blink
+    QPainter painter(viewport());
+    const int first = firstVisibleBlock().blockNumber();
+    const int last = cursorForPosition(viewport()->rect().bottomLeft()).blockNumber();
+    for (const QTextCursor &cursor : std::as_const(m_extraCursors)) {
+        const int line = cursor.blockNumber();
+        if (line < first || line > last || !cursor.block().isVisible()) {
+            continue;
+        }
+        QRect caret = cursorRect(cursor);
+        caret.setWidth(qMax(1, cursorWidth()));
+        if (caret.intersects(event->rect())) {
+            painter.fillRect(caret, palette().text());
+        }
+    }
+}
+
+inline void CustomTextEdit::mousePressEvent(QMouseEvent *event)
+{
+    const QPoint pos = event->position().toPoint();
+    if (event->button() == Qt::LeftButton && (event->modifiers() & Qt::AltModifier)) {
+        if (event->modifiers() & Qt::ShiftModifier) {
+            m_columnAnchorLine = cursorForPosition(pos).blockNumber();
+            m_columnAnchorColumn = columnAt(pos);
+            selectColumns(m_columnAnchorLine, m_columnAnchorColumn);
+        } else {
+            addCursor(cursorForPosition(pos));
+        }
+        event->accept();
+        return;
+    }
+    
+    clearExtraCursors();
+    QPlainTextEdit::mousePressEvent(event);
+}
+
+inline void CustomTextEdit::mouseMoveEvent(QMouseEvent *event)
+{
+    if (m_columnAnchorLine >= 0 && (event->buttons() & Qt::LeftButton)) {
+        const QPoint pos = event->position().toPoint();
+        selectColumns(cursorForPosition(pos).blockNumber(), columnAt(pos));
+        event->accept();
+        return;
+    }
+    QPlainTextEdit::mouseMoveEvent(event);
+}
+
+inline void CustomTextEdit::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (m_columnAnchorLine >= 0) {
+        m_columnAnchorLine = -1;
+        event->accept();
+        return;
+    }
+    QPlainTextEdit::mouseReleaseEvent(event);
+}
+
 inline bool CustomTextEdit::shouldSkipAutoComplete(QChar ch) const
 {
     return wordBoundaryChars().contains(ch);
@@ -610,55 +1409,40 @@ inline bool CustomTextEdit::isInsideQuotesOrComment(const QTextCursor &cursor) c
     return false;
 }
 
-inline void CustomTextEdit::handleAutoQuote(QChar quoteChar) 
+inline void CustomTextEdit::handleAutoQuote(QTextCursor &cursor, QChar quoteChar) 
 {
-    QTextCursor cursor = textCursor();
-    
     // Check for selection
     if (cursor.hasSelection()) {
         QString selectedText = cursor.selectedText();
         cursor.insertText(QString(quoteChar) + selectedText + quoteChar);
         cursor.movePosition(QTextCursor::Left);
-        setTextCursor(cursor);
         return;
     }
     
     // Check if next character is the same quote
-    int pos = cursor.position();
-    if (pos < document()->characterCount()) {
-        cursor.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, 1);
-        QString nextChar = cursor.selectedText();
-        if (nextChar == quoteChar) {
-            cursor.clearSelection();
-            cursor.movePosition(QTextCursor::Right);
-            setTextCursor(cursor);
-            return;
-        }
+    if (document()->characterAt(cursor.position()) == quoteChar) {
+        cursor.movePosition(QTextCursor::Right);
+        return;
     }
     
     // Insert quote pair
     cursor.insertText(QString(quoteChar) + quoteChar);
     cursor.movePosition(QTextCursor::Left);
-    setTextCursor(cursor);
 }
 
-inline void CustomTextEdit::handleAutoClose(QChar opening, QChar closing)
+inline void CustomTextEdit::handleAutoClose(QTextCursor &cursor, QChar opening, QChar closing)
 {
-    QTextCursor cursor = textCursor();
-    
     // Check for selection
     if (cursor.hasSelection()) {
         QString selectedText = cursor.selectedText();
         cursor.insertText(QString(opening) + selectedText + closing);
         cursor.movePosition(QTextCursor::Left);
-        setTextCursor(cursor);
         return;
     }
     
     // Insert bracket pair
     cursor.insertText(QString(opening) + closing);
     cursor.movePosition(QTextCursor::Left);
-    setTextCursor(cursor);
 }
 
 inline void CustomTextEdit::handleAutoBracket(QChar openingBracket) 
@@ -668,62 +1452,47 @@ inline void CustomTextEdit::handleAutoBracket(QChar openingBracket)
         return;
     }
     
-    handleAutoClose(openingBracket, closingBracket);
+    editAtCursors([this, openingBracket, closingBracket](QTextCursor &cursor) {
+        handleAutoClose(cursor, openingBracket, closingBracket);
+    });
 }
 
-inline void CustomTextEdit::handleBackspace() 
+inline void CustomTextEdit::handleBackspace(QTextCursor &cursor) 
 {
-    QTextCursor cursor = textCursor();
-    
     if (cursor.hasSelection()) {
         cursor.removeSelectedText();
         return;
     }
     
-    int position = cursor.position();
+    // Straight from the block text, no selections, this runs for every cursor
+    const QString text = cursor.block().text();
+    const int column = cursor.positionInBlock();
     
     // Check for auto-inserted pairs
-    if (position > 0) {
-        cursor.movePosition(QTextCursor::Left);
-        cursor.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, 2);
-        QString selectedText = cursor.selectedText();
-        
-        if (selectedText == "()" || selectedText == "\"\"" || 
-            selectedText == "''" || selectedText == "{}" || selectedText == "[]") {
+    if (column > 0 && column < text.length()) {
+        const QStringView pair = QStringView(text).mid(column - 1, 2);
+        if (pair == u"()" || pair == u"\"\"" || pair == u"''" || pair == u"{}" || pair == u"[]") {
+            cursor.movePosition(QTextCursor::Left);
+            cursor.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, 2);
             cursor.removeSelectedText();
             return;
         }
     }
     
     // Handle smart backspace for indentation
-    cursor = textCursor();
-    cursor.movePosition(QTextCursor::StartOfLine);
-    cursor.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, 
-                       position - cursor.position());
-    QString textBeforeCursor = cursor.selectedText();
-    
-    // Count trailing spaces
     int spacesCount = 0;
-    for (int i = textBeforeCursor.length() - 1; i >= 0; --i) {
-        if (textBeforeCursor.at(i) == ' ') {
-            spacesCount++;
-        } else {
-            break;
-        }
+    for (int i = column - 1; i >= 0 && text.at(i) == ' '; --i) {
+        spacesCount++;
     }
     
     // Delete 4 spaces if we have multiples of 4
     if (spacesCount >= 4 && spacesCount % 4 == 0) {
-        cursor = textCursor();
         cursor.movePosition(QTextCursor::Left, QTextCursor::KeepAnchor, 4);
-        if (cursor.selectedText() == "    ") {
-            cursor.removeSelectedText();
-            return;
-        }
+        cursor.removeSelectedText();
+        return;
     }
     
     // Default backspace
-    cursor = textCursor();
     cursor.deletePreviousChar();
 }
 
@@ -799,27 +1568,7 @@ inline void CustomTextEdit::handleTabKey(bool shiftModifier)
 inline void CustomTextEdit::handleEnter() 
 {
     QTextCursor cursor = textCursor();
-    QTextBlock currentBlock = cursor.block();
-    QString currentLineText = currentBlock.text();
-    
-    // Count leading spaces
-    int indentCount = 0;
-    while (indentCount < currentLineText.length() && 
-           currentLineText.at(indentCount).isSpace()) {
-        indentCount++;
-    }
-    
-    // Check if we need extra indentation
-    bool extraIndent = false;
-    QString trimmedLine = currentLineText.trimmed();
-    
-    if (trimmedLine.endsWith(':')) {
-        extraIndent = true;
-    } else if (trimmedLine.startsWith("class ") || trimmedLine.startsWith("def ")) {
-        extraIndent = true;
-    } else if (trimmedLine.contains("{")) {
-        extraIndent = true;
-    }
+    const int newIndent = newLineIndent(cursor);
     
     // Insert new line
     QPlainTextEdit::keyPressEvent(new QKeyEvent(QEvent::KeyPress, 
@@ -827,23 +1576,57 @@ inline void CustomTextEdit::handleEnter()
                                                 Qt::NoModifier));
     
     // Apply indentation
-    int newIndent = indentCount + (extraIndent ? 4 : 0);
     if (newIndent > 0) {
         cursor = textCursor();
         cursor.insertText(QString(newIndent, ' '));
     }
 }
 
-inline void CustomTextEdit::onTextChanged()
+inline int CustomTextEdit::newLineIndent(const QTextCursor &cursor) const
+{
+    const QString currentLineText = cursor.block().text();
+    
+    // The syntax tree knows about brackets, strings and block ends
+    int newIndent = m_syntaxTree->indentForNewLine(cursor.blockNumber(), cursor.positionInBlock());
+    
+    if (newIndent < 0) {
+        // Count leading spaces
+        int indentCount = 0;
+        while (indentCount < currentLineText.length() && 
+               currentLineText.at(indentCount).isSpace()) {
+            indentCount++;
+        }
+        
+        // Check if we need extra indentation
+        bool extraIndent = false;
+        QString trimmedLine = currentLineText.trimmed();
+        
+        if (trimmedLine.endsWith(':')) {
+            extraIndent = true;
+        } else if (trimmedLine.startsWith("class ") || trimmedLine.startsWith("def ")) {
+            extraIndent = true;
+        } else if (trimmedLine.contains("{")) {
+            extraIndent = true;
+        }
+        
+        newIndent = indentCount + (extraIndent ? 4 : 0);
+    }
+    return newIndent;
+}
+
+inline void CustomTextEdit::setModified(bool modified)
 {
-    QString currentContent = toPlainText();
-    if (!m_originalContent.isEmpty() && currentContent != m_originalContent) {
-        m_isModified = true;
-        emit fileModified(true);
-    } else if (m_originalContent.isEmpty() && !currentContent.isEmpty()) {
-        m_isModified = true;
-        emit fileModified(true);
+    if (modified) {
+        document()->setModified(true);
+    } else {
+        m_modificationTracker->markSaved();
     }
 }
 
+inline void CustomTextEdit::setLargeFileMode(bool enabled)
+{
+    m_largeFileMode = enabled;
+    m_modificationTracker->setContentCheck(!enabled);
+}
+
 #endif // CUSTOMTEXTEDIT_H
\ No newline at end of file
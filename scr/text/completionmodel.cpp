@@ -0,0 +1,80 @@
+#include "completionmodel.h"
+#include <QHash>
+
+CompletionModel::CompletionModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+void CompletionModel::addSource(Source source) {
+    sources.append(std::move(source));
+}
+
+void CompletionModel::update(const QString &query) {
+    beginResetModel();
+    results.clear();
+
+    if (!query.isEmpty()) {
+        const FuzzyMatcher matcher(query);
+
+        // Every source keeps its own top list, a word two of them know counts once
+        QHash<QString, int> best;
+        for (const Source &source : sources) {
+            FuzzyTopK top(maxResults);
+            source(matcher, top);
+            for (const FuzzyResult &result : top.take()) {
+                auto it = best.find(result.word);
+                if (it == best.end()) {
+                    best.insert(result.word, result.score);
+                } else if (result.score > *it) {
+                    *it = result.score;
+                }
+            }
+        }
+
+        // Recently picked words, even if no source ranked them high enough
+        for (int i = 0; i < recent.size(); ++i) {
+            auto it = best.find(recent.at(i));
+            const int score = it != best.end() ? *it : matcher.score(recent.at(i));
+            if (score < 0) {
+                continue;
+            }
+            const int boosted = score + 16 - i / 2;
+            if (it != best.end()) {
+                *it = boosted;
+            } else {
+                best.insert(recent.at(i), boosted);
+            }
+        }
+
+        FuzzyTopK top(maxResults);
+        for (auto it = best.cbegin(); it != best.cend(); ++it) {
+            top.offer(it.key(), it.value());
+        }
+        results = top.take();
+    }
+
+    endResetModel();
+}
+
+void CompletionModel::accepted(const QString &word) {
+    recent.removeOne(word);
+    recent.prepend(word);
+    if (recent.size() > maxRecent) {
+        recent.removeLast();
+    }
+}
+
+int CompletionModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : int(results.size());
+}
+
+QVariant CompletionModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= results.size()) {
+        return QVariant();
+    }
+    if (role == Qt::DisplayRole || role == Qt::EditRole) {
+        return results.at(index.row()).word;
+    }
+    return QVariant();
+}
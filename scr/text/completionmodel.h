@@ -0,0 +1,41 @@
+#ifndef COMPLETIONMODEL_H
+#define COMPLETIONMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+#include "fuzzymatcher.h"
+
+// The rows of the completion popup: only the best few matches for what was
+// typed, gathered from every source and ranked by score, frequency and how
+// recently a word was picked. The completer shows them as they are.
+class CompletionModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    // Puts the matches of one source into `top` (buffer words, workspace, keywords)
+    using Source = std::function<void(const FuzzyMatcher &matcher, FuzzyTopK &top)>;
+
+    explicit CompletionModel(QObject *parent = nullptr);
+
+    void addSource(Source source);
+
+    // Refills the rows for `query`, empty query means no rows
+    void update(const QString &query);
+    // A completion was inserted, it ranks higher for a while
+    void accepted(const QString &word);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    static constexpr int maxResults = 50;
+    static constexpr int maxRecent = 32;
+
+private:
+    QVector<Source> sources;
+    QVector<FuzzyResult> results;
+    QStringList recent;  // newest first
+};
+
+#endif // COMPLETIONMODEL_H
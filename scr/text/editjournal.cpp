@@ -0,0 +1,357 @@
+#include "editjournal.h"
+#include "fileloader.h"
+#include "modificationtracker.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QUuid>
+#include <QtConcurrent/QtConcurrentRun>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+
+const QByteArray magic = QByteArrayLiteral("MALJRNL1");
+
+enum RecordKind : quint8 {
+    SnapshotRecord = 1,
+    EditRecord = 2,
+    FileRecord = 3,  // a snapshot that is the file on disk
+};
+
+// Length and checksum first, a torn record at the end is recognized as one
+QByteArray frame(const QByteArray &payload)
+{
+    QByteArray record;
+    QDataStream out(&record, QIODevice::WriteOnly);
+    out << quint32(payload.size()) << quint16(qChecksum(payload));
+    record += payload;
+    return record;
+}
+
+} // namespace
+
+EditJournal::EditJournal(QTextDocument *document, ModificationTracker *tracker, QObject *parent)
+    : QObject(parent)
+    , doc(document)
+    , path(directory() + "/" + QUuid::createUuid().toString(QUuid::WithoutBraces) + ".journal")
+{
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(flushDelay);
+    connect(&flushTimer, &QTimer::timeout, this, &EditJournal::flush);
+    connect(tracker, &ModificationTracker::edited, this, &EditJournal::onEdited);
+}
+
+EditJournal::~EditJournal()
+{
+    // The worker posts to this object
+    writing.waitForFinished();
+    if (pending.replace || !pending.edits.isEmpty()) {
+        writeOut(path, pending);
+    }
+}
+
+QString EditJournal::directory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/journal";
+}
+
+void EditJournal::setBaseFile(const QString &file, const TextCodec::Format &format)
+{
+    const QFileInfo info(file);
+    baseFile = file;
+    baseFormat = format;
+    baseSize = info.size();
+    baseModified = info.lastModified().toMSecsSinceEpoch();
+    unstarted.clear();
+}
+
+void EditJournal::dropBaseFile()
+{
+    baseFile.clear();
+    baseSize = -1;
+    unstarted.clear();
+    if (started) {
+        writeSnapshot();
+    }
+}
+
+bool EditJournal::baseUnchanged() const
+{
+    if (baseFile.isEmpty()) {
+        return false;
+    }
+    const QFileInfo info(baseFile);
+    return info.exists() && info.size() == baseSize && info.lastModified().toMSecsSinceEpoch() == baseModified;
+}
+
+void EditJournal::onEdited(int position, int removed, int added)
+{
+    if (!started) {
+        // Snapshot once the edit is through, if it really left the document
+        // modified. With a base file that's the file plus the edits since.
+        if (!startQueued) {
+            startQueued = true;
+            QMetaObject::invokeMethod(this, &EditJournal::startIfModified, Qt::QueuedConnection);
+        }
+        if (baseFile.isEmpty()) {
+            return;
+        }
+    }
+
+    QString text;
+    if (added > 0) {
+        // The document's closing paragraph separator can be counted in
+        const int end = qMin(position + added, doc->characterCount() - 1);
+        QTextCursor cursor(doc);
+        cursor.setPosition(position);
+        cursor.setPosition(end, QTextCursor::KeepAnchor);
+        text = cursor.selectedText();
+        text.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+    }
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out << quint8(EditRecord) << qint32(position) << qint32(removed) << text;
+    if (started) {
+        append(payload);
+    } else {
+        unstarted.append(payload);
+    }
+}
+
+void EditJournal::startIfModified()
+{
+    startQueued = false;
+    if (started) {
+        return;
+    }
+    if (!doc->isModified()) {
+        // Back to what the base file holds
+        unstarted.clear();
+        return;
+    }
+    start();
+}
+
+void EditJournal::start()
+{
+    QDir().mkpath(directory());
+    lock = std::make_unique<QLockFile>(path + ".lock");
+    // Stale only once its process is gone, however long that took
+    lock->setStaleLockTime(0);
+    lock->tryLock(0);
+    started = true;
+
+    const QByteArrayList edits = unstarted;
+    unstarted.clear();
+    if (!baseUnchanged()) {
+        writeSnapshot();
+        return;
+    }
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out << quint8(FileRecord) << filePath << baseFile << baseSize << baseModified
+        << qint32(baseFormat.encoding) << baseFormat.bom;
+    pending = Batch();
+    pending.replace = true;
+    pending.base = payload;
+    snapshotBytes = baseSize;
+    editBytes = 0;
+    for (const QByteArray &edit : edits) {
+        append(edit);
+    }
+    if (!flushTimer.isActive()) {
+        flushTimer.start();
+    }
+}
+
+void EditJournal::writeSnapshot()
+{
+    // Whatever wasn't written yet is in the snapshot too. The copy is all
+    // that happens here, encoding waits for the worker.
+    pending = Batch();
+    pending.replace = true;
+    pending.text = doc->toPlainText();
+    pending.filePath = filePath;
+    snapshotBytes = pending.text.size() * qint64(sizeof(QChar));
+    editBytes = 0;
+    if (!flushTimer.isActive()) {
+        flushTimer.start();
+    }
+}
+
+void EditJournal::append(const QByteArray &payload)
+{
+    editBytes += payload.size();
+    if (editBytes > qMax(minCompactBytes, snapshotBytes)) {
+        // Replaying would take longer than reading a fresh snapshot
+        writeSnapshot();
+        return;
+    }
+    pending.edits.append(payload);
+    if (!flushTimer.isActive()) {
+        flushTimer.start();
+    }
+}
+
+void EditJournal::flush()
+{
+    if ((!pending.replace && pending.edits.isEmpty()) || writing.isRunning()) {
+        // writeDone() comes back for it
+        return;
+    }
+    const Batch batch = pending;
+    const QString target = path;
+    pending = Batch();
+    writing = QtConcurrent::run([this, target, batch]() {
+        writeOut(target, batch);
+        QMetaObject::invokeMethod(this, &EditJournal::writeDone, Qt::QueuedConnection);
+    });
+}
+
+void EditJournal::writeDone()
+{
+    if ((pending.replace || !pending.edits.isEmpty()) && !flushTimer.isActive()) {
+        flushTimer.start();
+    }
+}
+
+void EditJournal::discard()
+{
+    flushTimer.stop();
+    writing.waitForFinished();
+    pending = Batch();
+    started = false;
+    unstarted.clear();
+    if (lock) {
+        QFile::remove(path);
+        lock.reset();
+    }
+}
+
+QByteArray EditJournal::encode(const Batch &batch)
+{
+    QByteArray bytes;
+    if (batch.replace) {
+        QByteArray snapshot = batch.base;
+        if (snapshot.isEmpty()) {
+            QDataStream out(&snapshot, QIODevice::WriteOnly);
+            out << quint8(SnapshotRecord) << batch.filePath << batch.text;
+        }
+        bytes = magic + frame(snapshot);
+    }
+    for (const QByteArray &edit : batch.edits) {
+        bytes += frame(edit);
+    }
+    return bytes;
+}
+
+bool EditJournal::writeOut(const QString &path, const Batch &batch)
+{
+    const QByteArray bytes = encode(batch);
+    if (batch.replace) {
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(bytes) != bytes.size()) {
+            return false;
+        }
+        return file.commit();
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append) || file.write(bytes) != bytes.size()) {
+        return false;
+    }
+    file.flush();
+#ifdef Q_OS_UNIX
+    // On disk, not just handed to the OS: the machine may go down too
+    ::fsync(file.handle());
+#endif
+    return true;
+}
+
+QStringList EditJournal::orphaned()
+{
+    QStringList result;
+    const QDir dir(directory());
+    const QStringList names = dir.entryList(QStringList() << "*.journal", QDir::Files, QDir::Time);
+    for (const QString &name : names) {
+        const QString journal = dir.filePath(name);
+        QLockFile probe(journal + ".lock");
+        probe.setStaleLockTime(0);
+        if (probe.tryLock(0)) {
+            result.append(journal);
+        }
+    }
+    return result;
+}
+
+bool EditJournal::replay(const QString &journalPath, QString *filePath, QString *text)
+{
+    QFile file(journalPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray bytes = file.readAll();
+    if (!bytes.startsWith(magic)) {
+        return false;
+    }
+
+    bool haveSnapshot = false;
+    qsizetype at = magic.size();
+    constexpr qsizetype frameBytes = 6;
+    while (bytes.size() - at >= frameBytes) {
+        quint32 size = 0;
+        quint16 checksum = 0;
+        QDataStream header(bytes.mid(at, frameBytes));
+        header >> size >> checksum;
+        if (qsizetype(size) > bytes.size() - at - frameBytes) {
+            break;  // cut off by the crash
+        }
+        const QByteArray payload = bytes.mid(at + frameBytes, size);
+        if (qChecksum(payload) != checksum) {
+            break;
+        }
+        at += frameBytes + size;
+
+        QDataStream in(payload);
+        quint8 kind = 0;
+        in >> kind;
+        if (kind == SnapshotRecord) {
+            in >> *filePath >> *text;
+            haveSnapshot = true;
+        } else if (kind == FileRecord) {
+            QString base;
+            qint64 baseSize = 0;
+            qint64 modified = 0;
+            qint32 encoding = 0;
+            TextCodec::Format format;
+            in >> *filePath >> base >> baseSize >> modified >> encoding >> format.bom;
+            format.encoding = TextCodec::Encoding(encoding);
+            // Changed since, the edits don't fit it anymore
+            const QFileInfo info(base);
+            haveSnapshot = info.size() == baseSize && info.lastModified().toMSecsSinceEpoch() == modified
+                && FileLoader::readText(base, format, text);
+        } else if (kind == EditRecord && haveSnapshot) {
+            qint32 position = 0;
+            qint32 removed = 0;
+            QString added;
+            in >> position >> removed >> added;
+            // The same clamping the document did when it counted its end
+            position = qBound(0, position, int(text->size()));
+            removed = qBound(0, removed, int(text->size()) - position);
+            text->replace(position, removed, added);
+        }
+    }
+    return haveSnapshot;
+}
@@ -0,0 +1,113 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QByteArray>
+#include <QByteArrayList>
+#include <QFuture>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <memory>
+#include "textcodec.h"
+
+class QLockFile;
+class QTextDocument;
+class ModificationTracker;
+
+// Recovery log of a document with unsaved changes. Starts with a snapshot
+// the first time the document gets modified, then appends one record per
+// edit: where, how much went, what came. Records are gathered on the GUI
+// thread and written in batches, flushDelay apart, by a worker that also
+// does the encoding and checksums; the file is only rewritten when the
+// edits outgrow the snapshot.
+//
+// Right after a load or save the snapshot is just the file's name, size and
+// modification time (setBaseFile()), replay reads the file back. Only a
+// compaction, or a document that never matched a file, copies the text.
+//
+// Each record carries its length and a checksum, so a log cut off by a crash
+// replays up to its last whole record. A live journal holds a lock file, at
+// startup the ones nobody holds are what a dead session left behind.
+//
+// Edits come from the ModificationTracker, which already tells the
+// highlighter's format updates apart from text changes.
+class EditJournal : public QObject {
+    Q_OBJECT
+
+public:
+    EditJournal(QTextDocument *document, ModificationTracker *tracker, QObject *parent = nullptr);
+    // Whatever is gathered still gets written, the file stays
+    ~EditJournal();
+
+    // Goes into the snapshot, for restoring into the right file
+    void setFilePath(const QString &path) { filePath = path; }
+    QString journalPath() const { return path; }
+
+    // The document holds what this file does right now, read as `format`
+    void setBaseFile(const QString &path, const TextCodec::Format &format);
+    // The file changed without the document following it (saved while
+    // typing went on): the log goes on from a copy of the text
+    void dropBaseFile();
+
+    // Saved or thrown away on purpose: nothing left to recover
+    void discard();
+
+    static constexpr int flushDelay = 500;
+    // Edits are logged up to this many bytes, or the snapshot's size, before
+    // the log is compacted into a new snapshot
+    static constexpr qint64 minCompactBytes = 1024 * 1024;
+
+    static QString directory();
+    // Journals in directory() no running session holds
+    static QStringList orphaned();
+    // The text the journal ends with, and the file it belongs to
+    static bool replay(const QString &journalPath, QString *filePath, QString *text);
+
+private slots:
+    void onEdited(int position, int removed, int added);
+    void startIfModified();
+    void flush();
+
+private:
+    // What goes to the worker in one go
+    struct Batch {
+        bool replace = false;   // starts with a snapshot, the file is rewritten
+        QByteArray base;        // the snapshot as a base file record...
+        QString text;           // ...or as text, encoded on the worker
+        QString filePath;
+        QByteArrayList edits;   // payloads, framed on the worker
+    };
+
+    void start();
+    void writeSnapshot();
+    bool baseUnchanged() const;
+    void append(const QByteArray &payload);
+    void writeDone();
+    static QByteArray encode(const Batch &batch);
+    static bool writeOut(const QString &path, const Batch &batch);
+
+    QTextDocument *doc;
+    QString path;
+    QString filePath;
+    std::unique_ptr<QLockFile> lock;
+
+    bool started = false;
+    bool startQueued = false;
+    qint64 snapshotBytes = 0;
+    qint64 editBytes = 0;  // logged since the snapshot
+
+    // The file the document was last loaded from or saved to, as it was then
+    QString baseFile;
+    TextCodec::Format baseFormat;
+    qint64 baseSize = -1;
+    qint64 baseModified = 0;
+    // Edits since the base file, kept until the document turns out modified
+    QByteArrayList unstarted;
+
+    // Not handed to the worker yet
+    Batch pending;
+    QFuture<void> writing;
+    QTimer flushTimer;
+};
+
+#endif // EDITJOURNAL_H
@@ -0,0 +1,207 @@
+#include "fileloader.h"
+#include <QFile>
+#include <QtConcurrent/QtConcurrentRun>
+#include <climits>
+#include <optional>
+
+namespace {
+
+// What QIODevice::Text did: the "\r" of every "\r\n" from `from` on goes.
+// A "\r" at the very end stays, the next call looks at it again.
+void dropCarriageReturns(QString &text, qsizetype from)
+{
+    qsizetype i = QStringView(text).indexOf(QLatin1Char('\r'), from);
+    if (i < 0) {
+        return;
+    }
+    QChar *data = text.data();
+    const qsizetype size = text.size();
+    qsizetype out = i;
+    for (; i < size; ++i) {
+        if (data[i] == QLatin1Char('\r') && i + 1 < size && data[i + 1] == QLatin1Char('\n')) {
+            continue;
+        }
+        data[out++] = data[i];
+    }
+    text.truncate(out);
+}
+
+} // namespace
+
+FileLoader::FileLoader(const QString &path, QObject *parent)
+    : QObject(parent)
+    , m_path(path)
+{
+    // One chunk per pass of the event loop
+    m_deliverTimer.setInterval(0);
+    connect(&m_deliverTimer, &QTimer::timeout, this, &FileLoader::deliverNext);
+}
+
+FileLoader::~FileLoader()
+{
+    // The worker posts to this object, it has to be done first
+    cancel();
+}
+
+void FileLoader::start()
+{
+    cancel();
+    m_loading = true;
+    m_workerDone = false;
+
+    m_cancel = std::make_shared<std::atomic_bool>(false);
+    const std::shared_ptr<std::atomic_bool> cancel = m_cancel;
+    const QString path = m_path;
+    const bool progressive = m_progressive;
+    const int generation = m_generation;
+
+    m_work = QtConcurrent::run([this, cancel, path, progressive, generation]() {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            const QString error = file.errorString();
+            QMetaObject::invokeMethod(this, [this, error, generation]() {
+                receivedError(error, generation);
+            }, Qt::QueuedConnection);
+            return;
+        }
+
+        const qint64 size = file.size();
+        std::optional<TextCodec::Decoder> decoder;
+        // Decoded straight into here: everything, or the current chunk
+        QString text;
+        if (!progressive) {
+            text.reserve(qsizetype(qMin<qint64>(size, INT_MAX / 2)));
+        }
+        qint64 done = 0;
+
+        while (!*cancel) {
+            const QByteArray bytes = file.read(chunkBytes);
+            if (bytes.isEmpty() && !file.atEnd()) {
+                const QString error = file.errorString();
+                QMetaObject::invokeMethod(this, [this, error, generation]() {
+                    receivedError(error, generation);
+                }, Qt::QueuedConnection);
+                return;
+            }
+            qint64 skip = 0;
+            if (!decoder) {
+                const TextCodec::Format format = TextCodec::detect(bytes.constData(), bytes.size());
+                decoder.emplace(format.encoding);
+                skip = TextCodec::bomLength(format);
+                QMetaObject::invokeMethod(this, [this, format, generation]() {
+                    if (generation == m_generation) {
+                        m_format = format;
+                    }
+                }, Qt::QueuedConnection);
+            }
+            done += bytes.size();
+            const bool last = file.atEnd();
+
+            const qsizetype before = text.size();
+            decoder->decode(bytes.constData() + skip, bytes.size() - skip, text);
+            if (last) {
+                decoder->finish(text);
+                if (decoder->hasErrors()) {
+                    // Before the last text, so it's there when finished() is
+                    QMetaObject::invokeMethod(this, [this, generation]() {
+                        if (generation == m_generation) {
+                            m_format.lossy = true;
+                        }
+                    }, Qt::QueuedConnection);
+                }
+            }
+            dropCarriageReturns(text, qMax<qsizetype>(0, before - 1));
+
+            QString ready;
+            if (last) {
+                ready = text;
+            } else if (progressive) {
+                // A "\r" at the end may still lose its "\n"
+                if (text.endsWith(QLatin1Char('\r'))) {
+                    ready = text.left(text.size() - 1);
+                    text = QStringLiteral("\r");
+                } else {
+                    ready = text;
+                    text.clear();
+                }
+            }
+            const int percent = size > 0 ? int(done * 100 / size) : 100;
+            QMetaObject::invokeMethod(this, [this, ready, percent, last, generation]() {
+                received(ready, percent, last, generation);
+            }, Qt::QueuedConnection);
+            if (last) {
+                return;
+            }
+        }
+    });
+}
+
+bool FileLoader::readText(const QString &path, const TextCodec::Format &format, QString *text,
+                          QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) {
+            *error = file.errorString();
+        }
+        return false;
+    }
+    const QByteArray bytes = file.readAll();
+    const int skip = qMin<int>(TextCodec::bomLength(format), int(bytes.size()));
+    TextCodec::Decoder decoder(format.encoding);
+    text->clear();
+    decoder.decode(bytes.constData() + skip, bytes.size() - skip, *text);
+    decoder.finish(*text);
+    dropCarriageReturns(*text, 0);
+    return true;
+}
+
+void FileLoader::cancel()
+{
+    if (m_cancel) {
+        *m_cancel = true;
+    }
+    m_work.waitForFinished();
+    ++m_generation;
+    m_pending.clear();
+    m_deliverTimer.stop();
+    m_loading = false;
+}
+
+void FileLoader::received(const QString &text, int percent, bool last, int generation)
+{
+    if (generation != m_generation) {
+        return;
+    }
+    if (!text.isEmpty()) {
+        m_pending.append(text);
+    }
+    m_workerDone = last;
+    emit progress(percent);
+    if (!m_deliverTimer.isActive()) {
+        m_deliverTimer.start();
+    }
+}
+
+void FileLoader::receivedError(const QString &error, int generation)
+{
+    if (generation != m_generation) {
+        return;
+    }
+    m_loading = false;
+    emit failed(error);
+}
+
+void FileLoader::deliverNext()
+{
+    if (!m_pending.isEmpty()) {
+        emit textReady(m_pending.takeFirst());
+    }
+    if (m_pending.isEmpty()) {
+        m_deliverTimer.stop();
+        if (m_workerDone && m_loading) {
+            m_loading = false;
+            emit finished();
+        }
+    }
+}
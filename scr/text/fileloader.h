@@ -0,0 +1,70 @@
+#ifndef FILELOADER_H
+#define FILELOADER_H
+
+#include <QFuture>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <atomic>
+#include <memory>
+#include "textcodec.h"
+
+// Reads and decodes (TextCodec) a file on a worker thread, chunkBytes at a time, and
+// hands the text back on the GUI thread. Progressive loaders deliver each
+// chunk as it is decoded, one per event loop pass so input still gets
+// through; the others deliver the whole text once at the end.
+//
+// Deleting the loader cancels the read and drops everything not delivered.
+class FileLoader : public QObject {
+    Q_OBJECT
+
+public:
+    explicit FileLoader(const QString &path, QObject *parent = nullptr);
+    ~FileLoader();
+
+    void setProgressive(bool progressive) { m_progressive = progressive; }
+    bool isProgressive() const { return m_progressive; }
+
+    void start();
+    void cancel();
+    bool isLoading() const { return m_loading; }
+    QString filePath() const { return m_path; }
+    // Encoding and line breaks found in the file, once loading has finished
+    TextCodec::Format format() const { return m_format; }
+
+    static constexpr qint64 chunkBytes = 1024 * 1024;
+
+    // The same text a loader delivers, for a file already known to be in
+    // `format`, read in one go on the calling thread
+    static bool readText(const QString &path, const TextCodec::Format &format, QString *text,
+                         QString *error = nullptr);
+
+signals:
+    void progress(int percent);
+    // In file order, "\r\n" already turned into "\n"
+    void textReady(const QString &text);
+    void finished();
+    void failed(const QString &error);
+
+private slots:
+    void deliverNext();
+
+private:
+    void received(const QString &text, int percent, bool last, int generation);
+    void receivedError(const QString &error, int generation);
+
+    QString m_path;
+    TextCodec::Format m_format;
+    bool m_progressive = false;
+    bool m_loading = false;
+    bool m_workerDone = false;
+
+    QFuture<void> m_work;
+    std::shared_ptr<std::atomic_bool> m_cancel;
+    int m_generation = 0;  // results of a cancelled run are dropped
+
+    QStringList m_pending;
+    QTimer m_deliverTimer;
+};
+
+#endif // FILELOADER_H
@@ -0,0 +1,115 @@
+#include "filesaver.h"
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtConcurrent/QtConcurrentRun>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// The rename is only on disk once the directory is
+void syncDirectory(const QString &path)
+{
+#ifdef Q_OS_UNIX
+    const QByteArray dir = QFile::encodeName(QFileInfo(path).absolutePath());
+    const int fd = ::open(dir.constData(), O_RDONLY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#else
+    Q_UNUSED(path)
+#endif
+}
+
+} // namespace
+
+FileSaver::FileSaver(QObject *parent)
+    : QObject(parent)
+{
+}
+
+FileSaver::~FileSaver()
+{
+    // The worker posts to this object; a queued save still gets written
+    m_work.waitForFinished();
+    if (m_queued) {
+        write(m_queued->path, m_queued->text, m_queued->format);
+    }
+}
+
+void FileSaver::save(const QString &path, const QString &text, const TextCodec::Format &format, int tag)
+{
+    Job job;
+    job.path = path;
+    job.text = text;
+    job.format = format;
+    job.tag = tag;
+    if (m_saving) {
+        // Two writes racing to one rename could leave the older text
+        m_queued = job;
+        return;
+    }
+    startJob(job);
+}
+
+void FileSaver::startJob(const Job &job)
+{
+    m_saving = true;
+    m_work = QtConcurrent::run([this, job]() {
+        QString error;
+        const bool ok = write(job.path, job.text, job.format, &error);
+        QMetaObject::invokeMethod(this, [this, job, ok, error]() {
+            jobDone(job, ok, error);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void FileSaver::jobDone(const Job &job, bool ok, const QString &error)
+{
+    m_saving = false;
+    if (ok) {
+        emit saved(job.path, job.tag);
+    } else {
+        emit failed(job.path, error);
+    }
+    if (m_queued) {
+        const Job next = *m_queued;
+        m_queued.reset();
+        startJob(next);
+    } else {
+        emit idle();
+    }
+}
+
+bool FileSaver::write(const QString &path, const QString &text, const TextCodec::Format &format,
+                      QString *error)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error) {
+            *error = file.errorString();
+        }
+        return false;
+    }
+    const QByteArray bytes = TextCodec::encode(text, format);
+    if (file.write(bytes) != bytes.size()) {
+        if (error) {
+            *error = file.errorString();
+        }
+        file.cancelWriting();
+        return false;
+    }
+    // Syncs the temporary file before renaming it
+    if (!file.commit()) {
+        if (error) {
+            *error = file.errorString();
+        }
+        return false;
+    }
+    syncDirectory(path);
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef FILESAVER_H
+#define FILESAVER_H
+
+#include <QFuture>
+#include <QObject>
+#include <QString>
+#include <optional>
+#include "textcodec.h"
+
+// Writes text to a file on a worker thread: encoded with TextCodec into a
+// temporary file next to it, synced to disk and renamed over the old one.
+// A crash or a full disk leaves the old file or the new one, never half.
+//
+// One saver writes in order. Saving again while a write runs queues the new
+// text, replacing anything queued before. Deleting the saver waits for the
+// running write and does the queued one too, nothing asked for is dropped.
+class FileSaver : public QObject {
+    Q_OBJECT
+
+public:
+    explicit FileSaver(QObject *parent = nullptr);
+    ~FileSaver();
+
+    // `tag` comes back with saved(), e.g. the document revision the text is from
+    void save(const QString &path, const QString &text, const TextCodec::Format &format, int tag = 0);
+    bool isSaving() const { return m_saving; }
+
+    // The same write, on the calling thread
+    static bool write(const QString &path, const QString &text, const TextCodec::Format &format,
+                      QString *error = nullptr);
+
+signals:
+    void saved(const QString &path, int tag);
+    void failed(const QString &path, const QString &error);
+    // Nothing running or queued anymore
+    void idle();
+
+private:
+    struct Job {
+        QString path;
+        QString text;
+        TextCodec::Format format;
+        int tag = 0;
+    };
+
+    void startJob(const Job &job);
+    void jobDone(const Job &job, bool ok, const QString &error);
+
+    bool m_saving = false;
+    QFuture<void> m_work;
+    std::optional<Job> m_queued;
+};
+
+#endif // FILESAVER_H
@@ -0,0 +1,364 @@
+#include "fuzzymatcher.h"
+#include <QtAlgorithms>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MALACHITE_FUZZY_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Only this much of the query takes part, one position mask per character
+constexpr int maxQueryLength = 32;
+
+// Loads are 16 bytes wide and may run past the end of the last word
+constexpr int slack = 16;
+
+constexpr int matchScore = 16;
+constexpr int startBonus = 8;
+constexpr int prefixBonus = 12;
+constexpr int runBonus = 6;
+constexpr int caseBonus = 1;
+constexpr int gapStart = 3;
+constexpr int maxGapPenalty = 8;
+
+// ASCII lowercased, anything else squeezed into one byte with the high bit set
+inline char fold(QChar c)
+{
+    const ushort u = c.unicode();
+    if (u < 0x80) {
+        return char(u >= 'A' && u <= 'Z' ? u + ('a' - 'A') : u);
+    }
+    return char(0x80 | (u & 0x7f));
+}
+
+inline quint32 maskBit(char c)
+{
+    if (c >= 'a' && c <= 'z') {
+        return 1u << (c - 'a');
+    }
+    if (c >= '0' && c <= '9') {
+        return 1u << 26;
+    }
+    return c == '_' ? 1u << 27 : 1u << 28;
+}
+
+// positions[k] gets bit i set where folded[i] == query[k]. Each 16 byte
+// chunk of the word is loaded once and compared against every query byte.
+inline void findPositions(const char *folded, int wordLength, const char *query, int queryLength,
+                          quint64 *positions)
+{
+    std::fill(positions, positions + queryLength, 0);
+#ifdef MALACHITE_FUZZY_SSE2
+    for (int i = 0; i < wordLength; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(folded + i));
+        for (int k = 0; k < queryLength; ++k) {
+            const __m128i hits = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(query[k]));
+            positions[k] |= quint64(quint32(_mm_movemask_epi8(hits))) << i;
+        }
+    }
+    if (wordLength < 64) {
+        const quint64 inside = (quint64(1) << wordLength) - 1;
+        for (int k = 0; k < queryLength; ++k) {
+            positions[k] &= inside;
+        }
+    }
+#else
+    for (int i = 0; i < wordLength; ++i) {
+        for (int k = 0; k < queryLength; ++k) {
+            if (folded[i] == query[k]) {
+                positions[k] |= quint64(1) << i;
+            }
+        }
+    }
+#endif
+}
+
+// Best first: higher score, then the shorter word, then alphabetical
+bool better(const FuzzyResult &a, const FuzzyResult &b)
+{
+    if (a.score != b.score) {
+        return a.score > b.score;
+    }
+    if (a.word.size() != b.word.size()) {
+        return a.word.size() < b.word.size();
+    }
+    return a.word < b.word;
+}
+
+} // namespace
+
+void FuzzyCandidates::reserve(int wordCount, int bytes)
+{
+    words.reserve(wordCount);
+    masks.reserve(wordCount + 3);
+    startMasks.reserve(wordCount + 3);
+    starts.reserve(wordCount);
+    uppers.reserve(wordCount);
+    offsets.reserve(wordCount + 1);
+    bonuses.reserve(wordCount);
+    folded.reserve(bytes + slack);
+}
+
+void FuzzyCandidates::append(const QString &word, int bonus)
+{
+    if (word.isEmpty() || word.size() > FuzzyMatcher::maxWordLength) {
+        return;
+    }
+    if (offsets.isEmpty()) {
+        offsets.append(0);
+        // Padding lanes for the last 4-wide load, always kept at the end
+        masks.fill(0, 3);
+        startMasks.fill(0, 3);
+    }
+
+    folded.resize(offsets.last());
+    for (const QChar c : word) {
+        folded.append(fold(c));
+    }
+    offsets.append(int(folded.size()));
+    folded.append(slack, '\0');
+
+    const quint64 wordStarts = FuzzyMatcher::wordStarts(word);
+    words.append(word);
+    masks.insert(masks.size() - 3, FuzzyMatcher::charMask(word));
+    startMasks.insert(startMasks.size() - 3, FuzzyMatcher::startMask(word, wordStarts));
+    starts.append(wordStarts);
+    uppers.append(FuzzyMatcher::upperBits(word));
+    bonuses.append(bonus);
+}
+
+FuzzyTopK::FuzzyTopK(int k)
+    : k(k)
+{
+    heap.reserve(k);
+}
+
+void FuzzyTopK::offer(const QString &word, int score)
+{
+    if (k <= 0) {
+        return;
+    }
+    // heap.front() is the worst of the kept ones
+    if (heap.size() == k && score < heap.front().score) {
+        return;
+    }
+
+    FuzzyResult result{word, score};
+    if (heap.size() < k) {
+        heap.append(std::move(result));
+        std::push_heap(heap.begin(), heap.end(), better);
+        return;
+    }
+    if (!better(result, heap.front())) {
+        return;
+    }
+    std::pop_heap(heap.begin(), heap.end(), better);
+    heap.last() = std::move(result);
+    std::push_heap(heap.begin(), heap.end(), better);
+}
+
+int FuzzyTopK::threshold() const
+{
+    return heap.size() < k ? -1 : heap.front().score;
+}
+
+QVector<FuzzyResult> FuzzyTopK::take()
+{
+    std::sort_heap(heap.begin(), heap.end(), better);
+    QVector<FuzzyResult> results;
+    results.swap(heap);
+    return results;
+}
+
+FuzzyMatcher::FuzzyMatcher(const QString &query)
+    : text(query)
+    , length(qMin(int(query.size()), maxQueryLength))
+{
+    foldedQuery.reserve(length);
+    for (int i = 0; i < length; ++i) {
+        foldedQuery.append(fold(query.at(i)));
+        mask |= maskBit(foldedQuery.at(i));
+    }
+    if (length) {
+        firstMask = maskBit(foldedQuery.at(0));
+    }
+    queryUppers = upperBits(query.left(length));
+}
+
+quint32 FuzzyMatcher::charMask(const QString &word)
+{
+    quint32 mask = 0;
+    for (const QChar c : word) {
+        mask |= maskBit(fold(c));
+    }
+    return mask;
+}
+
+quint32 FuzzyMatcher::startMask(const QString &word, quint64 starts)
+{
+    quint32 mask = 0;
+    for (; starts; starts &= starts - 1) {
+        mask |= maskBit(fold(word.at(qCountTrailingZeroBits(starts))));
+    }
+    return mask;
+}
+
+quint64 FuzzyMatcher::upperBits(const QString &word)
+{
+    const int wordLength = qMin(int(word.size()), maxWordLength);
+    quint64 bits = 0;
+    for (int i = 0; i < wordLength; ++i) {
+        if (word.at(i).isUpper()) {
+            bits |= quint64(1) << i;
+        }
+    }
+    return bits;
+}
+
+quint64 FuzzyMatcher::wordStarts(const QString &word)
+{
+    const int wordLength = qMin(int(word.size()), maxWordLength);
+    quint64 starts = 0;
+    for (int i = 0; i < wordLength; ++i) {
+        const QChar c = word.at(i);
+        bool start = i == 0;
+        if (!start && c != QLatin1Char('_')) {
+            const QChar prev = word.at(i - 1);
+            start = !prev.isLetterOrNumber()                             // after '_'
+                || (c.isUpper() && prev.isLower())                       // camelCase
+                || (c.isDigit() != prev.isDigit())                       // name2, 2fa
+                || (c.isUpper() && i + 1 < wordLength && word.at(i + 1).isLower()
+                    && prev.isUpper());                                  // HTTPServer
+        }
+        if (start) {
+            starts |= quint64(1) << i;
+        }
+    }
+    return starts;
+}
+
+int FuzzyMatcher::score(const QString &word) const
+{
+    return score(word, charMask(word));
+}
+
+int FuzzyMatcher::score(const QString &word, quint32 wordMask) const
+{
+    const int wordLength = int(word.size());
+    if (!length || (mask & ~wordMask) || wordLength < length || wordLength > maxWordLength) {
+        return -1;
+    }
+
+    char buffer[maxWordLength + slack] = {};
+    for (int i = 0; i < wordLength; ++i) {
+        buffer[i] = fold(word.at(i));
+    }
+    return scoreFolded(buffer, wordLength, wordStarts(word), upperBits(word));
+}
+
+int FuzzyMatcher::scoreFolded(const char *folded, int wordLength, quint64 starts, quint64 uppers) const
+{
+    if (wordLength < length || wordLength > maxWordLength) {
+        return -1;
+    }
+
+    quint64 positions[maxQueryLength];
+    findPositions(folded, wordLength, foldedQuery.constData(), length, positions);
+
+    // First character at the earliest word start, the rest greedily after it.
+    // If that fails every later start fails too.
+    const quint64 first = positions[0] & starts;
+    if (!first) {
+        return -1;
+    }
+    int position = qCountTrailingZeroBits(first);
+    for (int k = 1; k < length; ++k) {
+        const quint64 after = positions[k] & ~((quint64(2) << position) - 1);
+        if (!after) {
+            return -1;
+        }
+        position = qCountTrailingZeroBits(after);
+    }
+
+    // Then back from the end, each character as late as it can be, so runs
+    // stay together ("ab" in "a_ab" takes the second a)
+    int matched[maxQueryLength];
+    matched[length - 1] = position;
+    for (int k = length - 2; k >= 0; --k) {
+        quint64 before = positions[k] & ((quint64(1) << matched[k + 1]) - 1);
+        if (k == 0) {
+            before &= starts;
+        }
+        matched[k] = 63 - qCountLeadingZeroBits(before);
+    }
+
+    int score = 0;
+    for (int k = 0; k < length; ++k) {
+        const int p = matched[k];
+        score += matchScore;
+        if (starts & (quint64(1) << p)) {
+            score += startBonus;
+        }
+        if (((uppers >> p) & 1) == ((queryUppers >> k) & 1)) {
+            score += caseBonus;
+        }
+        if (k > 0) {
+            const int gap = p - matched[k - 1] - 1;
+            score += gap == 0 ? runBonus : -qMin(maxGapPenalty, gapStart + gap);
+        }
+    }
+    if (matched[0] == 0) {
+        score += prefixBonus;
+    }
+    // Between otherwise equal matches the shorter word wins
+    score -= qMin(maxGapPenalty, (wordLength - length) / 4);
+    return qMax(score, 0);
+}
+
+void FuzzyMatcher::collect(const FuzzyCandidates &candidates, FuzzyTopK &top) const
+{
+    if (!length) {
+        return;
+    }
+
+    const int count = candidates.size();
+    const auto visit = [&](int i) {
+        const int offset = candidates.offsets.at(i);
+        const int s = scoreFolded(candidates.folded.constData() + offset, candidates.offsets.at(i + 1) - offset,
+                                  candidates.starts.at(i), candidates.uppers.at(i));
+        if (s >= 0) {
+            top.offer(candidates.words.at(i), s + candidates.bonuses.at(i));
+        }
+    };
+
+    // A word can only match if it has every kind of character the query has
+    // and the first one at a word start. Four words per step.
+    const quint32 *masks = candidates.masks.constData();
+    const quint32 *startMasks = candidates.startMasks.constData();
+#ifdef MALACHITE_FUZZY_SSE2
+    const __m128i need = _mm_set1_epi32(int(mask));
+    const __m128i needStart = _mm_set1_epi32(int(firstMask));
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < count; i += 4) {
+        const __m128i have = _mm_loadu_si128(reinterpret_cast<const __m128i *>(masks + i));
+        const __m128i haveStart = _mm_loadu_si128(reinterpret_cast<const __m128i *>(startMasks + i));
+        const __m128i missing = _mm_or_si128(_mm_andnot_si128(have, need), _mm_andnot_si128(haveStart, needStart));
+        uint hits = uint(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(missing, zero))));
+        while (hits) {
+            const int lane = qCountTrailingZeroBits(hits);
+            hits &= hits - 1;
+            if (i + lane < count) {
+                visit(i + lane);
+            }
+        }
+    }
+#else
+    for (int i = 0; i < count; ++i) {
+        if (!(mask & ~masks[i]) && !(firstMask & ~startMasks[i])) {
+            visit(i);
+        }
+    }
+#endif
+}
@@ -0,0 +1,95 @@
+#ifndef FUZZYMATCHER_H
+#define FUZZYMATCHER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+// A word that matched and how well
+struct FuzzyResult {
+    QString word;
+    int score = 0;
+};
+
+// Words laid out for bulk matching: ASCII-folded bytes back to back, the
+// character masks and word-start bits per word. Built once per source (the
+// workspace index, the keywords) and then read from any thread.
+class FuzzyCandidates {
+public:
+    void reserve(int words, int bytes);
+    // `bonus` is added to every score of the word, e.g. for frequency
+    void append(const QString &word, int bonus = 0);
+    int size() const { return int(words.size()); }
+
+private:
+    friend class FuzzyMatcher;
+
+    QVector<QString> words;
+    QVector<quint32> masks;      // every character, 3 lanes of padding at the end
+    QVector<quint32> startMasks; // characters that start a word part, same padding
+    QVector<quint64> starts;     // word-start bits, see FuzzyMatcher::wordStarts
+    QVector<quint64> uppers;     // upper case bits, so scoring never reads the QString
+    QVector<int> offsets;        // into folded, one past the last word too
+    QVector<int> bonuses;
+    QByteArray folded;           // with slack at the end for 16 byte loads
+};
+
+// Best `k` results seen so far, kept in a min-heap so nothing is sorted
+// until take() and only those k then
+class FuzzyTopK {
+public:
+    explicit FuzzyTopK(int k);
+
+    void offer(const QString &word, int score);
+    // Scores at or below this can't get in anymore
+    int threshold() const;
+    // Best first, leaves the heap empty
+    QVector<FuzzyResult> take();
+
+private:
+    int k;
+    QVector<FuzzyResult> heap;
+};
+
+// Subsequence matching of what was typed against identifiers: "gtattr"
+// finds getattr, "np_arr" finds numpy_array. The first character has to
+// hit a word start (start, after '_', a camel hump or digits), the rest may
+// skip. Scores favour word starts, consecutive runs, short gaps and case.
+class FuzzyMatcher {
+public:
+    explicit FuzzyMatcher(const QString &query);
+
+    bool isEmpty() const { return length == 0; }
+    QString query() const { return text; }
+
+    // Score of `word`, -1 when it doesn't match
+    int score(const QString &word) const;
+    // Same with the character mask known, skips most words without looking at them
+    int score(const QString &word, quint32 wordMask) const;
+    // Every candidate into `top`
+    void collect(const FuzzyCandidates &candidates, FuzzyTopK &top) const;
+
+    // Which letters, digits and '_' a word contains, one bit each kind
+    static quint32 charMask(const QString &word);
+    // Same for the characters at word starts only
+    static quint32 startMask(const QString &word, quint64 starts);
+    // Bit i set when word[i] starts a word part
+    static quint64 wordStarts(const QString &word);
+    // Bit i set when word[i] is upper case
+    static quint64 upperBits(const QString &word);
+
+    // Words longer than this never match, no identifier gets there
+    static constexpr int maxWordLength = 64;
+
+private:
+    int scoreFolded(const char *folded, int wordLength, quint64 starts, quint64 uppers) const;
+
+    QString text;
+    QByteArray foldedQuery;
+    int length = 0;
+    quint32 mask = 0;
+    quint32 firstMask = 0;
+    quint64 queryUppers = 0;
+};
+
+#endif // FUZZYMATCHER_H
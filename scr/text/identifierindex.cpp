@@ -0,0 +1,186 @@
+#include "identifierindex.h"
+#include "fuzzymatcher.h"
+#include "../parser/keywords.h"
+#include "../parser/linechange.h"
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QtAlgorithms>
+#include <algorithm>
+
+IdentifierIndex::IdentifierIndex(QTextDocument *document, QObject *parent)
+    : QObject(parent)
+    , doc(document)
+{
+    connect(doc, &QTextDocument::contentsChange, this, &IdentifierIndex::onContentsChange);
+    resync();
+}
+
+void IdentifierIndex::setEnabled(bool on) {
+    if (enabled == on) {
+        return;
+    }
+    enabled = on;
+    if (enabled) {
+        resync();
+        return;
+    }
+
+    lineWords.clear();
+    lineWords.squeeze();
+    counts.clear();
+}
+
+// Identifiers outside comments and one-line strings. Keywords and builtins
+// are left out, the completer has them anyway. Lines inside a multi-line
+// string aren't recognized as such, their words count like code.
+void IdentifierIndex::scanLine(const QString &text, QVector<QString> &words) {
+    const QChar *data = text.constData();
+    const int length = text.size();
+
+    int i = 0;
+    while (i < length) {
+        const QChar c = data[i];
+        if (c == QLatin1Char('#')) {
+            break;
+        }
+
+        if (c == QLatin1Char('"') || c == QLatin1Char('\'')) {
+            ++i;
+            while (i < length && data[i] != c) {
+                i += data[i] == QLatin1Char('\\') ? 2 : 1;
+            }
+            ++i;
+            continue;
+        }
+
+        if (c.isLetter() || c == QLatin1Char('_')) {
+            int end = i + 1;
+            while (end < length && (data[end].isLetterOrNumber() || data[end] == QLatin1Char('_'))) {
+                ++end;
+            }
+            const int wordLength = end - i;
+            if (wordLength >= minWordLength
+                && Keywords::lookup(reinterpret_cast<const ushort *>(data + i), wordLength) == Keywords::Kind::None) {
+                words.append(QString(data + i, wordLength));
+            }
+            i = end;
+            continue;
+        }
+
+        // 0x1f, 1e10, 10_000 aren't words
+        if (c.isDigit()) {
+            while (i < length && (data[i].isLetterOrNumber() || data[i] == QLatin1Char('_'))) {
+                ++i;
+            }
+            continue;
+        }
+        ++i;
+    }
+}
+
+void IdentifierIndex::retain(QVector<QString> &words) {
+    for (QString &word : words) {
+        auto it = counts.find(word);
+        if (it == counts.end()) {
+            it = counts.insert(word, Word{0, FuzzyMatcher::charMask(word)});
+        }
+        ++it->count;
+        word = it.key();
+    }
+}
+
+void IdentifierIndex::release(const QVector<QString> &words) {
+    for (const QString &word : words) {
+        auto it = counts.find(word);
+        if (it != counts.end() && --it->count == 0) {
+            counts.erase(it);
+        }
+    }
+}
+
+void IdentifierIndex::resync() {
+    if (!enabled) {
+        return;
+    }
+
+    counts.clear();
+    lineWords.clear();
+    lineWords.resize(doc->blockCount());
+    int line = 0;
+    for (QTextBlock block = doc->begin(); block.isValid(); block = block.next(), ++line) {
+        scanLine(block.text(), lineWords[line]);
+        retain(lineWords[line]);
+    }
+}
+
+void IdentifierIndex::onContentsChange(int position, int removed, int added) {
+    Q_UNUSED(removed)
+    if (!enabled) {
+        return;
+    }
+
+    const LineChange change = LineChange::of(doc, position, added, int(lineWords.size()));
+    if (!change.valid) {
+        resync();
+        return;
+    }
+    const int start = change.start;
+    const int oldEnd = change.oldEnd;
+    const int newEnd = change.newEnd;
+    const int delta = change.delta;
+
+    QVector<QVector<QString>> fresh(newEnd - start + 1);
+    QTextBlock block = change.first;
+    for (int i = 0; i < fresh.size(); ++i, block = block.next()) {
+        scanLine(block.text(), fresh[i]);
+    }
+
+    // The highlighter's format updates arrive here too, nothing to count then
+    if (delta == 0 && std::equal(fresh.cbegin(), fresh.cend(), lineWords.cbegin() + start)) {
+        return;
+    }
+
+    for (int i = start; i <= oldEnd; ++i) {
+        release(lineWords.at(i));
+    }
+    for (QVector<QString> &words : fresh) {
+        retain(words);
+    }
+
+    const int common = qMin(oldEnd, newEnd) - start + 1;
+    for (int i = 0; i < common; ++i) {
+        lineWords[start + i] = std::move(fresh[i]);
+    }
+    if (delta > 0) {
+        lineWords.insert(start + common, delta, QVector<QString>());
+        for (int i = 0; i < delta; ++i) {
+            lineWords[start + common + i] = std::move(fresh[common + i]);
+        }
+    } else if (delta < 0) {
+        lineWords.remove(start + common, -delta);
+    }
+}
+
+int IdentifierIndex::occurrences(const QString &word) const {
+    const auto it = counts.find(word);
+    return it != counts.end() ? it->count : 0;
+}
+
+void IdentifierIndex::collect(const FuzzyMatcher &matcher, FuzzyTopK &top) const {
+    if (!enabled || matcher.isEmpty()) {
+        return;
+    }
+
+    const QString typed = matcher.query();
+    for (auto it = counts.cbegin(); it != counts.cend(); ++it) {
+        // The word being typed is in the document too
+        if (it->count == 1 && it.key() == typed) {
+            continue;
+        }
+        const int score = matcher.score(it.key(), it->mask);
+        if (score >= 0) {
+            // Two points per doubling, capped so a frequent word can't beat a much better match
+            top.offer(it.key(), score + qMin(12, 2 * (31 - qCountLeadingZeroBits(quint32(it->count)))));
+        }
+    }
+}
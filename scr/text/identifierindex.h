@@ -0,0 +1,61 @@
+#ifndef IDENTIFIERINDEX_H
+#define IDENTIFIERINDEX_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+
+class QTextDocument;
+class FuzzyMatcher;
+class FuzzyTopK;
+
+// Every identifier in a document with how often it occurs, for completion.
+// Kept current from contentsChange: an edit only rescans the lines it
+// touched and adjusts the counts, the document is never read as a whole.
+class IdentifierIndex : public QObject {
+    Q_OBJECT
+
+public:
+    explicit IdentifierIndex(QTextDocument *document, QObject *parent = nullptr);
+
+    // Disabled indexes drop everything and ignore edits (large files)
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled; }
+
+    // Every identifier matching into `top`, frequent ones get a bonus.
+    // The word being typed doesn't suggest itself.
+    void collect(const FuzzyMatcher &matcher, FuzzyTopK &top) const;
+
+    int occurrences(const QString &word) const;
+    int wordCount() const { return int(counts.size()); }
+
+    // Shorter words aren't worth completing
+    static constexpr int minWordLength = 2;
+
+private slots:
+    void onContentsChange(int position, int removed, int added);
+
+private:
+    struct Word {
+        int count = 0;
+        quint32 mask = 0;  // FuzzyMatcher::charMask, rules most words out unread
+    };
+
+    static void scanLine(const QString &text, QVector<QString> &words);
+
+    void resync();
+    // Counts the words in and points them at the hash's own copy of the string
+    void retain(QVector<QString> &words);
+    void release(const QVector<QString> &words);
+
+    QTextDocument *doc;
+    bool enabled = true;
+
+    // Identifiers of each line as of the last contentsChange
+    QVector<QVector<QString>> lineWords;
+    QHash<QString, Word> counts;
+};
+
+#endif // IDENTIFIERINDEX_H
@@ -0,0 +1,434 @@
+#include "largefileedit.h"
+#include "textcodec.h"
+#include <QScrollBar>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QGuiApplication>
+#include <QClipboard>
+#include <QtConcurrent/QtConcurrentRun>
+
+LargeFileEdit::LargeFileEdit(QWidget *parent)
+    : LineView(parent)
+{
+    viewport()->setCursor(Qt::IBeamCursor);
+}
+
+LargeFileEdit::~LargeFileEdit()
+{
+    // The worker posts to this object; what was asked for still gets written
+    m_work.waitForFinished();
+    if (m_running) {
+        m_table.finishSave(*m_running);
+    }
+    if (m_queued) {
+        m_table.save(*m_queued);
+    }
+}
+
+bool LargeFileEdit::openFile(const QString &path, QString *error)
+{
+    if (!m_table.load(path, error)) {
+        return false;
+    }
+
+    // New lines get whatever the file uses
+    const QByteArray first = m_table.read(0, qMin<qint64>(m_table.size(), maxLineBytes));
+    const int newline = first.indexOf('\n');
+    m_lineBreak = newline > 0 && first.at(newline - 1) == '\r' ? "\r\n" : "\n";
+
+    m_undo.clear();
+    m_redo.clear();
+    m_savedRevision = m_table.revision();
+    m_modified = false;
+    m_cursorLine = 0;
+    m_cursorColumn = 0;
+    m_maxWidth = 0;
+    updateScrollBars();
+    viewport()->update();
+    return true;
+}
+
+void LargeFileEdit::saveFile(const QString &path)
+{
+    if (m_saving) {
+        // Two renames racing could leave the older text
+        m_queued = path;
+        return;
+    }
+    startSave(path);
+}
+
+void LargeFileEdit::startSave(const QString &path)
+{
+    m_saving = true;
+    m_running = m_table.beginSave(path);
+    const PieceTable::SaveJob started = *m_running;
+    m_work = QtConcurrent::run([this, started]() {
+        PieceTable::SaveJob job = started;
+        const bool ok = PieceTable::write(job);
+        QMetaObject::invokeMethod(this, [this, job, ok]() {
+            saveDone(job, ok);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void LargeFileEdit::saveDone(PieceTable::SaveJob job, bool ok)
+{
+    m_running.reset();
+    QString error = job.error;
+    const bool edited = m_table.revision() != job.revision;
+    // Without edits meanwhile the table starts over on the new file, undo too;
+    // with some, they and the snapshots are moved onto it
+    if (ok && m_table.finishSave(job, &m_undo, &m_redo, &error)) {
+        m_savedRevision = edited ? job.revision : m_table.revision();
+        m_typing = false;
+        updateModified();
+        viewport()->update();
+        emit saved(job.path);
+    } else {
+        // The table may have lost its text if the saved file wouldn't map
+        moveCursor(m_cursorLine, m_cursorColumn);
+        endEdit();
+        emit saveFailed(job.path, error);
+    }
+
+    if (m_queued) {
+        const QString next = *m_queued;
+        m_queued.reset();
+        startSave(next);
+    } else {
+        m_saving = false;
+        emit saveIdle();
+    }
+}
+
+// Decoding and column to byte mapping walk the bytes the same way, one
+// TextCodec::utf8Char at a time. Re-encoding the text instead would move
+// every invalid byte (cp1251 data, a line cut mid-character) to the 3 bytes
+// of U+FFFD and edits would land in the wrong place.
+QString LargeFileEdit::lineText(int line) const
+{
+    const QByteArray bytes = m_table.line(line, maxLineBytes);
+    QString text;
+    text.reserve(bytes.size());
+    for (qsizetype i = 0; i < bytes.size();) {
+        char32_t code = 0;
+        i += TextCodec::utf8Char(bytes.constData() + i, bytes.size() - i, &code);
+        if (code >= 0x10000) {
+            text += QChar(QChar::highSurrogate(code));
+            text += QChar(QChar::lowSurrogate(code));
+        } else {
+            text += QChar(char16_t(code));
+        }
+    }
+    return text;
+}
+
+qint64 LargeFileEdit::positionOf(int line, int column) const
+{
+    const QByteArray bytes = m_table.line(line, maxLineBytes);
+    qsizetype i = 0;
+    int units = 0;
+    while (i < bytes.size() && units < column) {
+        char32_t code = 0;
+        const int length = TextCodec::utf8Char(bytes.constData() + i, bytes.size() - i, &code);
+        const int width = code >= 0x10000 ? 2 : 1;
+        if (units + width > column) {
+            break;  // between the halves of a surrogate pair: the character's start
+        }
+        units += width;
+        i += length;
+    }
+    return m_table.lineStart(line) + i;
+}
+
+void LargeFileEdit::beginEdit(bool typing)
+{
+    if (!typing || !m_typing) {
+        m_undo.append(m_table.snapshot());
+        if (m_undo.size() > maxUndo) {
+            m_undo.remove(0, m_undo.size() - maxUndo);
+        }
+    }
+    m_typing = typing;
+    m_redo.clear();
+}
+
+void LargeFileEdit::updateModified()
+{
+    const bool modified = m_table.revision() != m_savedRevision;
+    if (modified != m_modified) {
+        m_modified = modified;
+        emit modificationChanged(m_modified);
+    }
+}
+
+void LargeFileEdit::endEdit()
+{
+    updateModified();
+    updateScrollBars();
+    ensureCursorVisible();
+    viewport()->update();
+    emit cursorPositionChanged();
+}
+
+void LargeFileEdit::insertText(const QString &text)
+{
+    if (text.isEmpty()) {
+        return;
+    }
+    const bool typing = text.size() == 1 && text.at(0) != QLatin1Char('\n');
+    beginEdit(typing);
+
+    QString normalized = text;
+    normalized.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+    QByteArray bytes = normalized.toUtf8();
+    if (m_lineBreak != "\n") {
+        bytes.replace('\n', m_lineBreak);
+    }
+    m_table.insert(positionOf(m_cursorLine, m_cursorColumn), bytes);
+
+    // Cursor after the inserted text
+    const QStringList lines = normalized.split(QLatin1Char('\n'));
+    if (lines.size() == 1) {
+        m_cursorColumn += lines.first().size();
+    } else {
+        m_cursorLine += int(lines.size()) - 1;
+        m_cursorColumn = lines.last().size();
+    }
+    endEdit();
+}
+
+void LargeFileEdit::deleteBackward()
+{
+    if (m_cursorColumn > 0) {
+        beginEdit(false);
+        const qint64 end = positionOf(m_cursorLine, m_cursorColumn);
+        const qint64 start = positionOf(m_cursorLine, m_cursorColumn - 1);
+        m_table.remove(start, end - start);
+        --m_cursorColumn;
+    } else if (m_cursorLine > 0) {
+        // Join with the line above, its break may be "\r\n"
+        beginEdit(false);
+        const int previousLength = lineText(m_cursorLine - 1).size();
+        const qint64 start = positionOf(m_cursorLine - 1, previousLength);
+        m_table.remove(start, m_table.lineStart(m_cursorLine) - start);
+        --m_cursorLine;
+        m_cursorColumn = previousLength;
+    } else {
+        return;
+    }
+    endEdit();
+}
+
+void LargeFileEdit::deleteForward()
+{
+    const int length = lineText(m_cursorLine).size();
+    const qint64 start = positionOf(m_cursorLine, m_cursorColumn);
+    qint64 end;
+    if (m_cursorColumn < length) {
+        end = positionOf(m_cursorLine, m_cursorColumn + 1);
+    } else if (m_cursorLine + 1 < lineCount()) {
+        end = m_table.lineStart(m_cursorLine + 1);
+    } else {
+        return;
+    }
+    beginEdit(false);
+    m_table.remove(start, end - start);
+    endEdit();
+}
+
+void LargeFileEdit::undo()
+{
+    if (m_undo.isEmpty()) {
+        return;
+    }
+    m_redo.append(m_table.snapshot());
+    m_table.restore(m_undo.takeLast());
+    m_typing = false;
+    moveCursor(m_cursorLine, m_cursorColumn);
+    endEdit();
+}
+
+void LargeFileEdit::redo()
+{
+    if (m_redo.isEmpty()) {
+        return;
+    }
+    m_undo.append(m_table.snapshot());
+    m_table.restore(m_redo.takeLast());
+    m_typing = false;
+    moveCursor(m_cursorLine, m_cursorColumn);
+    endEdit();
+}
+
+void LargeFileEdit::moveCursor(int line, int column)
+{
+    m_cursorLine = qBound(0, line, lineCount() - 1);
+    m_cursorColumn = qBound(0, column, int(lineText(m_cursorLine).size()));
+}
+
+void LargeFileEdit::goToLine(int line)
+{
+    m_typing = false;
+    moveCursor(line, 0);
+    verticalScrollBar()->setValue(m_cursorLine - visibleLines() / 2);
+    viewport()->update();
+    emit cursorPositionChanged();
+}
+
+void LargeFileEdit::ensureCursorVisible()
+{
+    scrollToLine(m_cursorLine);
+
+    const int x = fontMetrics().horizontalAdvance(lineText(m_cursorLine).left(m_cursorColumn));
+    const int textWidth = viewport()->width() - gutterWidth() - 8;
+    QScrollBar *hbar = horizontalScrollBar();
+    if (x > m_maxWidth) {
+        m_maxWidth = x;
+        updateScrollBars();
+    }
+    if (x < hbar->value()) {
+        hbar->setValue(x);
+    } else if (x > hbar->value() + textWidth) {
+        hbar->setValue(x - textWidth);
+    }
+}
+
+QStringList LargeFileEdit::lineTexts(int first, int count) const
+{
+    QStringList texts;
+    const int last = qMin(lineCount(), first + count);
+    for (int line = first; line < last; ++line) {
+        texts.append(lineText(line));
+    }
+    return texts;
+}
+
+int LargeFileEdit::caretColumn() const
+{
+    return hasFocus() ? m_cursorColumn : -1;
+}
+
+void LargeFileEdit::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton) {
+        LineView::mousePressEvent(event);
+        return;
+    }
+
+    const QFontMetrics fm = fontMetrics();
+    const int line = lineAt(qRound(event->position().y()));
+    const int x = qRound(event->position().x()) - gutterWidth() - 4 + horizontalScrollBar()->value();
+
+    // Nearest character boundary
+    const QString text = lineText(qMin(line, lineCount() - 1));
+    int column = 0;
+    int advance = 0;
+    while (column < text.size()) {
+        const int w = fm.horizontalAdvance(text.at(column));
+        if (advance + w / 2 > x) {
+            break;
+        }
+        advance += w;
+        ++column;
+    }
+
+    m_typing = false;
+    moveCursor(line, column);
+    viewport()->update();
+    emit cursorPositionChanged();
+}
+
+bool LargeFileEdit::focusNextPrevChild(bool next)
+{
+    Q_UNUSED(next)
+    return false;
+}
+
+void LargeFileEdit::keyPressEvent(QKeyEvent *event)
+{
+    const bool ctrl = event->modifiers() & Qt::ControlModifier;
+    const int line = m_cursorLine;
+    const int column = m_cursorColumn;
+
+    if (event->matches(QKeySequence::Undo)) {
+        undo();
+        return;
+    }
+    if (event->matches(QKeySequence::Redo)) {
+        redo();
+        return;
+    }
+    if (event->matches(QKeySequence::Paste)) {
+        insertText(QGuiApplication::clipboard()->text());
+        return;
+    }
+
+    switch (event->key()) {
+    case Qt::Key_Left:
+        if (column > 0) {
+            moveCursor(line, column - 1);
+        } else if (line > 0) {
+            moveCursor(line - 1, int(lineText(line - 1).size()));
+        }
+        break;
+    case Qt::Key_Right:
+        if (column < lineText(line).size()) {
+            moveCursor(line, column + 1);
+        } else if (line + 1 < lineCount()) {
+            moveCursor(line + 1, 0);
+        }
+        break;
+    case Qt::Key_Up:
+        moveCursor(line - 1, column);
+        break;
+    case Qt::Key_Down:
+        moveCursor(line + 1, column);
+        break;
+    case Qt::Key_PageUp:
+        moveCursor(line - visibleLines(), column);
+        break;
+    case Qt::Key_PageDown:
+        moveCursor(line + visibleLines(), column);
+        break;
+    case Qt::Key_Home:
+        moveCursor(ctrl ? 0 : line, 0);
+        break;
+    case Qt::Key_End:
+        if (ctrl) {
+            moveCursor(lineCount() - 1, maxLineBytes);
+        } else {
+            moveCursor(line, maxLineBytes);
+        }
+        break;
+    case Qt::Key_Backspace:
+        deleteBackward();
+        return;
+    case Qt::Key_Delete:
+        deleteForward();
+        return;
+    case Qt::Key_Return:
+    case Qt::Key_Enter:
+        insertText(QStringLiteral("\n"));
+        return;
+    case Qt::Key_Tab:
+        insertText(QStringLiteral("    "));
+        return;
+    default: {
+        const QString text = event->text();
+        if (!ctrl && !text.isEmpty() && text.at(0).isPrint()) {
+            insertText(text);
+            return;
+        }
+        LineView::keyPressEvent(event);
+        return;
+    }
+    }
+
+    // Only cursor movement gets here
+    m_typing = false;
+    ensureCursorVisible();
+    viewport()->update();
+    emit cursorPositionChanged();
+}
@@ -0,0 +1,94 @@
+#ifndef LARGEFILEEDIT_H
+#define LARGEFILEEDIT_H
+
+#include <QFuture>
+#include <QVector>
+#include <optional>
+#include "lineview.h"
+#include "piecetable.h"
+
+// Plain editor for files QTextDocument can't hold, over a PieceTable. Only
+// the lines on screen are ever read and decoded (as UTF-8), nothing is laid
+// out ahead. No highlighting, completion or selection: view, scroll, type,
+// undo, save.
+class LargeFileEdit : public LineView {
+    Q_OBJECT
+
+public:
+    explicit LargeFileEdit(QWidget *parent = nullptr);
+
+    ~LargeFileEdit();
+
+    bool openFile(const QString &path, QString *error = nullptr);
+    // Written on a worker, saved() or saveFailed() follows; typing goes on
+    // meanwhile. Saving again before that queues the newest path.
+    void saveFile(const QString &path);
+    bool isSaving() const { return m_saving; }
+
+    bool isModified() const { return m_modified; }
+    int lineCount() const override { return m_table.lineCount(); }
+    qint64 size() const { return m_table.size(); }
+
+    int cursorLine() const { return m_cursorLine; }
+    int cursorColumn() const { return m_cursorColumn; }
+    void goToLine(int line);
+
+    // Longer lines are shown and edited up to here only
+    static constexpr int maxLineBytes = 64 * 1024;
+
+signals:
+    void modificationChanged(bool modified);
+    void cursorPositionChanged();
+    void saved(const QString &path);
+    void saveFailed(const QString &path, const QString &error);
+    // Nothing running or queued anymore
+    void saveIdle();
+
+protected:
+    QStringList lineTexts(int first, int count) const override;
+    int caretColumn() const override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    // Tab is text here, not focus movement
+    bool focusNextPrevChild(bool next) override;
+
+private:
+    void startSave(const QString &path);
+    void saveDone(PieceTable::SaveJob job, bool ok);
+
+    QString lineText(int line) const;
+    // Byte position of a column (in QChars) of a line
+    qint64 positionOf(int line, int column) const;
+
+    void insertText(const QString &text);
+    void deleteBackward();
+    void deleteForward();
+    void undo();
+    void redo();
+    // Snapshot for undo, typed characters share one
+    void beginEdit(bool typing);
+    void endEdit();
+    void updateModified();
+
+    void moveCursor(int line, int column);
+    void ensureCursorVisible();
+
+    PieceTable m_table;
+    QVector<PieceTable::Snapshot> m_undo;
+    QVector<PieceTable::Snapshot> m_redo;
+    bool m_typing = false;
+    quint64 m_savedRevision = 0;
+    bool m_modified = false;
+    QByteArray m_lineBreak = "\n";
+
+    bool m_saving = false;
+    QFuture<void> m_work;
+    std::optional<PieceTable::SaveJob> m_running;  // finished by the destructor if it has to
+    std::optional<QString> m_queued;
+
+    int m_cursorColumn = 0;
+
+    static constexpr int maxUndo = 500;
+};
+
+#endif // LARGEFILEEDIT_H
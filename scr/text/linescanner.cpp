@@ -0,0 +1,69 @@
+#include "linescanner.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MALACHITE_LINES_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace LineScanner {
+
+qint64 scan(const char *data, qint64 from, qint64 to, qint64 firstNumber, int stride, QVector<qint64> &marks)
+{
+    qint64 number = firstNumber;
+    qint64 i = from;
+#ifdef MALACHITE_LINES_SSE2
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= to; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        uint mask = uint(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+        if (!mask) {
+            continue;
+        }
+        const int found = qPopulationCount(mask);
+        // Walk the bits only when a marked number falls in this chunk
+        const qint64 nextMark = (number + stride - 1) / stride * stride;
+        if (nextMark >= number + found) {
+            number += found;
+            continue;
+        }
+        for (; mask; mask &= mask - 1, ++number) {
+            if (number % stride == 0) {
+                marks.append(i + qCountTrailingZeroBits(mask));
+            }
+        }
+    }
+#endif
+    for (; i < to; ++i) {
+        if (data[i] == '\n') {
+            if (number % stride == 0) {
+                marks.append(i);
+            }
+            ++number;
+        }
+    }
+    return number;
+}
+
+qint64 count(const char *data, qint64 from, qint64 to)
+{
+    return std::count(data + from, data + to, '\n');
+}
+
+qint64 find(const char *data, qint64 from, qint64 to, qint64 n)
+{
+    const char *end = data + to;
+    for (const char *p = data + from; p < end; ++p) {
+        p = static_cast<const char *>(std::memchr(p, '\n', size_t(end - p)));
+        if (!p) {
+            return -1;
+        }
+        if (n-- == 0) {
+            return p - data;
+        }
+    }
+    return -1;
+}
+
+} // namespace LineScanner
@@ -0,0 +1,26 @@
+#ifndef LINESCANNER_H
+#define LINESCANNER_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// Newline scanning over raw file bytes, 16 bytes per step where SSE2 is
+// there. Used to index mapped files without keeping every line start: only
+// each stride-th newline is recorded, the rest is found again by scanning
+// at most stride lines.
+namespace LineScanner {
+
+// Scans [from, to) of data. Newlines are numbered on from `firstNumber`,
+// the position of each one whose number is a multiple of `stride` goes to
+// `marks`. Returns the number after the last newline found.
+qint64 scan(const char *data, qint64 from, qint64 to, qint64 firstNumber, int stride, QVector<qint64> &marks);
+
+// Newlines in [from, to)
+qint64 count(const char *data, qint64 from, qint64 to);
+
+// Position of the n-th (0-based) newline at or after `from`, -1 if none before `to`
+qint64 find(const char *data, qint64 from, qint64 to, qint64 n);
+
+} // namespace LineScanner
+
+#endif // LINESCANNER_H
@@ -0,0 +1,108 @@
+#include "lineview.h"
+#include <QPainter>
+#include <QScrollBar>
+
+LineView::LineView(QWidget *parent)
+    : QAbstractScrollArea(parent)
+{
+    QFont font("Consolas");
+    font.setStyleHint(QFont::Monospace);
+    font.setPixelSize(14);
+    setFont(font);
+
+    setFocusPolicy(Qt::StrongFocus);
+    verticalScrollBar()->setSingleStep(1);
+    horizontalScrollBar()->setSingleStep(fontMetrics().horizontalAdvance(QLatin1Char(' ')));
+}
+
+int LineView::visibleLines() const
+{
+    return qMax(1, viewport()->height() / fontMetrics().height());
+}
+
+int LineView::gutterWidth() const
+{
+    const int digits = QString::number(lineCount()).size();
+    return fontMetrics().horizontalAdvance(QLatin1Char('9')) * digits + 16;
+}
+
+int LineView::lineAt(int y) const
+{
+    return verticalScrollBar()->value() + y / fontMetrics().height();
+}
+
+void LineView::updateScrollBars()
+{
+    verticalScrollBar()->setRange(0, qMax(0, lineCount() - visibleLines()));
+    verticalScrollBar()->setPageStep(visibleLines());
+    const int textWidth = viewport()->width() - gutterWidth();
+    horizontalScrollBar()->setRange(0, qMax(0, m_maxWidth - textWidth + 20));
+    horizontalScrollBar()->setPageStep(qMax(1, textWidth));
+}
+
+void LineView::scrollToLine(int line)
+{
+    QScrollBar *bar = verticalScrollBar();
+    if (line < bar->value()) {
+        bar->setValue(line);
+    } else if (line >= bar->value() + visibleLines()) {
+        bar->setValue(line - visibleLines() + 1);
+    }
+}
+
+void LineView::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void LineView::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event)
+    QPainter painter(viewport());
+    const QFontMetrics fm = fontMetrics();
+    const int lineHeight = fm.height();
+    const int gutter = gutterWidth();
+    const int width = viewport()->width();
+    const int first = verticalScrollBar()->value();
+    const int xOffset = horizontalScrollBar()->value();
+
+    painter.fillRect(viewport()->rect(), m_backgroundColor);
+    painter.fillRect(0, 0, gutter, viewport()->height(), m_gutterColor);
+
+    // Only the lines on screen are read, whatever the file size
+    const QStringList texts = lineTexts(first, visibleLines() + 1);
+    const int caret = caretColumn();
+    int widest = m_maxWidth;
+    for (int row = 0; row < texts.size(); ++row) {
+        const int line = first + row;
+        const int top = row * lineHeight;
+        const QString &text = texts.at(row);
+
+        if (line == m_cursorLine) {
+            painter.fillRect(0, top, width, lineHeight, m_currentLineColor);
+        }
+
+        painter.setPen(m_lineNumberColor);
+        painter.drawText(QRect(0, top, gutter - 8, lineHeight), Qt::AlignRight | Qt::AlignVCenter,
+                         QString::number(line + 1));
+
+        painter.save();
+        painter.setClipRect(gutter, top, width - gutter, lineHeight);
+        const int left = gutter + 4 - xOffset;
+        painter.setPen(m_textColor);
+        painter.drawText(left, top + fm.ascent(), text);
+        if (line == m_cursorLine && caret >= 0) {
+            const int x = left + fm.horizontalAdvance(text.left(caret));
+            painter.fillRect(x, top, 2, lineHeight, m_textColor);
+        }
+        painter.restore();
+
+        widest = qMax(widest, fm.horizontalAdvance(text));
+    }
+
+    if (widest != m_maxWidth) {
+        m_maxWidth = widest;
+        updateScrollBars();
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef LINEVIEW_H
+#define LINEVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QColor>
+#include <QStringList>
+
+// What LargeFileEdit and LogViewer share: a monospace view that only ever
+// reads the lines on screen, with line numbers in a gutter and a current
+// line. Subclasses say how many lines there are and hand out their text.
+class LineView : public QAbstractScrollArea {
+    Q_OBJECT
+
+public:
+    explicit LineView(QWidget *parent = nullptr);
+
+    virtual int lineCount() const = 0;
+
+protected:
+    // Up to `count` lines from `first` on, fewer at the end
+    virtual QStringList lineTexts(int first, int count) const = 0;
+    // Where the caret is drawn on the current line, -1 for nowhere
+    virtual int caretColumn() const { return -1; }
+
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+    int visibleLines() const;
+    int gutterWidth() const;
+    // Line under a viewport y
+    int lineAt(int y) const;
+    void updateScrollBars();
+    // Scrolls as little as it takes to show the line
+    void scrollToLine(int line);
+
+    int m_cursorLine = 0;
+    int m_maxWidth = 0;  // widest line painted so far
+
+    QColor m_backgroundColor = QColor(30, 30, 30);
+    QColor m_textColor = QColor(212, 212, 212);
+    QColor m_gutterColor = QColor(50, 50, 50);
+    QColor m_lineNumberColor = QColor(200, 200, 200);
+    QColor m_currentLineColor = QColor(80, 80, 120);
+};
+
+#endif // LINEVIEW_H
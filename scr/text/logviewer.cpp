@@ -0,0 +1,379 @@
+#include "logviewer.h"
+#include "linescanner.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QPainter>
+#include <QScrollBar>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QInputDialog>
+#include <QGuiApplication>
+#include <QClipboard>
+#include <QtConcurrent/QtConcurrentRun>
+#include <climits>
+#include <cstring>
+
+namespace {
+
+// A worker reports back after each of these, so the scroll range grows as it goes
+constexpr qint64 chunkBytes = 16 * 1024 * 1024;
+
+constexpr int growthCheckMs = 1000;
+
+} // namespace
+
+LogViewer::LogViewer(QWidget *parent)
+    : LineView(parent)
+{
+    connect(&m_growthTimer, &QTimer::timeout, this, &LogViewer::checkGrowth);
+}
+
+LogViewer::~LogViewer()
+{
+    // The worker reads the mapping, it has to be done before the unmap
+    stopScan();
+}
+
+bool LogViewer::openFile(const QString &path, QString *error)
+{
+    stopScan();
+    m_growthTimer.stop();
+
+    auto file = std::make_unique<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly)) {
+        if (error) {
+            *error = file->errorString();
+        }
+        return false;
+    }
+    m_file = std::move(file);
+    m_data = nullptr;
+    m_size = 0;
+    if (!map(m_file->size())) {
+        if (error) {
+            *error = m_file->errorString();
+        }
+        m_file.reset();
+        return false;
+    }
+
+    m_marks.clear();
+    m_newlines = 0;
+    m_indexedTo = 0;
+    m_cursorLine = 0;
+    m_maxWidth = 0;
+
+    // Nothing waits for the index: the top of the file paints right away
+    startScan();
+    updateScrollBars();
+    viewport()->update();
+    m_growthTimer.start(growthCheckMs);
+    return true;
+}
+
+bool LogViewer::map(qint64 size)
+{
+    uchar *old = reinterpret_cast<uchar *>(const_cast<char *>(m_data));
+    uchar *data = size > 0 ? m_file->map(0, size) : nullptr;
+    if (size > 0 && !data) {
+        return false;
+    }
+    if (old) {
+        m_file->unmap(old);
+    }
+    m_data = reinterpret_cast<const char *>(data);
+    m_size = size;
+    return true;
+}
+
+void LogViewer::startScan()
+{
+    if (m_indexedTo >= m_size) {
+        return;
+    }
+
+    m_scanning = true;
+    m_cancel = std::make_shared<std::atomic_bool>(false);
+    const std::shared_ptr<std::atomic_bool> cancel = m_cancel;
+    const char *data = m_data;
+    const qint64 from = m_indexedTo;
+    const qint64 to = m_size;
+    const qint64 firstNumber = m_newlines;
+    const int generation = m_generation;
+
+    const QString path = m_file->fileName();
+
+    // Chunks are posted to this object; stopScan() waits for the worker,
+    // and Qt drops whatever is still queued if this object goes away
+    m_scan = QtConcurrent::run([this, cancel, data, from, to, firstNumber, generation, path]() {
+        qint64 number = firstNumber;
+        for (qint64 begin = from; begin < to && !*cancel; begin += chunkBytes) {
+            Chunk chunk;
+            chunk.to = qMin(to, begin + chunkBytes);
+            if (QFileInfo(path).size() < chunk.to) {
+                // Truncated under the scan, the rest of the mapping is gone
+                QMetaObject::invokeMethod(this, [this, generation]() {
+                    if (generation == m_generation) {
+                        restart();
+                    }
+                }, Qt::QueuedConnection);
+                return;
+            }
+            const qint64 next = LineScanner::scan(data, begin, chunk.to, number, indexStride, chunk.marks);
+            chunk.newlines = next - number;
+            number = next;
+            const bool last = chunk.to == to;
+            QMetaObject::invokeMethod(this, [this, chunk, last, generation]() {
+                applyChunk(chunk, last, generation);
+            }, Qt::QueuedConnection);
+        }
+    });
+}
+
+void LogViewer::stopScan()
+{
+    if (m_cancel) {
+        *m_cancel = true;
+    }
+    m_scan.waitForFinished();
+    m_scanning = false;
+    ++m_generation;
+}
+
+void LogViewer::applyChunk(const Chunk &chunk, bool last, int generation)
+{
+    if (generation != m_generation) {
+        return;
+    }
+
+    m_marks += chunk.marks;
+    m_newlines += chunk.newlines;
+    m_indexedTo = chunk.to;
+    if (last) {
+        m_scanning = false;
+    }
+
+    updateScrollBars();
+    if (m_following) {
+        m_cursorLine = lineCount() - 1;
+        verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+    }
+    emit indexProgress(m_size > 0 ? int(m_indexedTo * 100 / m_size) : 100);
+    viewport()->update();
+}
+
+void LogViewer::checkGrowth()
+{
+    if (!m_file || m_scanning) {
+        return;
+    }
+
+    const qint64 size = QFileInfo(m_file->fileName()).size();
+    if (size == m_size) {
+        return;
+    }
+    if (size < m_size) {
+        restart();
+        return;
+    }
+
+    if (map(size)) {
+        startScan();
+    }
+}
+
+void LogViewer::checkTruncation()
+{
+    if (m_file && QFileInfo(m_file->fileName()).size() < m_size) {
+        restart();
+    }
+}
+
+void LogViewer::restart()
+{
+    const QString path = m_file->fileName();
+    const bool follow = m_following;
+
+    // Truncated or rotated. Whatever comes next, the old mapping is longer
+    // than the file and mustn't be read again.
+    stopScan();
+    m_file.reset();
+    m_data = nullptr;
+    m_size = 0;
+    m_marks.clear();
+    m_newlines = 0;
+    m_indexedTo = 0;
+
+    if (openFile(path)) {
+        setFollowing(follow);
+    } else {
+        updateScrollBars();
+        viewport()->update();
+    }
+}
+
+int LogViewer::lineCount() const
+{
+    return int(qMin<qint64>(m_newlines + 1, INT_MAX));
+}
+
+qint64 LogViewer::lineStart(int line) const
+{
+    if (line <= 0) {
+        return 0;
+    }
+    const qint64 n = line - 1;  // the newline ending the line before
+    if (n >= m_newlines) {
+        return -1;
+    }
+    const qint64 from = m_marks.at(n / indexStride);
+    const qint64 rest = n % indexStride;
+    const qint64 position = rest == 0 ? from : LineScanner::find(m_data, from + 1, m_size, rest - 1);
+    return position < 0 ? -1 : position + 1;
+}
+
+QString LogViewer::lineText(qint64 start, qint64 *next) const
+{
+    const void *found = std::memchr(m_data + start, '\n', size_t(m_size - start));
+    const qint64 end = found ? static_cast<const char *>(found) - m_data : m_size;
+    *next = found ? end + 1 : m_size + 1;
+
+    qint64 length = qMin<qint64>(end - start, maxLineBytes);
+    if (length > 0 && end - start <= maxLineBytes && m_data[start + length - 1] == '\r') {
+        --length;
+    }
+    return QString::fromUtf8(m_data + start, int(length));
+}
+
+void LogViewer::setFollowing(bool follow)
+{
+    m_following = follow;
+    if (m_following) {
+        m_cursorLine = lineCount() - 1;
+        verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+        viewport()->update();
+        emit cursorPositionChanged();
+    }
+}
+
+void LogViewer::goToLine(int line)
+{
+    m_following = false;
+    m_cursorLine = qBound(0, line, lineCount() - 1);
+    verticalScrollBar()->setValue(m_cursorLine - visibleLines() / 2);
+    viewport()->update();
+    emit cursorPositionChanged();
+}
+
+void LogViewer::scrollContentsBy(int dx, int dy)
+{
+    Q_UNUSED(dx)
+    // Scrolling up leaves the end of the file
+    if (dy > 0) {
+        m_following = false;
+    }
+    viewport()->update();
+}
+
+QStringList LogViewer::lineTexts(int first, int count) const
+{
+    QStringList texts;
+    // One index lookup, then line by line from there
+    qint64 position = m_data ? lineStart(first) : -1;
+    for (int line = first; position >= 0 && position <= m_size && line < first + count; ++line) {
+        if (position == m_size && line >= lineCount()) {
+            break;
+        }
+        qint64 next = 0;
+        texts.append(lineText(position, &next));
+        position = next;
+    }
+    return texts;
+}
+
+void LogViewer::paintEvent(QPaintEvent *event)
+{
+    checkTruncation();
+    LineView::paintEvent(event);
+
+    if (m_scanning) {
+        QPainter painter(viewport());
+        const QString progress = QString("Indexing %1%").arg(m_size > 0 ? m_indexedTo * 100 / m_size : 100);
+        painter.setPen(m_lineNumberColor);
+        painter.drawText(viewport()->rect().adjusted(0, 4, -8, 0), Qt::AlignRight | Qt::AlignTop, progress);
+    }
+}
+
+void LogViewer::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton) {
+        LineView::mousePressEvent(event);
+        return;
+    }
+    m_cursorLine = qBound(0, lineAt(qRound(event->position().y())), lineCount() - 1);
+    viewport()->update();
+    emit cursorPositionChanged();
+}
+
+void LogViewer::keyPressEvent(QKeyEvent *event)
+{
+    const bool ctrl = event->modifiers() & Qt::ControlModifier;
+    int line = m_cursorLine;
+
+    if (event->matches(QKeySequence::Copy)) {
+        checkTruncation();
+        const qint64 start = m_data ? lineStart(m_cursorLine) : -1;
+        if (start >= 0 && start <= m_size) {
+            qint64 next = 0;
+            QGuiApplication::clipboard()->setText(lineText(start, &next));
+        }
+        return;
+    }
+    if (ctrl && event->key() == Qt::Key_G) {
+        bool ok = false;
+        const int target = QInputDialog::getInt(this, "Go to Line", "Line:", m_cursorLine + 1, 1, lineCount(), 1, &ok);
+        if (ok) {
+            goToLine(target - 1);
+        }
+        return;
+    }
+
+    switch (event->key()) {
+    case Qt::Key_Up:
+        --line;
+        break;
+    case Qt::Key_Down:
+        ++line;
+        break;
+    case Qt::Key_PageUp:
+        line -= visibleLines();
+        break;
+    case Qt::Key_PageDown:
+        line += visibleLines();
+        break;
+    case Qt::Key_Home:
+        line = 0;
+        break;
+    case Qt::Key_End:
+        setFollowing(true);
+        return;
+    case Qt::Key_F:
+        setFollowing(!m_following);
+        return;
+    case Qt::Key_Left:
+        horizontalScrollBar()->triggerAction(QAbstractSlider::SliderSingleStepSub);
+        return;
+    case Qt::Key_Right:
+        horizontalScrollBar()->triggerAction(QAbstractSlider::SliderSingleStepAdd);
+        return;
+    default:
+        LineView::keyPressEvent(event);
+        return;
+    }
+
+    m_following = false;
+    m_cursorLine = qBound(0, line, lineCount() - 1);
+    scrollToLine(m_cursorLine);
+    viewport()->update();
+    emit cursorPositionChanged();
+}
@@ -0,0 +1,92 @@
+#ifndef LOGVIEWER_H
+#define LOGVIEWER_H
+
+#include <QFuture>
+#include <QTimer>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include "lineview.h"
+
+class QFile;
+
+// Read-only view of files of any size: the file is mapped, lines are
+// indexed on a worker thread (LineScanner, every indexStride-th newline)
+// while the top of the file is already on screen, and only visible lines
+// are decoded. Follows files that are still being written, like tail -f.
+//
+// Ctrl+G jumps to a line, F or Ctrl+End turns following on, scrolling up
+// turns it off.
+class LogViewer : public LineView {
+    Q_OBJECT
+
+public:
+    explicit LogViewer(QWidget *parent = nullptr);
+    ~LogViewer();
+
+    bool openFile(const QString &path, QString *error = nullptr);
+
+    // Lines indexed so far, all of them once isIndexing() is false
+    int lineCount() const override;
+    bool isIndexing() const { return m_scanning; }
+    void goToLine(int line);
+
+    void setFollowing(bool follow);
+    bool isFollowing() const { return m_following; }
+
+    static constexpr int indexStride = 64;
+    static constexpr int maxLineBytes = 64 * 1024;
+
+signals:
+    void indexProgress(int percent);
+    void cursorPositionChanged();
+
+protected:
+    QStringList lineTexts(int first, int count) const override;
+    void paintEvent(QPaintEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+
+private slots:
+    void checkGrowth();
+
+private:
+    struct Chunk {
+        qint64 to = 0;
+        qint64 newlines = 0;
+        QVector<qint64> marks;
+    };
+
+    bool map(qint64 size);
+    void startScan();
+    void applyChunk(const Chunk &chunk, bool last, int generation);
+    void stopScan();
+    // Reading the mapping past the end of the file is SIGBUS. Everything
+    // that reads it first checks the file didn't shrink (copytruncate
+    // rotation), the timer alone would be a second late.
+    void checkTruncation();
+    void restart();
+
+    qint64 lineStart(int line) const;
+    QString lineText(qint64 start, qint64 *next) const;
+
+    std::unique_ptr<QFile> m_file;
+    const char *m_data = nullptr;
+    qint64 m_size = 0;
+
+    // Index of [0, m_indexedTo): newline count and every indexStride-th position
+    QVector<qint64> m_marks;
+    qint64 m_newlines = 0;
+    qint64 m_indexedTo = 0;
+
+    QFuture<void> m_scan;
+    std::shared_ptr<std::atomic_bool> m_cancel;
+    bool m_scanning = false;
+    int m_generation = 0;  // chunks of a stopped scan are dropped
+
+    QTimer m_growthTimer;
+    bool m_following = false;
+};
+
+#endif // LOGVIEWER_H
@@ -0,0 +1,222 @@
+#include "minimap.h"
+#include <QAbstractTextDocumentLayout>
+#include <QCoreApplication>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPlainTextEdit>
+#include <QScrollBar>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QTextLayout>
+#include <QWheelEvent>
+
+namespace {
+
+// Tiles kept around the visible ones, for scrolling back and forth
+constexpr int keptTiles = 4;
+
+QRgb halfway(QRgb a, QRgb b) {
+    return (((a & 0xfefefe) >> 1) + ((b & 0xfefefe) >> 1)) | 0xff000000;
+}
+
+}
+
+Minimap::Minimap(QPlainTextEdit *editor)
+    : QWidget(editor)
+    , editor(editor)
+    , doc(editor->document())
+{
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setCursor(Qt::ArrowCursor);
+
+    connect(doc, &QTextDocument::contentsChange, this, &Minimap::onContentsChange);
+    // The highlighter's format updates come as contentsChange too; updateBlock
+    // is a cheap extra for blocks the layout repaints without one
+    connect(doc->documentLayout(), &QAbstractTextDocumentLayout::updateBlock, this, &Minimap::onBlockUpdated);
+    connect(doc->documentLayout(), &QAbstractTextDocumentLayout::update, this, &Minimap::invalidateAll);
+    connect(editor->verticalScrollBar(), &QScrollBar::valueChanged, this, qOverload<>(&QWidget::update));
+    connect(editor->verticalScrollBar(), &QScrollBar::rangeChanged, this, qOverload<>(&QWidget::update));
+
+    blockCount = doc->blockCount();
+    tiles.resize((blockCount + tileLines - 1) / tileLines);
+}
+
+QSize Minimap::sizeHint() const {
+    return QSize(defaultWidth, 0);
+}
+
+void Minimap::onContentsChange(int position, int removed, int added) {
+    Q_UNUSED(removed)
+    const int first = doc->findBlock(position).blockNumber();
+    const int count = doc->blockCount();
+    if (count != blockCount) {
+        // Every line below moved
+        blockCount = count;
+        tiles.resize((blockCount + tileLines - 1) / tileLines);
+        invalidate(first, -1);
+    } else {
+        invalidate(first, doc->findBlock(position + added).blockNumber());
+    }
+}
+
+void Minimap::onBlockUpdated(const QTextBlock &block) {
+    invalidate(block.blockNumber(), block.blockNumber());
+}
+
+void Minimap::invalidateAll() {
+    invalidate(0, -1);
+}
+
+void Minimap::invalidate(int first, int last) {
+    const int from = qMax(0, first / tileLines);
+    const int to = last < 0 ? int(tiles.size()) - 1 : qMin(int(tiles.size()) - 1, last / tileLines);
+    for (int i = from; i <= to; ++i) {
+        tiles[i].dirty = true;
+    }
+    update();
+}
+
+void Minimap::renderTile(int index) {
+    Tile &tile = tiles[index];
+    const QSize size(width(), tileLines * lineHeight);
+    if (tile.image.size() != size) {
+        tile.image = QImage(size, QImage::Format_RGB32);
+    }
+    const QRgb background = editor->palette().color(QPalette::Base).rgb();
+    const QRgb plain = editor->palette().color(QPalette::Text).rgb();
+    tile.image.fill(background);
+    tile.dirty = false;
+
+    // Straight into the scanlines, a pixel per character and the row below
+    // it half as strong; tabs are four columns
+    const int columns = size.width();
+    QTextBlock block = doc->findBlockByNumber(index * tileLines);
+    for (int line = 0; line < tileLines && block.isValid(); ++line, block = block.next()) {
+        const QString text = block.text();
+        const QList<QTextLayout::FormatRange> ranges = block.layout() ? block.layout()->formats()
+                                                                      : QList<QTextLayout::FormatRange>();
+        QRgb *top = reinterpret_cast<QRgb *>(tile.image.scanLine(line * lineHeight));
+        QRgb *bottom = reinterpret_cast<QRgb *>(tile.image.scanLine(line * lineHeight + 1));
+
+        int range = 0;
+        int colorRange = -1;
+        QRgb color = plain;
+        int column = 0;
+        for (int i = 0; i < text.size() && column < columns; ++i) {
+            const QChar ch = text.at(i);
+            if (ch == QLatin1Char('\t')) {
+                column = (column / 4 + 1) * 4;
+                continue;
+            }
+            if (!ch.isSpace()) {
+                while (range < ranges.size() && ranges.at(range).start + ranges.at(range).length <= i) {
+                    ++range;
+                }
+                const int current = range < ranges.size() && ranges.at(range).start <= i ? range : -1;
+                if (current != colorRange) {
+                    colorRange = current;
+                    color = plain;
+                    if (current >= 0 && ranges.at(current).format.hasProperty(QTextFormat::ForegroundBrush)) {
+                        color = ranges.at(current).format.foreground().color().rgb();
+                    }
+                }
+                top[column] = color;
+                bottom[column] = halfway(color, background);
+            }
+            ++column;
+        }
+    }
+}
+
+int Minimap::firstVisibleLine() const {
+    return doc->findBlockByLineNumber(editor->verticalScrollBar()->value()).blockNumber();
+}
+
+int Minimap::visibleLines() const {
+    return qMax(1, editor->viewport()->height() / qMax(1, editor->fontMetrics().lineSpacing()));
+}
+
+int Minimap::contentOffset() const {
+    // Longer than the minimap: it scrolls along, in proportion to the editor
+    const int overflow = blockCount * lineHeight - height();
+    if (overflow <= 0) {
+        return 0;
+    }
+    const int maxFirst = qMax(1, blockCount - visibleLines());
+    return int(qint64(overflow) * qMin(firstVisibleLine(), maxFirst) / maxFirst);
+}
+
+int Minimap::sliderTop() const {
+    return firstVisibleLine() * lineHeight - contentOffset();
+}
+
+void Minimap::scrollToSlider(int top) {
+    // The inverse of sliderTop()
+    const int lines = visibleLines();
+    int first = top / lineHeight;
+    if (blockCount * lineHeight > height()) {
+        const int maxFirst = qMax(1, blockCount - lines);
+        const int track = height() - lines * lineHeight;
+        first = track > 0 ? int(qint64(top) * maxFirst / track) : 0;
+    }
+    first = qBound(0, first, blockCount - 1);
+    editor->verticalScrollBar()->setValue(doc->findBlockByNumber(first).firstLineNumber());
+}
+
+void Minimap::paintEvent(QPaintEvent *event) {
+    QPainter painter(this);
+    painter.fillRect(event->rect(), editor->palette().color(QPalette::Base));
+
+    const int offset = contentOffset();
+    const int tilePixels = tileLines * lineHeight;
+    const int firstTile = offset / tilePixels;
+    const int lastTile = qMin(int(tiles.size()) - 1, (offset + height()) / tilePixels);
+    for (int i = firstTile; i <= lastTile; ++i) {
+        if (tiles.at(i).dirty || tiles.at(i).image.width() != width()) {
+            renderTile(i);
+        }
+        painter.drawImage(0, i * tilePixels - offset, tiles.at(i).image);
+    }
+    for (int i = 0; i < tiles.size(); ++i) {
+        if ((i < firstTile - keptTiles || i > lastTile + keptTiles) && !tiles.at(i).image.isNull()) {
+            tiles[i].image = QImage();
+            tiles[i].dirty = true;
+        }
+    }
+
+    QColor slider = editor->palette().color(QPalette::Text);
+    slider.setAlpha(40);
+    painter.fillRect(QRect(0, sliderTop(), width(), visibleLines() * lineHeight), slider);
+}
+
+void Minimap::mousePressEvent(QMouseEvent *event) {
+    if (event->button() != Qt::LeftButton) {
+        QWidget::mousePressEvent(event);
+        return;
+    }
+    // Grabbing the slider keeps it under the mouse, anywhere else centers it there
+    const int y = qRound(event->position().y());
+    const int top = sliderTop();
+    const int sliderHeight = visibleLines() * lineHeight;
+    dragOffset = y >= top && y < top + sliderHeight ? y - top : sliderHeight / 2;
+    scrollToSlider(y - dragOffset);
+    event->accept();
+}
+
+void Minimap::mouseMoveEvent(QMouseEvent *event) {
+    if (dragOffset < 0 || !(event->buttons() & Qt::LeftButton)) {
+        QWidget::mouseMoveEvent(event);
+        return;
+    }
+    scrollToSlider(qRound(event->position().y()) - dragOffset);
+    event->accept();
+}
+
+void Minimap::mouseReleaseEvent(QMouseEvent *event) {
+    dragOffset = -1;
+    QWidget::mouseReleaseEvent(event);
+}
+
+void Minimap::wheelEvent(QWheelEvent *event) {
+    QCoreApplication::sendEvent(editor->viewport(), event);
+}
@@ -0,0 +1,67 @@
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+#include <QImage>
+#include <QVector>
+#include <QWidget>
+
+class QPlainTextEdit;
+class QTextBlock;
+class QTextDocument;
+
+// Zoomed-out picture of an editor's document, one pixel per character and
+// lineHeight pixels per line, in the highlighter's colors. It is drawn in
+// tiles of tileLines lines: an edit or a re-highlight only marks the tiles
+// of the blocks it touched, and a tile is rasterized again only when it is
+// dirty and on screen. Tiles far from the view are dropped.
+//
+// Shows the editor's viewport as a slider; clicking or dragging scrolls.
+class Minimap : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit Minimap(QPlainTextEdit *editor);
+
+    QSize sizeHint() const override;
+
+    static constexpr int defaultWidth = 100;
+    static constexpr int lineHeight = 2;
+    static constexpr int tileLines = 128;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+
+private slots:
+    void onContentsChange(int position, int removed, int added);
+    void onBlockUpdated(const QTextBlock &block);
+    void invalidateAll();
+
+private:
+    struct Tile {
+        QImage image;
+        bool dirty = true;
+    };
+
+    // Marks tiles from the one of `first` to the one of `last`, -1 to the end
+    void invalidate(int first, int last);
+    void renderTile(int index);
+
+    // Where the picture and the slider are for the editor's current scroll
+    int firstVisibleLine() const;
+    int visibleLines() const;
+    int contentOffset() const;
+    int sliderTop() const;
+    void scrollToSlider(int top);
+
+    QPlainTextEdit *editor;
+    QTextDocument *doc;
+    QVector<Tile> tiles;
+    int blockCount = 0;
+    int dragOffset = -1;  // from the slider top while dragging
+};
+
+#endif // MINIMAP_H
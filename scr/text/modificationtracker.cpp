@@ -0,0 +1,107 @@
+#include "modificationtracker.h"
+#include "../parser/linechange.h"
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QHash>
+
+ModificationTracker::ModificationTracker(QTextDocument *document, QObject *parent)
+    : QObject(parent)
+    , doc(document)
+{
+    connect(doc, &QTextDocument::contentsChange, this, &ModificationTracker::onContentsChange);
+    connect(doc, &QTextDocument::modificationChanged, this, &ModificationTracker::update);
+    resync();
+    markSaved();
+}
+
+quint64 ModificationTracker::hashLine(const QString &text) {
+    return quint64(qHash(QStringView(text), 0x4d414c41));
+}
+
+void ModificationTracker::setContentCheck(bool enabled) {
+    if (contentCheck == enabled) {
+        return;
+    }
+    contentCheck = enabled;
+    if (contentCheck) {
+        resync();
+    } else {
+        lineHashes.clear();
+        lineHashes.squeeze();
+    }
+    // The saved state isn't known without hashes from back then
+    savedHashes = lineHashes;
+    savedCharacters = doc->characterCount();
+    update();
+}
+
+void ModificationTracker::markSaved() {
+    // Shared until the next edit detaches it
+    savedHashes = lineHashes;
+    savedCharacters = doc->characterCount();
+    doc->setModified(false);
+    update();
+}
+
+void ModificationTracker::resync() {
+    lineHashes.clear();
+    if (!contentCheck) {
+        return;
+    }
+    lineHashes.reserve(doc->blockCount());
+    for (QTextBlock block = doc->begin(); block.isValid(); block = block.next()) {
+        lineHashes.append(hashLine(block.text()));
+    }
+}
+
+void ModificationTracker::onContentsChange(int position, int removed, int added) {
+    if (!contentCheck) {
+        emit edited(position, removed, added);
+        update();
+        return;
+    }
+
+    const LineChange change = LineChange::of(doc, position, added, int(lineHashes.size()));
+    if (!change.valid) {
+        resync();
+        emit edited(position, removed, added);
+        update();
+        return;
+    }
+    const int start = change.start;
+    const int oldEnd = change.oldEnd;
+    const int newEnd = change.newEnd;
+    const int delta = change.delta;
+
+    if (delta > 0) {
+        lineHashes.insert(oldEnd + 1, delta, 0);
+    } else if (delta < 0) {
+        lineHashes.remove(newEnd + 1, -delta);
+    }
+    bool changed = delta != 0;
+    QTextBlock block = change.first;
+    for (int line = start; line <= newEnd; ++line, block = block.next()) {
+        const quint64 hash = hashLine(block.text());
+        if (lineHashes.at(line) != hash) {
+            lineHashes[line] = hash;
+            changed = true;
+        }
+    }
+    // The highlighter's format updates arrive here too, nothing to check then
+    if (changed) {
+        emit edited(position, removed, added);
+        update();
+    }
+}
+
+void ModificationTracker::update() {
+    // Undo back to the save point is the common way back, and free
+    bool now = doc->isModified();
+    if (now && contentCheck && doc->characterCount() == savedCharacters) {
+        now = lineHashes != savedHashes;
+    }
+    if (now != modified) {
+        modified = now;
+        emit modificationChanged(modified);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef MODIFICATIONTRACKER_H
+#define MODIFICATIONTRACKER_H
+
+#include <QObject>
+#include <QVector>
+
+class QTextDocument;
+
+// Whether a document differs from what was last loaded or saved, without
+// ever copying its text. The undo stack's clean state answers most of it;
+// a hash per line, kept current from contentsChange like the other line
+// mirrors, catches text typed back to the saved state by hand.
+class ModificationTracker : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ModificationTracker(QTextDocument *document, QObject *parent = nullptr);
+
+    bool isModified() const { return modified; }
+
+    // The current text is what's on disk now
+    void markSaved();
+
+    // Without the line hashes only the undo stack counts (large files)
+    void setContentCheck(bool enabled);
+    bool hasContentCheck() const { return contentCheck; }
+
+signals:
+    void modificationChanged(bool modified);
+    // A contentsChange that changed text; the highlighter's format-only ones
+    // are left out. Without the content check that can't be told, all come.
+    // Goes out before modificationChanged() for the same change, so whoever
+    // resets on a clean state has seen the edit that led there.
+    void edited(int position, int removed, int added);
+
+private slots:
+    void onContentsChange(int position, int removed, int added);
+    void update();
+
+private:
+    static quint64 hashLine(const QString &text);
+    void resync();
+
+    QTextDocument *doc;
+    bool contentCheck = true;
+    bool modified = false;
+
+    // Current text, one hash per line, and the same as of markSaved()
+    QVector<quint64> lineHashes;
+    QVector<quint64> savedHashes;
+    int savedCharacters = 0;
+};
+
+#endif // MODIFICATIONTRACKER_H
@@ -0,0 +1,466 @@
+#include "piecetable.h"
+#include "linescanner.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+PieceTable::PieceTable() = default;
+
+PieceTable::~PieceTable() = default;
+
+qint64 PieceTable::map(const QString &filePath, QString *error)
+{
+    auto newFile = std::make_unique<QFile>(filePath);
+    if (!newFile->open(QIODevice::ReadOnly)) {
+        if (error) {
+            *error = newFile->errorString();
+        }
+        return -1;
+    }
+    const qint64 newSize = newFile->size();
+    const uchar *data = newSize > 0 ? newFile->map(0, newSize) : nullptr;
+    if (newSize > 0 && !data) {
+        if (error) {
+            *error = newFile->errorString();
+        }
+        return -1;
+    }
+
+    unmap();
+    file = std::move(newFile);
+    original = reinterpret_cast<const char *>(data);
+    originalSize = newSize;
+    path = filePath;
+    return indexOriginal();
+}
+
+bool PieceTable::load(const QString &filePath, QString *error)
+{
+    const qint64 newlines = map(filePath, error);
+    if (newlines < 0) {
+        return false;
+    }
+
+    added.clear();
+    pieces.clear();
+    if (originalSize > 0) {
+        Piece piece;
+        piece.length = originalSize;
+        piece.newlines = newlines;
+        pieces.append(piece);
+    }
+    updateSums(0);
+    currentRevision = nextRevision++;
+    return true;
+}
+
+bool PieceTable::save(const QString &filePath, QString *error)
+{
+    SaveJob job = beginSave(filePath);
+    if (!write(job)) {
+        if (error) {
+            *error = job.error;
+        }
+        return false;
+    }
+    return finishSave(job, nullptr, nullptr, error);
+}
+
+PieceTable::SaveJob PieceTable::beginSave(const QString &filePath) const
+{
+    SaveJob job;
+    job.path = filePath;
+    job.pieces = pieces;
+    // Shared, typing meanwhile appends to a copy
+    job.added = added;
+    job.original = original;
+    job.revision = currentRevision;
+    job.out = std::make_shared<QSaveFile>(filePath);
+    return job;
+}
+
+bool PieceTable::write(SaveJob &job)
+{
+    QSaveFile &out = *job.out;
+    if (!out.open(QIODevice::WriteOnly)) {
+        job.error = out.errorString();
+        return false;
+    }
+    for (const Piece &piece : job.pieces) {
+        const char *bytes = (piece.added ? job.added.constData() : job.original) + piece.start;
+        if (out.write(bytes, piece.length) != piece.length) {
+            job.error = out.errorString();
+            out.cancelWriting();
+            return false;
+        }
+    }
+    // The sync that takes long, commit() then has next to nothing left
+    out.flush();
+#ifdef Q_OS_UNIX
+    ::fsync(out.handle());
+#endif
+    return true;
+}
+
+bool PieceTable::finishSave(SaveJob &job, QVector<Snapshot> *undo, QVector<Snapshot> *redo, QString *error)
+{
+    const bool edited = currentRevision != job.revision;
+
+    // Edits since beginSave() point into the old file, which may be gone
+    // after the rename: where its bytes went is worked out while it's mapped
+    QVector<Piece> rebased;
+    QVector<Snapshot> rebasedUndo;
+    QVector<Snapshot> rebasedRedo;
+    if (edited) {
+        QVector<Moved> moved;
+        qint64 at = 0;
+        for (const Piece &piece : job.pieces) {
+            if (!piece.added) {
+                moved.append({piece.start, piece.length, at});
+            }
+            at += piece.length;
+        }
+        std::sort(moved.begin(), moved.end(), [](const Moved &a, const Moved &b) { return a.from < b.from; });
+
+        const auto rebaseAll = [this, &moved](const QVector<Snapshot> *history) {
+            QVector<Snapshot> result;
+            if (history) {
+                for (const Snapshot &snapshot : *history) {
+                    result.append({rebase(snapshot.pieces, moved), snapshot.revision});
+                }
+            }
+            return result;
+        };
+        rebased = rebase(pieces, moved);
+        rebasedUndo = rebaseAll(undo);
+        rebasedRedo = rebaseAll(redo);
+    }
+
+#ifdef Q_OS_WIN
+    // Windows won't replace a file that is still mapped
+    const bool replacing = file && QFileInfo(job.path) == QFileInfo(path);
+#else
+    // Elsewhere the old mapping outlives the rename, and stays until the
+    // new file is mapped: a failure on the way leaves the pieces fitting it
+    const bool replacing = false;
+#endif
+    const QString oldPath = path;
+    if (replacing) {
+        unmap();
+    }
+    if (!job.out->commit()) {
+        if (error) {
+            *error = job.out->errorString();
+        }
+        if (replacing && map(oldPath, nullptr) < 0) {
+            dropText(undo, redo);
+        }
+        return false;
+    }
+
+    if (!edited) {
+        if (!load(job.path, error)) {
+            if (replacing) {
+                dropText(undo, redo);
+            }
+            return false;
+        }
+        if (undo) {
+            undo->clear();
+        }
+        if (redo) {
+            redo->clear();
+        }
+        return true;
+    }
+    if (map(job.path, error) < 0) {
+        if (replacing) {
+            dropText(undo, redo);
+        }
+        return false;
+    }
+    // Newline counts of file pieces need the new file's index
+    pieces = rebased;
+    recount(pieces);
+    updateSums(0);
+    const auto adopt = [this](QVector<Snapshot> *history, QVector<Snapshot> &result) {
+        if (history) {
+            for (Snapshot &snapshot : result) {
+                recount(snapshot.pieces);
+            }
+            *history = result;
+        }
+    };
+    adopt(undo, rebasedUndo);
+    adopt(redo, rebasedRedo);
+    return true;
+}
+
+QVector<PieceTable::Piece> PieceTable::rebase(const QVector<Piece> &list, const QVector<Moved> &moved)
+{
+    QVector<Piece> result;
+    result.reserve(list.size());
+    for (const Piece &piece : list) {
+        if (piece.added) {
+            result.append(piece);
+            continue;
+        }
+        qint64 at = piece.start;
+        const qint64 end = piece.start + piece.length;
+        // The first stretch ending after `at`; they don't overlap, edits never copy file bytes
+        auto it = std::upper_bound(moved.cbegin(), moved.cend(), at, [](qint64 position, const Moved &m) {
+            return position < m.from + m.length;
+        });
+        while (at < end) {
+            if (it != moved.cend() && it->from <= at) {
+                Piece part;
+                part.start = it->to + (at - it->from);
+                part.length = qMin(end, it->from + it->length) - at;
+                result.append(part);
+                at += part.length;
+                ++it;
+            } else {
+                // Not in the saved text, e.g. deleted before the save and back by undo
+                const qint64 gapEnd = it != moved.cend() ? qMin(end, it->from) : end;
+                const qint64 start = added.size();
+                added.append(original + at, gapEnd - at);
+                result.append(makePiece(true, start, gapEnd - at));
+                at = gapEnd;
+            }
+        }
+    }
+    return result;
+}
+
+void PieceTable::recount(QVector<Piece> &list) const
+{
+    for (Piece &piece : list) {
+        if (!piece.added) {
+            piece = makePiece(false, piece.start, piece.length);
+        }
+    }
+}
+
+void PieceTable::dropText(QVector<Snapshot> *undo, QVector<Snapshot> *redo)
+{
+    pieces.clear();
+    added.clear();
+    if (undo) {
+        undo->clear();
+    }
+    if (redo) {
+        redo->clear();
+    }
+    updateSums(0);
+    currentRevision = nextRevision++;
+}
+
+void PieceTable::unmap()
+{
+    // Closing unmaps too
+    if (file) {
+        file->close();
+        file.reset();
+    }
+    original = nullptr;
+    originalSize = 0;
+    originalIndex.clear();
+}
+
+const char *PieceTable::bytesOf(const Piece &piece) const
+{
+    return (piece.added ? added.constData() : original) + piece.start;
+}
+
+qint64 PieceTable::indexOriginal()
+{
+    originalIndex.clear();
+    return LineScanner::scan(original, 0, originalSize, 0, indexStride, originalIndex);
+}
+
+qint64 PieceTable::originalRank(qint64 position) const
+{
+    const auto it = std::lower_bound(originalIndex.cbegin(), originalIndex.cend(), position);
+    const qint64 j = qint64(it - originalIndex.cbegin()) - 1;
+    if (j < 0) {
+        return LineScanner::count(original, 0, position);
+    }
+    const qint64 from = originalIndex.at(j) + 1;
+    return j * indexStride + 1 + LineScanner::count(original, from, position);
+}
+
+qint64 PieceTable::originalSelect(qint64 n) const
+{
+    const qint64 from = originalIndex.at(n / indexStride);
+    const qint64 rest = n % indexStride;
+    if (rest == 0) {
+        return from;
+    }
+    return LineScanner::find(original, from + 1, originalSize, rest - 1);
+}
+
+PieceTable::Piece PieceTable::makePiece(bool isAdded, qint64 start, qint64 length) const
+{
+    Piece piece;
+    piece.start = start;
+    piece.length = length;
+    piece.added = isAdded;
+    piece.newlines = isAdded ? LineScanner::count(added.constData(), start, start + length)
+                             : originalRank(start + length) - originalRank(start);
+    return piece;
+}
+
+int PieceTable::splitAt(qint64 position)
+{
+    if (position >= totalSize) {
+        return int(pieces.size());
+    }
+    const auto it = std::upper_bound(offsets.cbegin(), offsets.cbegin() + pieces.size(), position);
+    const int i = int(it - offsets.cbegin()) - 1;
+    if (offsets.at(i) == position) {
+        return i;
+    }
+
+    const Piece whole = pieces.at(i);
+    const Piece left = makePiece(whole.added, whole.start, position - offsets.at(i));
+    Piece right = whole;
+    right.start += left.length;
+    right.length -= left.length;
+    right.newlines -= left.newlines;
+    pieces[i] = left;
+    pieces.insert(i + 1, right);
+    updateSums(i);
+    return i + 1;
+}
+
+void PieceTable::updateSums(int from)
+{
+    offsets.resize(pieces.size() + 1);
+    lineOffsets.resize(pieces.size() + 1);
+    if (from == 0) {
+        offsets[0] = 0;
+        lineOffsets[0] = 0;
+    }
+    for (int i = from; i < pieces.size(); ++i) {
+        offsets[i + 1] = offsets.at(i) + pieces.at(i).length;
+        lineOffsets[i + 1] = lineOffsets.at(i) + pieces.at(i).newlines;
+    }
+    totalSize = offsets.last();
+    totalNewlines = lineOffsets.last();
+}
+
+qint64 PieceTable::lineStart(int line) const
+{
+    if (line <= 0) {
+        return 0;
+    }
+    const qint64 n = line - 1;  // the newline ending the line before
+    if (n >= totalNewlines) {
+        return totalSize;
+    }
+
+    const auto it = std::upper_bound(lineOffsets.cbegin(), lineOffsets.cbegin() + pieces.size(), n);
+    const int i = int(it - lineOffsets.cbegin()) - 1;
+    const Piece &piece = pieces.at(i);
+    const qint64 k = n - lineOffsets.at(i);
+    const qint64 inPiece = piece.added ? LineScanner::find(bytesOf(piece), 0, piece.length, k)
+                                       : originalSelect(originalRank(piece.start) + k) - piece.start;
+    return offsets.at(i) + inPiece + 1;
+}
+
+QByteArray PieceTable::line(int line, int maxBytes) const
+{
+    const qint64 start = lineStart(line);
+    const qint64 end = line + 1 < lineCount() ? lineStart(line + 1) - 1 : totalSize;
+    QByteArray bytes = read(start, qMin<qint64>(end - start, maxBytes));
+    if (end - start <= maxBytes && bytes.endsWith('\r')) {
+        bytes.chop(1);
+    }
+    return bytes;
+}
+
+QByteArray PieceTable::read(qint64 position, qint64 length) const
+{
+    QByteArray bytes;
+    position = qBound<qint64>(0, position, totalSize);
+    length = qBound<qint64>(0, length, totalSize - position);
+    if (!length) {
+        return bytes;
+    }
+    bytes.reserve(length);
+
+    const auto it = std::upper_bound(offsets.cbegin(), offsets.cbegin() + pieces.size(), position);
+    for (int i = int(it - offsets.cbegin()) - 1; length > 0 && i < pieces.size(); ++i) {
+        const Piece &piece = pieces.at(i);
+        const qint64 skip = position - offsets.at(i);
+        const qint64 take = qMin(length, piece.length - skip);
+        bytes.append(bytesOf(piece) + skip, take);
+        position += take;
+        length -= take;
+    }
+    return bytes;
+}
+
+void PieceTable::insert(qint64 position, const QByteArray &bytes)
+{
+    if (bytes.isEmpty()) {
+        return;
+    }
+    position = qBound<qint64>(0, position, totalSize);
+
+    // Typing extends the piece it typed last
+    if (position > 0) {
+        const auto it = std::upper_bound(offsets.cbegin(), offsets.cbegin() + pieces.size(), position - 1);
+        const int i = int(it - offsets.cbegin()) - 1;
+        Piece &piece = pieces[i];
+        if (piece.added && offsets.at(i + 1) == position && piece.start + piece.length == added.size()) {
+            added.append(bytes);
+            piece.length += bytes.size();
+            piece.newlines += LineScanner::count(bytes.constData(), 0, bytes.size());
+            updateSums(i);
+            currentRevision = nextRevision++;
+            return;
+        }
+    }
+
+    const int i = splitAt(position);
+    const qint64 start = added.size();
+    added.append(bytes);
+    pieces.insert(i, makePiece(true, start, bytes.size()));
+    updateSums(i);
+    currentRevision = nextRevision++;
+}
+
+void PieceTable::remove(qint64 position, qint64 length)
+{
+    position = qBound<qint64>(0, position, totalSize);
+    length = qMin(length, totalSize - position);
+    if (length <= 0) {
+        return;
+    }
+    const int first = splitAt(position);
+    const int last = splitAt(position + length);
+    pieces.remove(first, last - first);
+    updateSums(first);
+    currentRevision = nextRevision++;
+}
+
+PieceTable::Snapshot PieceTable::snapshot() const
+{
+    Snapshot snapshot;
+    snapshot.pieces = pieces;
+    snapshot.revision = currentRevision;
+    return snapshot;
+}
+
+void PieceTable::restore(const Snapshot &snapshot)
+{
+    pieces = snapshot.pieces;
+    updateSums(0);
+    currentRevision = snapshot.revision;
+}
@@ -0,0 +1,127 @@
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <memory>
+
+class QFile;
+class QSaveFile;
+
+// Text of a file too big for QTextDocument. The file stays on disk, mapped
+// read-only, everything typed goes to an append-only buffer, and a short
+// list of pieces says which bytes of which buffer make up the text. Memory
+// is the mapped pages (the OS can drop them) plus the edits.
+//
+// Lines are found through a sparse index of the file's newlines, every
+// indexStride-th one, and a newline count per piece.
+class PieceTable {
+public:
+    struct Piece {
+        qint64 start = 0;
+        qint64 length = 0;
+        qint64 newlines = 0;
+        bool added = false;  // in the append buffer, not the file
+    };
+
+    // Undo is putting an older piece list back, the buffers only grow
+    struct Snapshot {
+        QVector<Piece> pieces;
+        quint64 revision = 0;
+    };
+
+    PieceTable();
+    ~PieceTable();
+
+    bool load(const QString &path, QString *error = nullptr);
+    // Writes through QSaveFile, then maps the new file and drops the edits
+    bool save(const QString &path, QString *error = nullptr);
+
+    // The same save in three steps, for writing on a worker while typing
+    // goes on. beginSave() takes the pieces as they are, write() puts them
+    // in a temporary file on any thread, finishSave() renames it over the
+    // target on the table's thread. The table mustn't load() in between.
+    struct SaveJob {
+        QString path;
+        QVector<Piece> pieces;
+        QByteArray added;
+        const char *original = nullptr;
+        quint64 revision = 0;
+        std::shared_ptr<QSaveFile> out;
+        QString error;
+    };
+    SaveJob beginSave(const QString &path) const;
+    static bool write(SaveJob &job);
+    // Edits made since beginSave() are kept and moved onto the new file,
+    // with the undo and redo snapshots. Without any, the edits are dropped
+    // like in save() and so are the snapshots.
+    bool finishSave(SaveJob &job, QVector<Snapshot> *undo = nullptr, QVector<Snapshot> *redo = nullptr,
+                    QString *error = nullptr);
+    QString filePath() const { return path; }
+
+    qint64 size() const { return totalSize; }
+    int lineCount() const { return int(totalNewlines + 1); }
+    qint64 lineStart(int line) const;
+    // Line without its "\n" or "\r\n", cut after maxBytes
+    QByteArray line(int line, int maxBytes) const;
+    QByteArray read(qint64 position, qint64 length) const;
+
+    void insert(qint64 position, const QByteArray &bytes);
+    void remove(qint64 position, qint64 length);
+
+    // Changes with every edit, restore() brings the old one back
+    quint64 revision() const { return currentRevision; }
+    Snapshot snapshot() const;
+    void restore(const Snapshot &snapshot);
+
+    static constexpr int indexStride = 64;
+
+private:
+    // Where a stretch of the old file is in the saved one
+    struct Moved {
+        qint64 from = 0;
+        qint64 length = 0;
+        qint64 to = 0;
+    };
+
+    // Maps the file, indexes it and returns its newline count, -1 on failure
+    qint64 map(const QString &path, QString *error);
+    const char *bytesOf(const Piece &piece) const;
+    // Pieces of the old file as pieces of the new one; bytes the new one
+    // doesn't have are copied to the append buffer
+    QVector<Piece> rebase(const QVector<Piece> &list, const QVector<Moved> &moved);
+    void recount(QVector<Piece> &list) const;
+    // Fills originalIndex, returns the file's newline count
+    qint64 indexOriginal();
+    // Newlines in the file before `position`, and where newline n is
+    qint64 originalRank(qint64 position) const;
+    qint64 originalSelect(qint64 n) const;
+
+    Piece makePiece(bool added, qint64 start, qint64 length) const;
+    // Index of the piece that starts at `position`, splitting one if needed
+    int splitAt(qint64 position);
+    void updateSums(int from);
+    void unmap();
+    // Nothing mapped to read the pieces from: the text goes, so do the
+    // snapshots. Only the file on disk has it then.
+    void dropText(QVector<Snapshot> *undo, QVector<Snapshot> *redo);
+
+    QString path;
+    std::unique_ptr<QFile> file;
+    const char *original = nullptr;
+    qint64 originalSize = 0;
+    QVector<qint64> originalIndex;  // position of newline j * indexStride
+    QByteArray added;
+
+    QVector<Piece> pieces;
+    QVector<qint64> offsets;      // text position of each piece, one past the end too
+    QVector<qint64> lineOffsets;  // newlines before each piece, same
+    qint64 totalSize = 0;
+    qint64 totalNewlines = 0;
+
+    quint64 currentRevision = 0;
+    quint64 nextRevision = 1;
+};
+
+#endif // PIECETABLE_H
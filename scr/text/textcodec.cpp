@@ -0,0 +1,483 @@
+#include "textcodec.h"
+#include <QStringDecoder>
+#include <QStringEncoder>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MALACHITE_CODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace TextCodec {
+
+namespace {
+
+// windows-1251 from 0x80 up, 0x98 is unassigned
+const char16_t cp1251High[128] = {
+    0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+    0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0xFFFD, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+    0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+    0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+    0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+    0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+    0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+    0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+    0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+    0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+    0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+    0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+    0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+    0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+};
+
+constexpr char16_t replacement = 0xFFFD;
+
+// Length of the ASCII run at the start of src
+qint64 asciiLength(const uchar *src, qint64 size)
+{
+    qint64 i = 0;
+#ifdef MALACHITE_CODEC_SSE2
+    for (; i + 16 <= size; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const uint high = uint(_mm_movemask_epi8(chunk));
+        if (high) {
+            return i + qCountTrailingZeroBits(high);
+        }
+    }
+#endif
+    while (i < size && src[i] < 0x80) {
+        ++i;
+    }
+    return i;
+}
+
+// Widens the ASCII run at the start of src into dst and returns its length.
+// dst must have room for size units, it may be written past the run.
+qint64 widenAscii(const uchar *src, qint64 size, char16_t *dst)
+{
+    qint64 i = 0;
+#ifdef MALACHITE_CODEC_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpackhi_epi8(chunk, zero));
+        const uint high = uint(_mm_movemask_epi8(chunk));
+        if (high) {
+            return i + qCountTrailingZeroBits(high);
+        }
+    }
+#endif
+    for (; i < size && src[i] < 0x80; ++i) {
+        dst[i] = src[i];
+    }
+    return i;
+}
+
+// Latin-1 is every byte widened
+void widenAll(const uchar *src, qint64 size, char16_t *dst)
+{
+    qint64 i = 0;
+#ifdef MALACHITE_CODEC_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpackhi_epi8(chunk, zero));
+    }
+#endif
+    for (; i < size; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+// Bytes of the sequence a lead byte starts, 0 if it can't start one
+int sequenceLength(uchar lead)
+{
+    if (lead < 0x80) {
+        return 1;
+    }
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        return 2;
+    }
+    if (lead >= 0xE0 && lead <= 0xEF) {
+        return 3;
+    }
+    if (lead >= 0xF0 && lead <= 0xF4) {
+        return 4;
+    }
+    return 0;
+}
+
+// The sequence at src, whose length is known to fit; -1 if it is invalid
+// (bad continuation, overlong, surrogate or past U+10FFFF)
+qint32 decodeSequence(const uchar *src, int length)
+{
+    static const qint32 minimum[] = {0, 0, 0x80, 0x800, 0x10000};
+    qint32 code = src[0] & (0x7F >> length);
+    for (int k = 1; k < length; ++k) {
+        if ((src[k] & 0xC0) != 0x80) {
+            return -1;
+        }
+        code = (code << 6) | (src[k] & 0x3F);
+    }
+    if (code < minimum[length] || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) {
+        return -1;
+    }
+    return code;
+}
+
+// Whether src[0, size) could still become a valid sequence with more bytes
+bool isCutSequence(const uchar *src, qint64 size)
+{
+    const int length = sequenceLength(src[0]);
+    if (length <= 1 || size >= length) {
+        return false;
+    }
+    for (qint64 k = 1; k < size; ++k) {
+        if ((src[k] & 0xC0) != 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decodes UTF-8 into dst, which has room for size units. Stops before a
+// sequence cut off by the end; *consumed says where. Invalid bytes are
+// added to *invalid.
+qint64 decodeUtf8(const uchar *src, qint64 size, char16_t *dst, qint64 *consumed, qint64 *invalid)
+{
+    qint64 i = 0;
+    qint64 o = 0;
+    while (i < size) {
+        const qint64 ascii = widenAscii(src + i, size - i, dst + o);
+        i += ascii;
+        o += ascii;
+        if (i >= size) {
+            break;
+        }
+
+        const int length = sequenceLength(src[i]);
+        if (length > 1 && i + length > size && isCutSequence(src + i, size - i)) {
+            break;
+        }
+        const qint32 code = length > 1 && i + length <= size ? decodeSequence(src + i, length) : -1;
+        if (code < 0) {
+            dst[o++] = replacement;
+            ++*invalid;
+            ++i;
+        } else if (code >= 0x10000) {
+            dst[o++] = char16_t(0xD800 + ((code - 0x10000) >> 10));
+            dst[o++] = char16_t(0xDC00 + ((code - 0x10000) & 0x3FF));
+            i += length;
+        } else {
+            dst[o++] = char16_t(code);
+            i += length;
+        }
+    }
+    *consumed = i;
+    return o;
+}
+
+qint64 decodeCp1251(const uchar *src, qint64 size, char16_t *dst)
+{
+    qint64 i = 0;
+    while (i < size) {
+        i += widenAscii(src + i, size - i, dst + i);
+        if (i < size) {
+            dst[i] = cp1251High[src[i] - 0x80];
+            ++i;
+        }
+    }
+    return size;
+}
+
+// The cp1251 byte for a unit, -1 if it has none
+int cp1251Byte(char16_t unit)
+{
+    if (unit < 0x80) {
+        return unit;
+    }
+    if (unit >= 0x0410 && unit <= 0x044F) {
+        return 0xC0 + (unit - 0x0410);
+    }
+    for (int k = 0; k < 64; ++k) {
+        if (cp1251High[k] == unit) {
+            return 0x80 + k;
+        }
+    }
+    return -1;
+}
+
+// Only called once canEncode() said yes, '?' is never really written
+QByteArray encodeCp1251(QStringView text)
+{
+    QByteArray bytes(text.size(), Qt::Uninitialized);
+    char *out = bytes.data();
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        const int byte = cp1251Byte(text.at(i).unicode());
+        out[i] = byte >= 0 ? char(byte) : '?';
+    }
+    return bytes;
+}
+
+// Cyrillic words are runs of high bytes, accented Western letters mostly
+// sit alone between ASCII ones
+Encoding guessLegacy(const uchar *bytes, qint64 size)
+{
+    qint64 inRuns = 0;
+    qint64 alone = 0;
+    for (qint64 i = 0; i < size; ++i) {
+        if (bytes[i] < 0x80) {
+            continue;
+        }
+        const bool before = i > 0 && bytes[i - 1] >= 0x80;
+        const bool after = i + 1 < size && bytes[i + 1] >= 0x80;
+        if (before || after) {
+            ++inRuns;
+        } else {
+            ++alone;
+        }
+    }
+    return inRuns > alone ? Encoding::Cp1251 : Encoding::Latin1;
+}
+
+LineBreak detectLineBreak(const char *data, qint64 size, const Format &format)
+{
+    if (format.encoding == Encoding::Utf16LE || format.encoding == Encoding::Utf16BE) {
+        const int low = format.encoding == Encoding::Utf16LE ? 0 : 1;
+        for (qint64 i = 0; i + 1 < size; i += 2) {
+            if (data[i + 1 - low] != 0) {
+                continue;
+            }
+            if (data[i + low] == '\n') {
+                return LineBreak::Lf;
+            }
+            if (data[i + low] == '\r') {
+                const bool pair = i + 3 < size && data[i + 2 + low] == '\n' && data[i + 3 - low] == 0;
+                return pair ? LineBreak::CrLf : LineBreak::Cr;
+            }
+        }
+        return LineBreak::Lf;
+    }
+
+    const char *newline = static_cast<const char *>(std::memchr(data, '\n', size_t(size)));
+    if (newline) {
+        return newline > data && newline[-1] == '\r' ? LineBreak::CrLf : LineBreak::Lf;
+    }
+    return std::memchr(data, '\r', size_t(size)) ? LineBreak::Cr : LineBreak::Lf;
+}
+
+} // namespace
+
+Format detect(const char *data, qint64 size)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    Format format;
+    if (size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF) {
+        format.bom = true;
+    } else if (size >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+        format.encoding = Encoding::Utf16LE;
+        format.bom = true;
+    } else if (size >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
+        format.encoding = Encoding::Utf16BE;
+        format.bom = true;
+    } else if (validUtf8Length(data, size) < size) {
+        format.encoding = guessLegacy(bytes, size);
+    }
+    const int skip = bomLength(format);
+    format.lineBreak = detectLineBreak(data + skip, size - skip, format);
+    return format;
+}
+
+int bomLength(const Format &format)
+{
+    if (!format.bom) {
+        return 0;
+    }
+    return format.encoding == Encoding::Utf8 ? 3 : 2;
+}
+
+QString name(Encoding encoding)
+{
+    switch (encoding) {
+    case Encoding::Utf8:
+        return QStringLiteral("UTF-8");
+    case Encoding::Utf16LE:
+        return QStringLiteral("UTF-16LE");
+    case Encoding::Utf16BE:
+        return QStringLiteral("UTF-16BE");
+    case Encoding::Latin1:
+        return QStringLiteral("ISO-8859-1");
+    case Encoding::Cp1251:
+        return QStringLiteral("windows-1251");
+    }
+    return QString();
+}
+
+qint64 validUtf8Length(const char *data, qint64 size)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    qint64 i = 0;
+    while (i < size) {
+        i += asciiLength(bytes + i, size - i);
+        if (i >= size) {
+            break;
+        }
+        const int length = sequenceLength(bytes[i]);
+        if (length > 1 && i + length > size) {
+            return isCutSequence(bytes + i, size - i) ? size : i;
+        }
+        if (length <= 1 || decodeSequence(bytes + i, length) < 0) {
+            return i;
+        }
+        i += length;
+    }
+    return size;
+}
+
+int utf8Char(const char *data, qint64 size, char32_t *code)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    const int length = sequenceLength(bytes[0]);
+    if (length == 1) {
+        *code = bytes[0];
+        return 1;
+    }
+    const qint32 decoded = length > 1 && length <= size ? decodeSequence(bytes, length) : -1;
+    if (decoded < 0) {
+        *code = replacement;
+        return 1;
+    }
+    *code = char32_t(decoded);
+    return length;
+}
+
+Decoder::Decoder(Encoding encoding)
+    : encoding(encoding)
+{
+    if (encoding == Encoding::Utf16LE || encoding == Encoding::Utf16BE) {
+        utf16 = std::make_unique<QStringDecoder>(encoding == Encoding::Utf16LE ? QStringConverter::Utf16LE
+                                                                                : QStringConverter::Utf16BE);
+    }
+}
+
+Decoder::~Decoder() = default;
+
+void Decoder::decode(const char *data, qint64 size, QString &out)
+{
+    if (utf16) {
+        out += utf16->decode(QByteArrayView(data, size));
+        return;
+    }
+
+    const uchar *src = reinterpret_cast<const uchar *>(data);
+    const qsizetype start = out.size();
+    // Never more units than bytes, the carried ones included
+    out.resize(start + size + carried);
+    char16_t *dst = reinterpret_cast<char16_t *>(out.data()) + start;
+    qint64 written = 0;
+
+    switch (encoding) {
+    case Encoding::Latin1:
+        widenAll(src, size, dst);
+        written = size;
+        break;
+    case Encoding::Cp1251:
+        written = decodeCp1251(src, size, dst);
+        break;
+    default: {
+        qint64 from = 0;
+        if (carried) {
+            // Finish the character cut at the end of the last call
+            const int length = sequenceLength(carry[0]);
+            const int joined = carried + int(qMin<qint64>(length - carried, size));
+            std::memcpy(carry + carried, src, size_t(joined - carried));
+            if (joined < length && isCutSequence(carry, joined)) {
+                carried = joined;
+                out.resize(start);
+                return;
+            }
+            qint64 consumed = 0;
+            written = decodeUtf8(carry, joined, dst, &consumed, &invalid);
+            // Bytes from this call that started a new cut sequence are read again
+            from = qMax<qint64>(0, consumed - carried);
+            carried = 0;
+        }
+        qint64 consumed = 0;
+        written += decodeUtf8(src + from, size - from, dst + written, &consumed, &invalid);
+        consumed += from;
+        carried = int(size - consumed);
+        std::memcpy(carry, src + consumed, size_t(carried));
+        break;
+    }
+    }
+    out.resize(start + written);
+}
+
+void Decoder::finish(QString &out)
+{
+    if (carried) {
+        out += QChar(replacement);
+        ++invalid;
+        carried = 0;
+    }
+}
+
+bool Decoder::hasErrors() const
+{
+    return invalid > 0 || (utf16 && utf16->hasError());
+}
+
+bool canEncode(QStringView text, Encoding encoding)
+{
+    switch (encoding) {
+    case Encoding::Latin1:
+        return std::all_of(text.begin(), text.end(), [](QChar c) { return c.unicode() < 0x100; });
+    case Encoding::Cp1251:
+        return std::all_of(text.begin(), text.end(), [](QChar c) { return cp1251Byte(c.unicode()) >= 0; });
+    default:
+        return true;
+    }
+}
+
+QByteArray encode(QStringView text, const Format &format)
+{
+    QString converted;
+    if (format.lineBreak != LineBreak::Lf && text.contains(QLatin1Char('\n'))) {
+        converted = text.toString();
+        converted.replace(QLatin1Char('\n'), format.lineBreak == LineBreak::CrLf ? QLatin1String("\r\n")
+                                                                                 : QLatin1String("\r"));
+        text = converted;
+    }
+
+    QByteArray bytes;
+    switch (format.encoding) {
+    case Encoding::Utf8:
+        bytes = text.toUtf8();
+        if (format.bom) {
+            bytes.prepend("\xEF\xBB\xBF");
+        }
+        break;
+    case Encoding::Utf16LE:
+    case Encoding::Utf16BE: {
+        QStringEncoder encoder(format.encoding == Encoding::Utf16LE ? QStringConverter::Utf16LE
+                                                                     : QStringConverter::Utf16BE,
+                               format.bom ? QStringConverter::Flag::WriteBom : QStringConverter::Flag::Default);
+        bytes = encoder.encode(text);
+        break;
+    }
+    case Encoding::Latin1:
+        bytes = text.toLatin1();
+        break;
+    case Encoding::Cp1251:
+        bytes = encodeCp1251(text);
+        break;
+    }
+    return bytes;
+}
+
+} // namespace TextCodec
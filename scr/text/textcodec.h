@@ -0,0 +1,74 @@
+#ifndef TEXTCODEC_H
+#define TEXTCODEC_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringView>
+#include <memory>
+
+class QStringDecoder;
+
+// Encodings of files on disk. Detection looks at a BOM, then checks whether
+// a sample is valid UTF-8 and otherwise guesses a legacy code page. The
+// ASCII parts of the text, most of any source file, are checked and widened
+// 16 bytes per step where SSE2 is there; only the rest goes byte by byte.
+namespace TextCodec {
+
+enum class Encoding { Utf8, Utf16LE, Utf16BE, Latin1, Cp1251 };
+enum class LineBreak { Lf, CrLf, Cr };
+
+// How a file was written, so saving can write it the same way
+struct Format {
+    Encoding encoding = Encoding::Utf8;
+    bool bom = false;
+    LineBreak lineBreak = LineBreak::Lf;
+    // Decoding replaced invalid bytes: writing the text back won't give the
+    // file back, whoever saves should know
+    bool lossy = false;
+};
+
+// From the first bytes of a file
+Format detect(const char *data, qint64 size);
+int bomLength(const Format &format);
+QString name(Encoding encoding);
+
+// Bytes of [data, data + size) that are valid UTF-8, a sequence cut off by
+// the end counts as valid
+qint64 validUtf8Length(const char *data, qint64 size);
+
+// The UTF-8 character at data: its length in bytes, its code point in *code.
+// A byte that starts no valid sequence, a cut-off one included, is one
+// character of its own, U+FFFD.
+int utf8Char(const char *data, qint64 size, char32_t *code);
+
+// Streaming conversion to UTF-16. A character split between two calls is
+// finished by the second one, finish() ends a cut-off one with U+FFFD.
+// Invalid bytes become U+FFFD too.
+class Decoder {
+public:
+    explicit Decoder(Encoding encoding);
+    ~Decoder();
+
+    void decode(const char *data, qint64 size, QString &out);
+    void finish(QString &out);
+    // Some bytes were invalid and became U+FFFD
+    bool hasErrors() const;
+
+private:
+    Encoding encoding;
+    unsigned char carry[4] = {};
+    int carried = 0;
+    qint64 invalid = 0;
+    std::unique_ptr<QStringDecoder> utf16;  // UTF-16 goes through Qt
+};
+
+// Whether every character of the text exists in the encoding; encode()
+// writes '?' for the ones that don't
+bool canEncode(QStringView text, Encoding encoding);
+
+// The text as bytes in `format`, "\n" written as its line break
+QByteArray encode(QStringView text, const Format &format);
+
+} // namespace TextCodec
+
+#endif // TEXTCODEC_H